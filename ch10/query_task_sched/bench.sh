@@ -0,0 +1,65 @@
+#!/bin/bash
+# ch10/query_task_sched/bench.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Programming"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Programming
+# ****************************************************************
+# Brief Description:
+# Compare the time taken to dump the scheduling attributes of all threads
+# by our ch10/query_task_sched.sh script versus our C query_task_sched app.
+# Optionally pass the number of (sleeping) dummy threads to create first,
+# so as to see how both scale (f.e. 10000).
+#
+# For details, pl refer to the book Ch 10.
+name=$(basename $0)
+TD=$(dirname $(realpath $0))
+APP=${TD}/query_task_sched
+SCRIPT=${TD}/../query_task_sched.sh
+LOOPS=10
+
+[ ! -x ${APP} ] && {
+  echo "${name}: ${APP} not built; run 'make' first"
+  exit 1
+}
+
+# Optionally spawn a bunch of sleeping threads: a process with N threads
+# (via a tiny python helper, if available)
+nthrds=${1:-0}
+[ ${nthrds} -gt 0 ] && {
+  which python3 >/dev/null || {
+    echo "${name}: need python3 to create the dummy threads"
+    exit 1
+  }
+  python3 -c "
+import threading, time
+evt = threading.Event()
+for i in range(${nthrds}):
+    threading.Thread(target=evt.wait, daemon=True).start()
+time.sleep(3600)" &
+  helper=$!
+  trap "kill ${helper} 2>/dev/null" EXIT
+  sleep 3   # let 'em all get created
+}
+
+ms_since()
+{
+echo $(( ($(date +%s%N) - $1) / 1000000 ))
+}
+
+echo "${name}: $(ls -d /proc/[0-9]*/task/[0-9]* 2>/dev/null |wc -l) threads alive"
+
+t1=$(date +%s%N)
+for i in $(seq 1 ${LOOPS}); do
+  ${APP} >/dev/null
+done
+printf "%-32s : %9d ms/run (avg over %d runs)\n" "query_task_sched (C)" \
+	$(( $(ms_since ${t1}) / LOOPS )) ${LOOPS}
+
+t1=$(date +%s%N)
+bash ${SCRIPT} >/dev/null
+printf "%-32s : %9d ms/run (1 run)\n" "query_task_sched.sh (script)" $(ms_since ${t1})
+exit 0
@@ -0,0 +1,258 @@
+/*
+ * ch10/query_task_sched/query_task_sched.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 10 : CPU Scheduling, Part 1
+ ****************************************************************
+ * Brief Description:
+ * A *userspace* C equivalent of our ch10/query_task_sched.sh script: query
+ * the scheduling attributes - policy, RT (static) priority, nice value and
+ * CPU affinity mask - of all threads currently alive on the system.
+ *
+ * The script forks chrt(1), taskset(1) and several awk/cut processes for
+ * every single thread; on a busy box that takes minutes. Here, we walk
+ * /proc/<pid>/task/<tid> just once and query each thread directly via the
+ * sched_getscheduler(2), sched_getparam(2), getpriority(2) and
+ * sched_getaffinity(2) system calls - no processes are spawned at all.
+ *
+ * The output table is the same as the script's (plus a 'Nice' column),
+ * including the 'highlighting' of real-time threads: one star for any
+ * SCHED_FIFO/SCHED_RR thread, three stars for those with an rtprio of 99.
+ * (A small difference: the script queries the policy of the *process* (PID)
+ * for every thread; here we (correctly) query each thread (TID) itself.)
+ *
+ * For details, please refer the book, Ch 10.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#ifndef SCHED_RESET_ON_FORK
+#define SCHED_RESET_ON_FORK	0x40000000
+#endif
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE		6
+#endif
+
+static int ncpus;
+static size_t cpusetsz;
+static cpu_set_t *cpuset;
+
+static const char *policy_str(int policy)
+{
+	switch (policy & ~SCHED_RESET_ON_FORK) {
+	case SCHED_OTHER:
+		return "SCHED_OTHER";
+	case SCHED_FIFO:
+		return "SCHED_FIFO";
+	case SCHED_RR:
+		return "SCHED_RR";
+	case SCHED_BATCH:
+		return "SCHED_BATCH";
+	case SCHED_IDLE:
+		return "SCHED_IDLE";
+	case SCHED_DEADLINE:
+		return "SCHED_DEADLINE";
+	}
+	return "<unknown>";
+}
+
+/*
+ * (Re)size our CPU set so that the kernel accepts it; sched_getaffinity(2)
+ * fails with EINVAL when the set is smaller than the kernel's cpumask (which
+ * can be larger than the # of CPUs configured).
+ */
+static int cpuset_alloc(int n)
+{
+	if (cpuset)
+		CPU_FREE(cpuset);
+	cpuset = CPU_ALLOC(n);
+	if (!cpuset)
+		return -1;
+	ncpus = n;
+	cpusetsz = CPU_ALLOC_SIZE(n);
+	return 0;
+}
+
+/* Render the affinity mask as hex, the same way as taskset(1) does */
+static void mask2hex(const cpu_set_t *set, char *buf, size_t bufsz)
+{
+	int cpu, b, nibble, started = 0;
+	size_t off = 0;
+
+	for (cpu = ((ncpus + 3) / 4) * 4 - 4; cpu >= 0; cpu -= 4) {
+		nibble = 0;
+		for (b = 0; b < 4; b++)
+			if (cpu + b < ncpus && CPU_ISSET_S(cpu + b, cpusetsz, set))
+				nibble |= 1 << b;
+		if (!nibble && !started && cpu)
+			continue;
+		started = 1;
+		if (off + 2 > bufsz)
+			break;
+		buf[off++] = "0123456789abcdef"[nibble];
+	}
+	buf[off] = '\0';
+}
+
+static int get_affinity(pid_t tid, char *buf, size_t bufsz)
+{
+	while (sched_getaffinity(tid, cpusetsz, cpuset) < 0) {
+		if (errno != EINVAL || ncpus >= 1024 * 1024)
+			return -1;
+		if (cpuset_alloc(ncpus * 2) < 0)
+			return -1;
+	}
+	mask2hex(cpuset, buf, bufsz);
+	return 0;
+}
+
+/* Read the thread's name (comm) via it's /proc/<pid>/task/<tid>/ dir fd */
+static void get_comm(int taskfd, const char *tidstr, char *comm, size_t sz)
+{
+	char path[288];	/* d_name can be up to 256 chars */
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/comm", tidstr);
+	strncpy(comm, "<gone>", sz);
+	fd = openat(taskfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	n = read(fd, comm, sz - 1);
+	close(fd);
+	if (n <= 0)
+		return;
+	comm[n] = '\0';
+	if (comm[n - 1] == '\n')
+		comm[n - 1] = '\0';
+}
+
+static void show_thread(int taskfd, pid_t pid, const char *tidstr, pid_t prev_pid)
+{
+	struct sched_param sp;
+	char comm[32], mask[1024];
+	int policy, nice, rt;
+	pid_t tid = atoi(tidstr);
+
+	policy = sched_getscheduler(tid);
+	if (policy < 0 || sched_getparam(tid, &sp) < 0)
+		return;		/* the thread's likely gone; skip it */
+	errno = 0;
+	nice = getpriority(PRIO_PROCESS, tid);
+	if (nice == -1 && errno)
+		return;
+	if (get_affinity(tid, mask, sizeof(mask)) < 0)
+		return;
+	get_comm(taskfd, tidstr, comm, sizeof(comm));
+
+	printf("%6d  ", pid);
+	/* if it's a child thread, indent to the right */
+	if (pid != 1 && pid == prev_pid)
+		printf("  %6d%32s", tid, comm);
+	else
+		printf("%6d  %32s", tid, comm);
+	printf("   %15s   %2d  %4d", policy_str(policy), sp.sched_priority, nice);
+
+	/* 'Highlight', with 1 star, any real-time thread, and with 3 stars,
+	 * those that have an rtprio of 99 !
+	 */
+	rt = (policy & ~SCHED_RESET_ON_FORK) == SCHED_FIFO ||
+	     (policy & ~SCHED_RESET_ON_FORK) == SCHED_RR;
+	if (rt)
+		printf("%s       %s\n", sp.sched_priority == 99 ? "   ***" : "     *", mask);
+	else
+		printf("             %s\n", mask);
+}
+
+/* Walk all threads of process @pid, i.e., the /proc/<pid>/task/ dir */
+static int show_process(int procfd, const char *pidstr, pid_t *prev_pid)
+{
+	char path[288];	/* d_name can be up to 256 chars */
+	struct dirent *de;
+	DIR *dir;
+	pid_t pid = atoi(pidstr);
+	int taskfd, nthrds = 0;
+
+	snprintf(path, sizeof(path), "%s/task", pidstr);
+	taskfd = openat(procfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (taskfd < 0)
+		return 0;	/* the process is gone */
+	dir = fdopendir(taskfd);
+	if (!dir) {
+		close(taskfd);
+		return 0;
+	}
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] < '0' || de->d_name[0] > '9')
+			continue;
+		show_thread(dirfd(dir), pid, de->d_name, *prev_pid);
+		*prev_pid = pid;
+		nthrds++;
+	}
+	closedir(dir);
+	return nthrds;
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec t1, t2;
+	struct dirent *de;
+	pid_t prev_pid = 1;
+	int procfd, nthrds = 0, timeit = 0;
+	DIR *proc;
+
+	if (argc > 1) {
+		if (!strcmp(argv[1], "-t"))
+			timeit = 1;
+		else {
+			fprintf(stderr, "Usage: %s [-t]\n"
+				" -t : show the time taken (on stderr)\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (cpuset_alloc(sysconf(_SC_NPROCESSORS_CONF)) < 0) {
+		perror("CPU_ALLOC failed");
+		exit(EXIT_FAILURE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	proc = opendir("/proc");
+	if (!proc) {
+		perror("opendir /proc failed");
+		exit(EXIT_FAILURE);
+	}
+	procfd = dirfd(proc);
+
+	printf("  PID       TID            Name                        Sched Policy  Prio Nice *RT  CPU-affinity-mask\n");
+	while ((de = readdir(proc))) {
+		if (de->d_name[0] < '0' || de->d_name[0] > '9')
+			continue;
+		nthrds += show_process(procfd, de->d_name, &prev_pid);
+	}
+	closedir(proc);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	if (timeit)
+		fprintf(stderr, "%s: %d threads queried in %.3f ms\n", argv[0], nthrds,
+			(t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_nsec - t1.tv_nsec) / 1e6);
+	CPU_FREE(cpuset);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,310 @@
+#!/bin/bash
+# ch11/cgroups_v2_cpu_eg/cgv2_cpu_sweep.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Programming"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Programming
+# ****************************************************************
+# Brief Description:
+# Our cgv2_cpu_ctrl.sh script tries out one cpu.max setting. Here, we sweep
+# over several cgroups v2 CPU controller configurations, running our
+# calibrated CPU burner (cpuburn.c) within a sub-group for each:
+#  base   : no limit at all (the baseline)
+#  max    : cpu.max = quota period, for every period in the -P list and
+#           every bandwidth percentage in the -b list (quota = period x
+#           pct/100 x threads, i.e., pct is of the CPU the burner threads
+#           could use)
+#  weight : cpu.weight = W, for every W in the -w list; as the weight only
+#           matters under contention, a competing burner runs in a sibling
+#           sub-group (at the default weight of 100) and both are confined
+#           (taskset) to one CPU
+#  cpuset : cpuset.cpus = the first N CPUs, N = 1, 2, 4, ... (only if the
+#           cpuset controller's available on the v2 hierarchy)
+# For each, we record the deltas of the sub-group's cpu.stat (usage_usec,
+# nr_periods, nr_throttled, throttled_usec) and the burner's work done and
+# work unit latency percentiles into ${OUTDIR}/cpu_sweep.csv, and plot the
+# p99 / p99.9 latency, throughput and the throttled fraction of periods per
+# configuration (via gnuplot, if installed) into ${OUTDIR}/cpu_sweep.png.
+#
+# The tail latency's what a throttled group pays: with a short period, the
+# group's throttled often but briefly; with a long one, rarely but for
+# long. Pick the period/quota that keeps the p99 within your budget.
+#
+# For details, pl refer to the book Ch 11.
+#
+# Additional Ref:
+# https://www.kernel.org/doc/html/latest/admin-guide/cgroup-v2.html#cpu
+# https://www.kernel.org/doc/html/latest/scheduler/sched-bwc.html
+name=$(basename $0)
+TD=$(dirname $(realpath $0))
+BURN=${TD}/cpuburn
+TDIR=cpu_sweep_test
+HOGDIR=cpu_sweep_hog
+
+# Defaults
+THREADS=$(nproc)
+DURATION=5                            # seconds, per configuration
+UNIT_US=100                           # the burner's work unit (CPU time)
+PERIODS="10000 50000 100000 250000 1000000"   # us
+PCTS="25 50 75"
+WEIGHTS="25 100 400"
+OUTDIR=.
+
+usage()
+{
+  echo "Usage: ${name} [-t threads] [-d duration-s] [-u unit-us] [-P \"periods-us\"]
+    [-b \"bandwidth-pcts\"] [-w \"weights\"] [-o outdir]
+ -t : # of burner threads (default: # of CPUs, here ${THREADS})
+ -d : how long to run each configuration, in seconds (default ${DURATION})
+ -u : the CPU time per work unit, in us (default ${UNIT_US})
+ -P : the cpu.max periods to sweep, in us (default \"${PERIODS}\")
+ -b : the bandwidths to sweep, as a % of the threads' CPU (default \"${PCTS}\")
+ -w : the cpu.weight values to sweep (default \"${WEIGHTS}\")
+ -o : the output directory for the CSV and PNG files (default: .)"
+  exit 1
+}
+
+# cleanup
+remove_subgroups()
+{
+local d
+for d in ${TDIR} ${HOGDIR} ; do
+  [ -d ${CGV2_MNT}/${d} ] || continue
+  if [ -f ${CGV2_MNT}/${d}/cgroup.kill ] ; then   # 5.14 on
+    echo 1 > ${CGV2_MNT}/${d}/cgroup.kill
+  else
+    kill -9 $(cat ${CGV2_MNT}/${d}/cgroup.procs) 2>/dev/null
+  fi
+  sleep 0.2
+  rmdir ${CGV2_MNT}/${d}
+done
+} # end remove_subgroups()
+
+# Final cleanup: also turn off the controllers we enabled (in reverse order),
+# leaving the root's cgroup.subtree_control as we found it
+cleanup()
+{
+local c
+remove_subgroups
+for c in ${ENABLED_CTRLS} ; do
+  echo "-${c}" > ${CGV2_MNT}/cgroup.subtree_control 2>/dev/null
+done
+ENABLED_CTRLS=""
+} # end cleanup()
+
+# Is the controller $1 already enabled for the root's children?
+ctrl_enabled()
+{
+grep -qw $1 ${CGV2_MNT}/cgroup.subtree_control
+}
+
+setup_cgv2_cpu()
+{
+echo "[+] Adding the 'cpu' (and, if available, 'cpuset') controller to the cgroups v2 hierarchy"
+ENABLED_CTRLS=""
+ctrl_enabled cpu || {
+  echo "+cpu" > ${CGV2_MNT}/cgroup.subtree_control || {
+    echo "Adding cpu controller failed, aborting.
+Note: the presence of any RT process in this group will cause the 'cpu' controller addition to fail"
+    exit 1
+  }
+  ENABLED_CTRLS="cpu"
+}
+HAVE_CPUSET=0
+if ctrl_enabled cpuset ; then
+  HAVE_CPUSET=1
+elif grep -qw cpuset ${CGV2_MNT}/cgroup.controllers && \
+     echo "+cpuset" > ${CGV2_MNT}/cgroup.subtree_control 2>/dev/null ; then
+  HAVE_CPUSET=1
+  ENABLED_CTRLS="cpuset ${ENABLED_CTRLS}"
+fi
+[ ${HAVE_CPUSET} -eq 0 ] && echo "(the cpuset controller's unavailable; skipping the cpuset variants)"
+} # end setup_cgv2_cpu()
+
+# Create (afresh) the sub-group $1
+mk_subgroup()
+{
+[ -d ${CGV2_MNT}/$1 ] && rmdir ${CGV2_MNT}/$1
+mkdir ${CGV2_MNT}/$1 || {
+  echo "Warning! creating sub-dir ${CGV2_MNT}/$1 failed..."
+  exit 1
+}
+} # end mk_subgroup()
+
+# Print the value of the key $1 in the flat keyed file $2 (0 if absent)
+getkey()
+{
+awk -v k=$1 '$1 == k {v=$2} END {print v+0}' $2
+}
+
+# Print the cpu.stat values we track, space-separated
+get_cpustat()
+{
+local f=${CGV2_MNT}/${TDIR}/cpu.stat
+echo "$(getkey usage_usec $f) $(getkey nr_periods $f) $(getkey nr_throttled $f) $(getkey throttled_usec $f)"
+}
+
+# Run one configuration:
+#  run_one kind quota period weight cpus
+# (cpus is a cpulist for cpuset.cpus, "all" for all, or "tsN" to confine our
+# burner and the competing one to CPU N via taskset)
+run_one()
+{
+local kind=$1 quota=$2 period=$3 weight=$4 cpus=$5
+local cg=${CGV2_MNT}/${TDIR} pfx="" label before after res hogpid=""
+
+case ${kind} in
+  max)    label="max:${quota}/${period}" ;;
+  weight) label="weight:${weight}" ;;
+  cpuset) label="cpuset:${cpus}" ;;
+  *)      label=${kind} ;;
+esac
+
+mk_subgroup ${TDIR}
+echo "${quota} ${period}" > ${cg}/cpu.max || {
+  echo "Error! updating cpu.max (${quota} ${period}) failed; skipping ${label}"
+  rmdir ${cg} ; return
+}
+echo ${weight} > ${cg}/cpu.weight
+if [ ${kind} = "cpuset" ] ; then
+  echo ${cpus} > ${cg}/cpuset.cpus || {
+    echo "Error! updating cpuset.cpus (${cpus}) failed; skipping ${label}"
+    rmdir ${cg} ; return
+  }
+elif [ ${kind} = "weight" ] ; then
+  pfx="taskset -c ${cpus#ts}"
+  mk_subgroup ${HOGDIR}
+  ( echo ${BASHPID} > ${CGV2_MNT}/${HOGDIR}/cgroup.procs && \
+    exec ${pfx} ${BURN} -l ${LOOPS} -t ${THREADS} -d $((DURATION+1)) -c ) >/dev/null &
+  hogpid=$!
+fi
+
+before=$(get_cpustat)
+# the subshell moves itself into the sub-group and then becomes the burner
+res=$( echo ${BASHPID} > ${cg}/cgroup.procs && \
+       exec ${pfx} ${BURN} -l ${LOOPS} -t ${THREADS} -d ${DURATION} -c )
+after=$(get_cpustat)
+[ ! -z "${hogpid}" ] && {
+  kill ${hogpid} 2>/dev/null ; wait ${hogpid} 2>/dev/null
+}
+[ -z "${res}" ] && res="0,0,0,0,0,0"
+
+set -- ${before} ${after}
+echo "${label},${kind},${quota},${period},${weight},${cpus},${THREADS},\
+$(($5-$1)),$(($6-$2)),$(($7-$3)),$(($8-$4)),${res}" >> ${CSV}
+tail -n1 ${CSV}
+remove_subgroups
+} # end run_one()
+
+plot()
+{
+which gnuplot >/dev/null || {
+  echo "(gnuplot not installed; not plotting)"
+  return
+}
+local png=${OUTDIR}/cpu_sweep.png
+echo -n -e "set terminal png size 1200,900\n\
+    set output \"${png}\"\n\
+    set datafile separator \",\"\n\
+    set key autotitle columnhead\n\
+    set multiplot layout 2,1 title \"cgroups v2 CPU controller sweep: ${THREADS} thread(s), \
+${DURATION} s each; kernel: $(uname -r)\"\n\
+    set xtics rotate by -45 noenhanced\n\
+    set grid\n\
+    set logscale y\n\
+    set ylabel \"work unit latency (us)\"\n\
+    plot \"${CSV}\" using 0:15:xtic(1) with linespoints title \"p99\", \
+\"\" using 0:16 with linespoints title \"p99.9\"\n\
+    unset logscale y\n\
+    set ylabel \"work units/s\"\n\
+    set y2label \"throttled periods (%)\"\n\
+    set y2tics\n\
+    set y2range [0:100]\n\
+    plot \"${CSV}\" using 0:13:xtic(1) with boxes fill solid 0.3 title \"units/s\", \
+\"\" using 0:(\$9 > 0 ? 100.0*\$10/\$9 : 0) axes x1y2 with linespoints title \"% throttled\"\n\
+    unset multiplot\n" > ${OUTDIR}/plotcmd_cpu_sweep
+gnuplot ${OUTDIR}/plotcmd_cpu_sweep && echo "[+] Plot: ${png}"
+} # end plot()
+
+
+### "main" here
+
+[ $(id -u) -ne 0 ] && {
+   echo "$0: need root."
+   exit 1
+}
+while getopts "t:d:u:P:b:w:o:h" opt; do
+  case "${opt}" in
+    t) THREADS=${OPTARG} ;;
+    d) DURATION=${OPTARG} ;;
+    u) UNIT_US=${OPTARG} ;;
+    P) PERIODS=${OPTARG} ;;
+    b) PCTS=${OPTARG} ;;
+    w) WEIGHTS=${OPTARG} ;;
+    o) OUTDIR=${OPTARG} ;;
+    *) usage ;;
+  esac
+done
+
+[ ! -x ${BURN} ] && {
+  echo "${name}: the cpuburn program isn't built; running make ..."
+  make -C ${TD} cpuburn || exit 1
+}
+
+mount |grep -q cgroup2 || {
+  echo "No cgroup2 filesystem mounted? Pl mount one first; aborting..."
+  exit 1
+}
+export CGV2_MNT=$(mount |grep cgroup2 |head -n1 |awk '{print $3}')
+[ -z "${CGV2_MNT}" ] && {
+  echo "cgroup2 filesystem not acquired, aborting..."
+  exit 1
+}
+grep -qw cpu ${CGV2_MNT}/cgroup.controllers || {
+  echo "The cpu controller isn't available on the cgroup v2 hierarchy, aborting..."
+  exit 1
+}
+
+mkdir -p ${OUTDIR} || exit 1
+CSV=${OUTDIR}/cpu_sweep.csv
+
+remove_subgroups
+setup_cgv2_cpu
+trap cleanup EXIT
+trap 'exit 1' INT QUIT TERM
+
+echo "[+] Calibrating the burner's work unit (${UNIT_US} us of CPU)"
+LOOPS=$(${BURN} -u ${UNIT_US} -L) || exit 1
+
+echo "config,kind,quota_us,period_us,weight,cpus,threads,\
+usage_usec,nr_periods,nr_throttled,throttled_usec,\
+units,units_per_s,p50_us,p99_us,p999_us,max_us" > ${CSV}
+
+echo "[+] Sweeping (${DURATION}s per configuration) into ${CSV}"
+run_one base max 100000 100 all
+for period in ${PERIODS} ; do
+  for pct in ${PCTS} ; do
+    quota=$((period*pct*THREADS/100))
+    [ ${quota} -lt 1000 ] && {    # the kernel's minimum quota's 1 ms
+      echo "(skipping ${pct}% of period ${period}: quota < 1000 us)"
+      continue
+    }
+    run_one max ${quota} ${period} 100 all
+  done
+done
+for w in ${WEIGHTS} ; do
+  run_one weight max 100000 ${w} ts0
+done
+if [ ${HAVE_CPUSET} -eq 1 ] ; then
+  n=1
+  while [ ${n} -le $(nproc) ] ; do
+    run_one cpuset max 100000 100 0-$((n-1))
+    n=$((n*2))
+  done
+fi
+
+plot
+exit 0
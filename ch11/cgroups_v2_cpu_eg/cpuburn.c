@@ -0,0 +1,234 @@
+/*
+ * ch11/cgroups_v2_cpu_eg/cpuburn.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 11 : CPU Scheduling, Part 2
+ ****************************************************************
+ * Brief Description:
+ * A calibrated CPU 'burner', for our cgroups v2 CPU controller sweep
+ * (cgv2_cpu_sweep.sh). Unlike simp.sh's shell arithmetic, the work's
+ * quantifiable: we first calibrate a 'work unit' to take a given amount of
+ * *CPU* time (default 100 us; calibrated against the thread's CPU-time
+ * clock, so a throttled or contended CPU doesn't skew it). Then, 'threads'
+ * threads perform work units back-to-back for the given duration, timing
+ * each one by the wall clock. A unit that takes longer than its CPU time
+ * was delayed - preempted or, within a bandwidth-limited cgroup, throttled
+ * till the next period - and that's the tail latency we report:
+ *  units (completed), units/s, and the p50, p99, p99.9 and max latency of
+ *  a work unit in us.
+ * With -c, that's emitted as one CSV line (for the sweep script). The sweep
+ * calibrates just once (-L) and passes the result along (-l), so that the
+ * calibration itself doesn't run within (and skew) the cgroup under test.
+ *
+ * For details, please refer the book, Ch 11.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+static int nthreads = 1, secs = 5, unit_us = 100, csv, calib_only;
+static uint64_t unit_loops;	/* calibrated: loops per work unit */
+static volatile int stop;
+
+struct burner {
+	pthread_t tid;
+	uint32_t *lat;		/* per work unit latency, us */
+	size_t n, max;
+};
+
+static uint64_t ts_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* The work: an integer dependency chain the compiler can't elide */
+static uint64_t burn(uint64_t loops)
+{
+	static volatile uint64_t sink;
+	uint64_t x = 88172645463325252ULL, i;
+
+	for (i = 0; i < loops; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+	}
+	sink = x;
+	return sink;
+}
+
+/*
+ * Find the # of loops taking unit_us of CPU time: double up till a run
+ * takes >= 50 ms of CPU time, then scale; take the best of a few tries.
+ */
+static void calibrate(void)
+{
+	uint64_t loops = 1000, t, best = 0;
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		for (loops = 1000; ; loops *= 2) {
+			t = ts_ns(CLOCK_THREAD_CPUTIME_ID);
+			burn(loops);
+			t = ts_ns(CLOCK_THREAD_CPUTIME_ID) - t;
+			if (t >= 50000000ULL)
+				break;
+		}
+		if (loops * 1000ULL * unit_us / t > best)
+			best = loops * 1000ULL * unit_us / t;
+	}
+	unit_loops = best ? best : 1;
+}
+
+static void *burner_fn(void *arg)
+{
+	struct burner *b = arg;
+	uint64_t t0, t1;
+	uint32_t *p;
+
+	t0 = ts_ns(CLOCK_MONOTONIC);
+	while (!stop) {
+		burn(unit_loops);
+		t1 = ts_ns(CLOCK_MONOTONIC);
+		if (b->n == b->max) {
+			b->max = b->max ? b->max * 2 : 65536;
+			p = realloc(b->lat, b->max * sizeof(uint32_t));
+			if (!p)
+				break;
+			b->lat = p;
+		}
+		b->lat[b->n++] = (t1 - t0) / 1000;
+		t0 = t1;
+	}
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-t threads] [-d seconds] [-u unit-us] [-l loops | -L] [-c]\n"
+		" -t : # of burner threads (default %d)\n"
+		" -d : how long to run, in seconds (default %d)\n"
+		" -u : the CPU time a work unit's calibrated to take, in us (default %d)\n"
+		" -l : skip the calibration; a work unit's this many loops\n"
+		" -L : just calibrate, printing the # of loops per work unit\n"
+		" -c : print the result as one CSV line:\n"
+		"      units,units_per_s,p50_us,p99_us,p999_us,max_us\n",
+		name, nthreads, secs, unit_us);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct burner *b;
+	struct timespec ts;
+	uint32_t *all;
+	size_t n = 0;
+	int opt, i, given;
+
+	while ((opt = getopt(argc, argv, "t:d:u:l:Lch")) != -1) {
+		switch (opt) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'd':
+			secs = atoi(optarg);
+			break;
+		case 'u':
+			unit_us = atoi(optarg);
+			break;
+		case 'l':
+			unit_loops = strtoull(optarg, NULL, 0);
+			break;
+		case 'L':
+			calib_only = 1;
+			break;
+		case 'c':
+			csv = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nthreads <= 0 || secs <= 0 || unit_us <= 0)
+		usage(argv[0]);
+
+	given = unit_loops != 0;
+	if (!given || calib_only)
+		calibrate();
+	if (calib_only) {
+		printf("%lu\n", (unsigned long)unit_loops);
+		exit(EXIT_SUCCESS);
+	}
+	if (!csv)
+		printf("%s: %d thread(s) for %d s; work unit = %lu loops (%s)\n",
+		       argv[0], nthreads, secs, (unsigned long)unit_loops,
+		       given ? "as given" : "calibrated");
+
+	b = calloc(nthreads, sizeof(struct burner));
+	if (!b) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&b[i].tid, NULL, burner_fn, &b[i])) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	ts.tv_sec = secs;
+	ts.tv_nsec = 0;
+	nanosleep(&ts, NULL);
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(b[i].tid, NULL);
+		n += b[i].n;
+	}
+
+	/* merge all the threads' samples */
+	all = malloc((n ? n : 1) * sizeof(uint32_t));
+	if (!all) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0, n = 0; i < nthreads; i++) {
+		memcpy(all + n, b[i].lat, b[i].n * sizeof(uint32_t));
+		n += b[i].n;
+		free(b[i].lat);
+	}
+	free(b);
+	if (!n) {
+		fprintf(stderr, "%s: no work unit completed\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	qsort(all, n, sizeof(uint32_t), cmp_u32);
+
+	if (csv)
+		printf("%zu,%.1f,%u,%u,%u,%u\n", n, (double)n / secs, all[n / 2],
+		       all[n * 99 / 100], all[n * 999 / 1000], all[n - 1]);
+	else
+		printf("%zu work units (%.1f/s); latency (us): p50 %u  p99 %u  p99.9 %u  max %u\n",
+		       n, (double)n / secs, all[n / 2], all[n * 99 / 100],
+		       all[n * 999 / 1000], all[n - 1]);
+	free(all);
+	exit(EXIT_SUCCESS);
+}
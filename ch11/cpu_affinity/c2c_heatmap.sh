@@ -0,0 +1,65 @@
+#!/bin/bash
+# ch11/cpu_affinity/c2c_heatmap.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Programming"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Programming
+# ***************************************************************
+# Brief Description:
+# Run our c2c_latency app (unless a CSV matrix it generated is passed) and
+# plot the core-to-core round-trip latency matrix as a heatmap, via gnuplot
+# (as with ch11/latency_tests/latency_test.sh). The PNG's named
+#  c2c_$(uname -r).png
+# Extra args (after the optional CSV file) are passed along to c2c_latency,
+# f.e.
+#  ./c2c_heatmap.sh -c 0-7 -s 11
+#
+# For details, refer the book, Ch 11.
+name=$(basename $0)
+TD=$(dirname $(realpath $0))
+C2C=${TD}/c2c_latency
+
+which gnuplot >/dev/null || {
+  echo "${name}: gnuplot not installed? aborting..."
+  exit 1
+}
+
+if [ $# -ge 1 -a -f "$1" ] ; then
+  csv=$1
+  shift
+else
+  [ ! -x ${C2C} ] && {
+    echo "${name}: the c2c_latency program isn't built; running make ..."
+    make -C ${TD} c2c_latency || exit 1
+  }
+  csv=c2c_$(uname -r).csv
+  echo "${C2C} -o ${csv} $@"
+  ${C2C} -o ${csv} "$@" || exit 1
+fi
+
+ncpus=$(head -n1 ${csv} | awk -F, '{print NF-1}')
+[ ${ncpus} -lt 2 ] && {
+  echo "${name}: need at least two CPUs in the matrix to plot"
+  exit 1
+}
+# scale the image with the # of CPUs
+sz=$((ncpus*20 + 200))
+[ ${sz} -lt 640 ] && sz=640
+
+echo -n -e "set title \"Core-to-core round-trip latency (ns); kernel: $(uname -r)\"\n\
+    set terminal png size ${sz},${sz}\n\
+    set output \"c2c_$(uname -r).png\"\n\
+    set datafile separator \",\"\n\
+    set datafile missing \"nan\"\n\
+    set xlabel \"pong CPU\"\n\
+    set ylabel \"ping CPU\"\n\
+    set size square\n\
+    set yrange [*:*] reverse\n\
+    set palette rgb 33,13,10\n\
+    set cblabel \"ns\"\n\
+    plot \"${csv}\" matrix rowheaders columnheaders with image notitle\n" >plotcmd_c2c
+
+gnuplot <plotcmd_c2c && echo "${name}: heatmap: c2c_$(uname -r).png (from ${csv})"
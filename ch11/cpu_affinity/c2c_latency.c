@@ -0,0 +1,289 @@
+/*
+ * ch11/cpu_affinity/c2c_latency.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 11 : CPU Scheduling, Part 2
+ ****************************************************************
+ * Brief Description:
+ * Core-to-core ('c2c') communication latency: for every pair of (allowed)
+ * CPUs (a, b), we pin a 'ping' thread to a and a 'pong' thread to b and
+ * have them bounce a single cache line between them: ping stores an odd
+ * sequence # and spins until it sees pong's (even) reply, pong spins until
+ * it sees ping's store and replies. Each round trip thus costs two cache
+ * line transfers (plus the coherence protocol's invalidations) - exactly
+ * what a producer/consumer pair placed on those two CPUs pays per hand-off.
+ *
+ * We time batches of round trips and report the median batch's round-trip
+ * latency (in ns) as an NxN matrix in CSV form (row: ping CPU, col: pong
+ * CPU; the diagonal's 'nan'), followed by a summary per topological
+ * relation (SMT siblings, same LLC, other LLC, other NUMA node).
+ * Plot it as a heatmap via our c2c_heatmap.sh script.
+ *
+ * For details, please refer the book, Ch 11.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include "cpu_topo.h"
+
+static int iters = 1000, nsamples = 25;
+
+/* The cache line that's bounced; alone on its line */
+static struct {
+	uint64_t seq;
+	char pad[64 - sizeof(uint64_t)];
+} line __attribute__((aligned(64)));
+
+struct pp_ctx {
+	pthread_barrier_t bar;
+	double *samples;	/* ns per round trip, per batch */
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Spin until the line holds @val. Should both threads ever end up on one
+ * CPU (pinning failed, or the CPU's oversubscribed), yielding now and then
+ * keeps us from spinning away whole timeslices.
+ */
+static inline void wait_for(uint64_t val)
+{
+	unsigned long spins = 0;
+
+	while (__atomic_load_n(&line.seq, __ATOMIC_ACQUIRE) != val)
+		if (++spins % (1 << 20) == 0)
+			sched_yield();
+}
+
+static void *pong(void *arg)
+{
+	struct pp_ctx *ctx = arg;
+	uint64_t n = (uint64_t)iters * nsamples, i;
+
+	pthread_barrier_wait(&ctx->bar);
+	for (i = 0; i < n; i++) {
+		wait_for(2 * i + 1);
+		__atomic_store_n(&line.seq, 2 * i + 2, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void *ping(void *arg)
+{
+	struct pp_ctx *ctx = arg;
+	uint64_t i = 0, t0;
+	int s, j;
+
+	pthread_barrier_wait(&ctx->bar);
+	for (s = 0; s < nsamples; s++) {
+		t0 = now_ns();
+		for (j = 0; j < iters; j++, i++) {
+			__atomic_store_n(&line.seq, 2 * i + 1, __ATOMIC_RELEASE);
+			wait_for(2 * i + 2);
+		}
+		ctx->samples[s] = (double)(now_ns() - t0) / iters;
+	}
+	return NULL;
+}
+
+static int cmp_dbl(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The (median) round-trip latency in ns between CPUs @a and @b; <0 on failure */
+static double pingpong(const struct cpu_topo *t, int a, int b)
+{
+	struct pp_ctx ctx;
+	pthread_t tping, tpong;
+	double ret;
+
+	ctx.samples = calloc(nsamples, sizeof(double));
+	if (!ctx.samples)
+		return -1;
+	line.seq = 0;
+	pthread_barrier_init(&ctx.bar, NULL, 3);
+	if (pthread_create(&tpong, NULL, pong, &ctx) ||
+	    pthread_create(&tping, NULL, ping, &ctx)) {
+		fprintf(stderr, "pthread_create failed\n");
+		exit(EXIT_FAILURE);
+	}
+	if (cpu_topo_pin(t, tping, a) || cpu_topo_pin(t, tpong, b))
+		fprintf(stderr, "warning: pinning to CPUs %d,%d failed\n", a, b);
+	pthread_barrier_wait(&ctx.bar);
+	pthread_join(tping, NULL);
+	pthread_join(tpong, NULL);
+	pthread_barrier_destroy(&ctx.bar);
+
+	qsort(ctx.samples, nsamples, sizeof(double), cmp_dbl);
+	ret = ctx.samples[nsamples / 2];
+	free(ctx.samples);
+	return ret;
+}
+
+enum { R_SMT, R_LLC, R_XLLC, R_NUMA, NR_RELS };
+static const char *rel_name[NR_RELS] = {
+	"SMT siblings", "same LLC", "other LLC", "other node"
+};
+
+static int relation(const struct cpu_topo *t, int a, int b)
+{
+	if (t->cpu[a].node != t->cpu[b].node)
+		return R_NUMA;
+	if (CPU_ISSET_S(b, t->masksz, t->cpu[a].smt))
+		return R_SMT;
+	if (CPU_ISSET_S(b, t->masksz, t->cpu[a].llc_cpus))
+		return R_LLC;
+	return R_XLLC;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-c cpulist] [-n round-trips] [-s samples] [-o file.csv]\n"
+		" -c : the CPUs to measure, a cpulist (f.e. 0-3,8); default: all allowed\n"
+		" -n : # of round trips per sample (default %d)\n"
+		" -s : # of samples per CPU pair; we report the median (default %d)\n"
+		" -o : write the matrix (CSV) to this file (default: stdout)\n",
+		name, iters, nsamples);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct cpu_topo *t;
+	cpu_set_t *cpus;
+	char *cpulist = NULL, *outfile = NULL;
+	double *lat, v, sum[NR_RELS] = { 0 }, min[NR_RELS], max[NR_RELS];
+	int opt, a, b, r, *cnt, n = 0, *idx;
+	FILE *out = stdout;
+
+	while ((opt = getopt(argc, argv, "c:n:s:o:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			cpulist = optarg;
+			break;
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		case 's':
+			nsamples = atoi(optarg);
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (iters <= 0 || nsamples <= 0)
+		usage(argv[0]);
+
+	t = cpu_topo_read();
+	if (!t) {
+		fprintf(stderr, "%s: reading the CPU topology failed, aborting...\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	cpus = CPU_ALLOC(t->ncpus);
+	idx = calloc(t->ncpus, sizeof(int));
+	cnt = calloc(NR_RELS, sizeof(int));
+	if (!cpus || !idx || !cnt)
+		exit(EXIT_FAILURE);
+	if (cpulist) {
+		if (cpu_topo_parse_cpulist(t, cpulist, cpus) < 0)
+			usage(argv[0]);
+		CPU_AND_S(t->masksz, cpus, cpus, t->allowed);
+	} else {
+		memcpy(cpus, t->allowed, t->masksz);
+	}
+	for (a = 0; a < t->ncpus; a++)
+		if (CPU_ISSET_S(a, t->masksz, cpus))
+			idx[n++] = a;
+	if (n < 2)
+		fprintf(stderr, "%s: warning: fewer than two CPUs to measure\n", argv[0]);
+	lat = calloc((size_t)n * n, sizeof(double));
+	if (!lat)
+		exit(EXIT_FAILURE);
+
+	fprintf(stderr, "%s: %d CPUs, %d pairs; %d samples of %d round trips each\n",
+		argv[0], n, n * (n - 1), nsamples, iters);
+	for (a = 0; a < n; a++) {
+		for (b = 0; b < n; b++) {
+			if (a == b) {
+				lat[a * n + b] = NAN;
+				continue;
+			}
+			v = pingpong(t, idx[a], idx[b]);
+			if (v < 0)
+				exit(EXIT_FAILURE);
+			lat[a * n + b] = v;
+			r = relation(t, idx[a], idx[b]);
+			if (!cnt[r] || v < min[r])
+				min[r] = v;
+			if (!cnt[r] || v > max[r])
+				max[r] = v;
+			sum[r] += v;
+			cnt[r]++;
+		}
+		fprintf(stderr, ".");
+	}
+	fprintf(stderr, "\n");
+
+	if (outfile) {
+		out = fopen(outfile, "w");
+		if (!out) {
+			perror(outfile);
+			exit(EXIT_FAILURE);
+		}
+	}
+	fprintf(out, "cpu");
+	for (b = 0; b < n; b++)
+		fprintf(out, ",%d", idx[b]);
+	fprintf(out, "\n");
+	for (a = 0; a < n; a++) {
+		fprintf(out, "%d", idx[a]);
+		for (b = 0; b < n; b++)
+			fprintf(out, isnan(lat[a * n + b]) ? ",nan" : ",%.1f", lat[a * n + b]);
+		fprintf(out, "\n");
+	}
+	if (outfile) {
+		fclose(out);
+		printf("round-trip latency matrix (ns) written to %s\n", outfile);
+	}
+
+	printf("\n%-13s %6s %10s %10s %10s   (round trip, ns)\n", "relation", "pairs",
+	       "min", "avg", "max");
+	for (r = 0; r < NR_RELS; r++) {
+		if (!cnt[r])
+			printf("%-13s %6d %10s\n", rel_name[r], 0, "-");
+		else
+			printf("%-13s %6d %10.1f %10.1f %10.1f\n", rel_name[r], cnt[r],
+			       min[r], sum[r] / cnt[r], max[r]);
+	}
+	free(lat);
+	free(idx);
+	free(cnt);
+	CPU_FREE(cpus);
+	cpu_topo_free(t);
+	exit(EXIT_SUCCESS);
+}
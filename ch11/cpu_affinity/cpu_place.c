@@ -0,0 +1,250 @@
+/*
+ * ch11/cpu_affinity/cpu_place.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 11 : CPU Scheduling, Part 2
+ ****************************************************************
+ * Brief Description:
+ * Our userspc_cpuaffinity app sets whatever raw bitmask it's given; here,
+ * we instead let the topology decide. With no options, we show the CPU
+ * topology (as read by cpu_topo.c); with -n N -p policy, we show where N
+ * worker threads would be placed as per the policy:
+ *  none       : not pinned at all; the scheduler decides
+ *  spread-llc : round-robin across the LLCs, one thread per core first
+ *  pack-llc   : all threads within one LLC, one per core first
+ *  no-smt     : one thread per core, never on SMT siblings
+ *
+ * With -B, we benchmark the policies (all of them, or just the one given
+ * via -p) on a shared-memory workload: the N threads perform random atomic
+ * increments on a table of counters they all share, plus a read of a
+ * shared (read-mostly) lookup table per increment. Threads within an LLC
+ * share the cache lines they write; across LLCs (or sockets), every
+ * increment's a potential cache-line migration. We report the aggregate
+ * throughput of each policy, relative to 'none'.
+ *
+ * For details, please refer the book, Ch 11.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "cpu_topo.h"
+
+static int nthreads, ms = 1000, tbl_kb = 256;
+static uint64_t *counters;		/* the shared (written) table */
+static uint32_t *lookup;		/* the shared (read-mostly) table */
+static size_t nslots;
+
+struct worker {
+	pthread_t tid;
+	int cpu;
+	uint64_t seed;
+	volatile uint64_t ops;
+	pthread_barrier_t *bar;
+	volatile int *stop;
+};
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t x = w->seed, ops = 0, sum = 0;
+	int i;
+
+	pthread_barrier_wait(w->bar);	/* we've been pinned by now */
+	while (!*w->stop) {
+		for (i = 0; i < 1024; i++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			sum += lookup[(x >> 32) % nslots];
+			__atomic_fetch_add(&counters[x % nslots], 1, __ATOMIC_RELAXED);
+		}
+		ops += 1024;
+		w->ops = ops;
+	}
+	if (sum == 1)		/* keep the compiler from eliding the reads */
+		printf("!");
+	return NULL;
+}
+
+/* Run the workload on @nthreads threads placed on @cpus; returns ops/s */
+static double run(const struct cpu_topo *t, const int *cpus)
+{
+	struct worker *w = calloc(nthreads, sizeof(struct worker));
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	pthread_barrier_t bar;
+	volatile int stop = 0;
+	uint64_t total = 0;
+	int i, ret;
+
+	if (!w)
+		return -1;
+	memset(counters, 0, nslots * sizeof(uint64_t));
+	pthread_barrier_init(&bar, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		w[i].cpu = cpus[i];
+		w[i].seed = 88172645463325252ULL + i * 0x9E3779B97F4A7C15ULL;
+		w[i].bar = &bar;
+		w[i].stop = &stop;
+		ret = pthread_create(&w[i].tid, NULL, worker_fn, &w[i]);
+		if (ret) {
+			fprintf(stderr, "pthread_create failed (%d)\n", ret);
+			exit(EXIT_FAILURE);
+		}
+		ret = cpu_topo_pin(t, w[i].tid, cpus[i]);
+		if (ret)
+			fprintf(stderr, "pinning thread %d to CPU %d failed (%d)\n", i, cpus[i], ret);
+	}
+	pthread_barrier_wait(&bar);
+	nanosleep(&ts, NULL);
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(w[i].tid, NULL);
+		total += w[i].ops;
+	}
+	pthread_barrier_destroy(&bar);
+	free(w);
+	return total * 1000.0 / ms;
+}
+
+static void print_placement(const int *cpus)
+{
+	int i;
+
+	for (i = 0; i < nthreads; i++) {
+		if (cpus[i] < 0)
+			printf("%s*", i ? "," : "");
+		else
+			printf("%s%d", i ? "," : "", cpus[i]);
+	}
+}
+
+static int bench(const struct cpu_topo *t, int policy)
+{
+	int *cpus = calloc(nthreads, sizeof(int));
+	double tput, base = 0;
+	size_t i;
+	int p;
+
+	nslots = (size_t)tbl_kb * 1024 / sizeof(uint64_t);
+	counters = aligned_alloc(64, nslots * sizeof(uint64_t));
+	lookup = malloc(nslots * sizeof(uint32_t));
+	if (!cpus || !counters || !lookup)
+		return -1;
+	for (i = 0; i < nslots; i++)
+		lookup[i] = i * 2654435761U;
+
+	printf("\nBenchmark: %d threads, %d ms per policy, shared table of %d KB\n",
+	       nthreads, ms, tbl_kb);
+	printf("%-11s %14s %6s  %s\n", "policy", "Mops/s", "rel", "cpus (*: not pinned)");
+	for (p = 0; p < CT_NR_POLICIES; p++) {
+		if (policy >= 0 && p != policy && p != CT_NONE)
+			continue;
+		if (cpu_topo_place(t, nthreads, p, cpus) < 0) {
+			printf("%-11s %14s\n", cpu_topo_policy_name(p), "n/a");
+			continue;
+		}
+		tput = run(t, cpus);
+		if (tput < 0)
+			return -1;
+		if (p == CT_NONE)
+			base = tput;
+		printf("%-11s %14.2f %6.2f  ", cpu_topo_policy_name(p), tput / 1e6,
+		       base ? tput / base : 0);
+		print_placement(cpus);
+		printf("\n");
+	}
+	free(cpus);
+	free(counters);
+	free(lookup);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	int p;
+
+	fprintf(stderr,
+		"Usage: %s [-n threads] [-p policy] [-B [-d ms] [-s table-KB]]\n"
+		" (no options)  : show the CPU topology\n"
+		" -n : # of worker threads (default: the # of cores)\n"
+		" -p : the placement policy; one of:",
+		name);
+	for (p = 0; p < CT_NR_POLICIES; p++)
+		fprintf(stderr, " %s", cpu_topo_policy_name(p));
+	fprintf(stderr, "\n"
+		" -B : benchmark the policies (all of them, or 'none' and the one given via -p)\n"
+		" -d : the duration of each run in ms (default %d)\n"
+		" -s : the size of the shared counter table in KB (default %d)\n",
+		ms, tbl_kb);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct cpu_topo *t;
+	int opt, policy = -1, do_bench = 0, *cpus;
+
+	while ((opt = getopt(argc, argv, "n:p:Bd:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nthreads = atoi(optarg);
+			break;
+		case 'p':
+			policy = cpu_topo_policy_parse(optarg);
+			if (policy < 0)
+				usage(argv[0]);
+			break;
+		case 'B':
+			do_bench = 1;
+			break;
+		case 'd':
+			ms = atoi(optarg);
+			break;
+		case 's':
+			tbl_kb = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nthreads < 0 || ms <= 0 || tbl_kb <= 0)
+		usage(argv[0]);
+
+	t = cpu_topo_read();
+	if (!t) {
+		fprintf(stderr, "%s: reading the CPU topology failed, aborting...\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (!nthreads)
+		nthreads = t->nr_cores;
+	cpu_topo_print(t);
+
+	if (policy >= 0 && !do_bench) {
+		cpus = calloc(nthreads, sizeof(int));
+		if (!cpus || cpu_topo_place(t, nthreads, policy, cpus) < 0) {
+			fprintf(stderr, "%s: placement failed\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		printf("\n%d threads, policy %s: cpus ", nthreads, cpu_topo_policy_name(policy));
+		print_placement(cpus);
+		printf("\n");
+		free(cpus);
+	}
+	if (do_bench && bench(t, policy) < 0) {
+		fprintf(stderr, "%s: benchmark failed\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	cpu_topo_free(t);
+	exit(EXIT_SUCCESS);
+}
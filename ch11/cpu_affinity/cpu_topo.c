@@ -0,0 +1,356 @@
+/*
+ * ch11/cpu_affinity/cpu_topo.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 11 : CPU Scheduling, Part 2
+ ****************************************************************
+ * Brief Description:
+ * Our topology-aware thread placement 'library'; see cpu_topo.h.
+ * The topology's read from sysfs:
+ *  /sys/devices/system/cpu/cpuN/topology/thread_siblings_list : SMT siblings
+ *  /sys/devices/system/cpu/cpuN/cache/indexM/{level,shared_cpu_list} : the
+ *      LLC is the highest level cache
+ *  /sys/devices/system/node/nodeK/cpulist : NUMA nodes
+ *
+ * For details, please refer the book, Ch 11.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include "cpu_topo.h"
+
+#define MAX_NODES	1024
+
+/* Parse a kernel 'cpulist' (f.e. "0-3,8,10-11") into @set */
+int cpu_topo_parse_cpulist(const struct cpu_topo *t, const char *s, cpu_set_t *set)
+{
+	char *end;
+	long a, b, i;
+
+	CPU_ZERO_S(t->masksz, set);
+	while (*s && *s != '\n') {
+		a = b = strtol(s, &end, 10);
+		if (end == s)
+			return -1;
+		if (*end == '-')
+			b = strtol(end + 1, &end, 10);
+		for (i = a; i <= b && i < t->ncpus; i++)
+			CPU_SET_S(i, t->masksz, set);
+		s = (*end == ',') ? end + 1 : end;
+	}
+	return 0;
+}
+
+static int read_cpulist(const struct cpu_topo *t, const char *path, cpu_set_t *set)
+{
+	char buf[4096];
+	FILE *fp = fopen(path, "r");
+
+	if (!fp)
+		return -1;
+	if (!fgets(buf, sizeof(buf), fp)) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	return cpu_topo_parse_cpulist(t, buf, set);
+}
+
+/* The lowest numbered CPU in @set */
+static int first_cpu(const struct cpu_topo *t, cpu_set_t *set)
+{
+	int c;
+
+	for (c = 0; c < t->ncpus; c++)
+		if (CPU_ISSET_S(c, t->masksz, set))
+			return c;
+	return -1;
+}
+
+/* The LLC: the CPUs sharing the highest level cache of @cpu */
+static void read_llc(struct cpu_topo *t, int cpu, cpu_set_t *tmp)
+{
+	cpu_set_t *llc = t->cpu[cpu].llc_cpus;
+	char path[128];
+	int idx, lvl, maxlvl = 0;
+	FILE *fp;
+
+	CPU_ZERO_S(t->masksz, llc);
+	CPU_SET_S(cpu, t->masksz, llc);
+	for (idx = 0; ; idx++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, idx);
+		fp = fopen(path, "r");
+		if (!fp)
+			break;
+		if (fscanf(fp, "%d", &lvl) != 1)
+			lvl = 0;
+		fclose(fp);
+		if (lvl < maxlvl)
+			continue;
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, idx);
+		if (read_cpulist(t, path, tmp) < 0)
+			continue;
+		if (lvl > maxlvl)	/* a higher level: it replaces the lower one(s) */
+			CPU_ZERO_S(t->masksz, llc);
+		CPU_OR_S(t->masksz, llc, llc, tmp);
+		maxlvl = lvl;
+	}
+}
+
+/* Count the distinct values of the int at @off in each allowed CPU's info */
+static int nr_distinct(const struct cpu_topo *t, size_t off)
+{
+	int *seen = calloc(t->ncpus + MAX_NODES, sizeof(int));
+	int c, v, n = 0;
+
+	if (!seen)
+		return 0;
+	for (c = 0; c < t->ncpus; c++) {
+		if (!CPU_ISSET_S(c, t->masksz, t->allowed))
+			continue;
+		v = *(int *)((char *)&t->cpu[c] + off);
+		if (!seen[v]++)
+			n++;
+	}
+	free(seen);
+	return n;
+}
+
+void cpu_topo_free(struct cpu_topo *t)
+{
+	int c;
+
+	if (!t)
+		return;
+	if (t->cpu) {
+		for (c = 0; c < t->ncpus; c++) {
+			CPU_FREE(t->cpu[c].smt);
+			CPU_FREE(t->cpu[c].llc_cpus);
+		}
+		free(t->cpu);
+	}
+	CPU_FREE(t->allowed);
+	free(t);
+}
+
+/* Read the topology; returns NULL on failure */
+struct cpu_topo *cpu_topo_read(void)
+{
+	struct cpu_topo *t = calloc(1, sizeof(*t));
+	cpu_set_t *tmp = NULL;
+	char path[128];
+	int c, node;
+
+	if (!t)
+		return NULL;
+	t->ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (t->ncpus <= 0)
+		goto err;
+	t->masksz = CPU_ALLOC_SIZE(t->ncpus);
+	t->allowed = CPU_ALLOC(t->ncpus);
+	tmp = CPU_ALLOC(t->ncpus);
+	t->cpu = calloc(t->ncpus, sizeof(struct cpu_topo_cpu));
+	if (!t->allowed || !tmp || !t->cpu)
+		goto err;
+	if (sched_getaffinity(0, t->masksz, t->allowed) < 0)
+		goto err;
+
+	for (c = 0; c < t->ncpus; c++) {
+		t->cpu[c].smt = CPU_ALLOC(t->ncpus);
+		t->cpu[c].llc_cpus = CPU_ALLOC(t->ncpus);
+		if (!t->cpu[c].smt || !t->cpu[c].llc_cpus)
+			goto err;
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", c);
+		if (read_cpulist(t, path, t->cpu[c].smt) < 0) {
+			CPU_ZERO_S(t->masksz, t->cpu[c].smt);
+			CPU_SET_S(c, t->masksz, t->cpu[c].smt);
+		}
+		read_llc(t, c, tmp);
+		t->cpu[c].core = first_cpu(t, t->cpu[c].smt);
+		t->cpu[c].llc = first_cpu(t, t->cpu[c].llc_cpus);
+	}
+	/* NUMA nodes (their IDs can be sparse) */
+	for (node = 0; node < MAX_NODES; node++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		if (read_cpulist(t, path, tmp) < 0)
+			continue;
+		for (c = 0; c < t->ncpus; c++)
+			if (CPU_ISSET_S(c, t->masksz, tmp))
+				t->cpu[c].node = node;
+	}
+	t->nr_cores = nr_distinct(t, offsetof(struct cpu_topo_cpu, core));
+	t->nr_llcs = nr_distinct(t, offsetof(struct cpu_topo_cpu, llc));
+	t->nr_nodes = nr_distinct(t, offsetof(struct cpu_topo_cpu, node));
+	CPU_FREE(tmp);
+	return t;
+err:
+	CPU_FREE(tmp);
+	cpu_topo_free(t);
+	return NULL;
+}
+
+void cpu_topo_print(const struct cpu_topo *t)
+{
+	int c;
+
+	printf("%d CPUs configured; allowed: %d CPUs on %d cores, %d LLCs, %d NUMA nodes\n",
+	       t->ncpus, CPU_COUNT_S(t->masksz, t->allowed), t->nr_cores, t->nr_llcs,
+	       t->nr_nodes);
+	printf("%5s %5s %5s %5s\n", "cpu", "core", "llc", "node");
+	for (c = 0; c < t->ncpus; c++)
+		if (CPU_ISSET_S(c, t->masksz, t->allowed))
+			printf("%5d %5d %5d %5d\n", c, t->cpu[c].core, t->cpu[c].llc,
+			       t->cpu[c].node);
+}
+
+static const char *policy_name[CT_NR_POLICIES] = {
+	"none", "spread-llc", "pack-llc", "no-smt"
+};
+
+const char *cpu_topo_policy_name(int policy)
+{
+	return (policy >= 0 && policy < CT_NR_POLICIES) ? policy_name[policy] : "?";
+}
+
+/* Returns the policy, -1 if @name isn't one */
+int cpu_topo_policy_parse(const char *name)
+{
+	int p;
+
+	for (p = 0; p < CT_NR_POLICIES; p++)
+		if (!strcmp(name, policy_name[p]))
+			return p;
+	return -1;
+}
+
+/* Is @c the lowest numbered allowed CPU of its core? */
+static int is_primary(const struct cpu_topo *t, int c)
+{
+	int s;
+
+	for (s = 0; s < c; s++)
+		if (CPU_ISSET_S(s, t->masksz, t->cpu[c].smt) &&
+		    CPU_ISSET_S(s, t->masksz, t->allowed))
+			return 0;
+	return 1;
+}
+
+/*
+ * Append the allowed CPUs of the LLC @llc to @order: one per core first,
+ * then (unless @nosmt) their SMT siblings. Returns the new length.
+ */
+static int llc_order(const struct cpu_topo *t, int llc, int nosmt, int *order, int n)
+{
+	int c, pass;
+
+	for (pass = 0; pass < (nosmt ? 1 : 2); pass++)
+		for (c = 0; c < t->ncpus; c++)
+			if (CPU_ISSET_S(c, t->masksz, t->allowed) && t->cpu[c].llc == llc &&
+			    is_primary(t, c) == !pass)
+				order[n++] = c;
+	return n;
+}
+
+/*
+ * Compute the placement of @nthreads threads as per @policy: thread i's to
+ * run on CPU @cpus[i] (-1: not pinned). If there are more threads than the
+ * policy has CPUs for, we wrap around (i.e., oversubscribe).
+ * Returns 0, or -1 on failure.
+ */
+int cpu_topo_place(const struct cpu_topo *t, int nthreads, int policy, int *cpus)
+{
+	int *llcs, *order, *pos, *len, nllc = 0, n = 0, maxlen = 0, i, c, l, k, ret = -1;
+
+	if (policy == CT_NONE) {
+		for (i = 0; i < nthreads; i++)
+			cpus[i] = -1;
+		return 0;
+	}
+	llcs = calloc(t->ncpus, sizeof(int));
+	order = calloc(t->ncpus, sizeof(int));
+	pos = calloc(t->ncpus, sizeof(int));
+	len = calloc(t->ncpus, sizeof(int));
+	if (!llcs || !order || !pos || !len)
+		goto out;
+
+	/* the LLCs (their IDs), in the order of their first allowed CPU */
+	for (c = 0; c < t->ncpus; c++) {
+		if (!CPU_ISSET_S(c, t->masksz, t->allowed))
+			continue;
+		for (l = 0; l < nllc && llcs[l] != t->cpu[c].llc; l++)
+			;
+		if (l == nllc)
+			llcs[nllc++] = t->cpu[c].llc;
+	}
+	if (!nllc)
+		goto out;
+
+	switch (policy) {
+	case CT_PACK_LLC:
+		n = llc_order(t, llcs[0], 0, order, 0);
+		break;
+	case CT_NO_SMT:
+		for (l = 0; l < nllc; l++)
+			n = llc_order(t, llcs[l], 1, order, n);
+		break;
+	case CT_SPREAD_LLC:
+		/* lay out each LLC's CPUs contiguously, then take them round-robin */
+		for (l = 0; l < nllc; l++) {
+			pos[l] = n;
+			n = llc_order(t, llcs[l], 0, order, n);
+			len[l] = n - pos[l];
+			if (len[l] > maxlen)
+				maxlen = len[l];
+		}
+		for (i = 0, k = 0; i < nthreads; k++) {
+			if (k / nllc >= maxlen)		/* all LLCs used up: wrap */
+				k = 0;
+			l = k % nllc;
+			if (k / nllc < len[l])
+				cpus[i++] = order[pos[l] + k / nllc];
+		}
+		ret = 0;
+		goto out;
+	default:
+		goto out;
+	}
+	for (i = 0; i < nthreads; i++)
+		cpus[i] = order[i % n];
+	ret = 0;
+out:
+	free(llcs);
+	free(order);
+	free(pos);
+	free(len);
+	return ret;
+}
+
+/* Pin @thread to @cpu (nothing to do if it's -1); returns 0 or an errno */
+int cpu_topo_pin(const struct cpu_topo *t, pthread_t thread, int cpu)
+{
+	cpu_set_t *set;
+	int ret;
+
+	if (cpu < 0)
+		return 0;
+	set = CPU_ALLOC(t->ncpus);
+	if (!set)
+		return -1;
+	CPU_ZERO_S(t->masksz, set);
+	CPU_SET_S(cpu, t->masksz, set);
+	ret = pthread_setaffinity_np(thread, t->masksz, set);
+	CPU_FREE(set);
+	return ret;
+}
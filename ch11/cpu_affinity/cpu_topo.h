@@ -0,0 +1,65 @@
+/*
+ * ch11/cpu_affinity/cpu_topo.h
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 11 : CPU Scheduling, Part 2
+ ****************************************************************
+ * Brief Description:
+ * A small userspace 'library' for topology-aware thread placement: read the
+ * CPU topology (cores, SMT siblings, LLC groups and NUMA nodes) from
+ * /sys/devices/system/cpu, compute a placement of N threads as per a policy
+ * and apply it (pthread_setaffinity_np(3)). The CPU masks are dynamically
+ * sized (CPU_ALLOC(3)), so any # of CPUs is fine.
+ *
+ * For details, please refer the book, Ch 11.
+ */
+#ifndef __CPU_TOPO_H__
+#define __CPU_TOPO_H__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <pthread.h>
+
+struct cpu_topo_cpu {
+	int core;		/* the core ID: its lowest numbered SMT sibling */
+	int llc;		/* the LLC ID: the lowest numbered CPU sharing it */
+	int node;		/* the NUMA node */
+	cpu_set_t *smt;		/* SMT siblings, including itself */
+	cpu_set_t *llc_cpus;	/* CPUs sharing the last level cache */
+};
+
+struct cpu_topo {
+	int ncpus;		/* # of configured CPUs, i.e., the mask 'width' */
+	size_t masksz;		/* CPU_ALLOC_SIZE(ncpus) */
+	cpu_set_t *allowed;	/* the CPUs we're allowed to run on */
+	int nr_cores, nr_llcs, nr_nodes;	/* (among the allowed CPUs) */
+	struct cpu_topo_cpu *cpu;
+};
+
+enum cpu_topo_policy {
+	CT_NONE,		/* don't pin at all (the baseline) */
+	CT_SPREAD_LLC,		/* round-robin across the LLCs, one thread per core first */
+	CT_PACK_LLC,		/* all threads within one LLC, one per core first */
+	CT_NO_SMT,		/* one thread per core (never on SMT siblings) */
+	CT_NR_POLICIES
+};
+
+struct cpu_topo *cpu_topo_read(void);
+void cpu_topo_free(struct cpu_topo *t);
+void cpu_topo_print(const struct cpu_topo *t);
+int cpu_topo_parse_cpulist(const struct cpu_topo *t, const char *s, cpu_set_t *set);
+
+const char *cpu_topo_policy_name(int policy);
+int cpu_topo_policy_parse(const char *name);
+int cpu_topo_place(const struct cpu_topo *t, int nthreads, int policy, int *cpus);
+int cpu_topo_pin(const struct cpu_topo *t, pthread_t thread, int cpu);
+
+#endif /* __CPU_TOPO_H__ */
@@ -14,6 +14,17 @@
  * A small *userspace* app to query and set the CPU affinity mask of any
  * given process or thread (via PID). If no PID is explicitly provided,
  * we just display the CPU mask of the calling process (this app).
+ * The masks are dynamically sized (CPU_ALLOC(3)), so any # of CPUs works;
+ * the new mask can be a hex value (with the leading 0x) of any length.
+ *
+ * Besides, a benchmark mode (-b) shows why the placement matters: it runs a
+ * compute-bound and a memory-bound kernel on two threads pinned to:
+ *  the same CPU, SMT sibling threads, two cores sharing the LLC, two cores
+ *  on different LLCs (same node), and two CPUs on different NUMA nodes
+ * (as found via the topology in /sys/devices/system/cpu), reporting the
+ * aggregate throughput of each relative to twice that of a lone thread.
+ * With -M {cpu|mem}, we run the given kernel on every pair of CPUs, giving
+ * an NxN throughput matrix.
  *
  * For details, please refer the book, Ch 11.
  */
@@ -21,12 +32,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sched.h>
+#include "cpu_topo.h"
 
 static unsigned int numcores;
+static size_t masksz;		/* CPU_ALLOC_SIZE(numcores) */
 
 static inline void print_ruler(unsigned int len)
 {
@@ -42,7 +60,7 @@ static inline void print_ruler(unsigned int len)
 	printf("\n");
 }
 
-/* 
+/*
  * disp_cpumask()
  * Print the provided CPU bitmask @cpumask (along with the 'ruler' lines),
  * for a max of @ncores-1 CPU cores, in (a more intuitive) right-to-left order.
@@ -50,13 +68,17 @@ static inline void print_ruler(unsigned int len)
 static void disp_cpumask(pid_t pid, cpu_set_t *cpumask, unsigned int ncores)
 {
 	int i;
-	char tmpbuf[128];
+	char path[64], comm[32] = "?";
+	FILE *fp;
 
-	printf("CPU affinity mask for PID %d:\n", pid);
-	snprintf(tmpbuf, 127, "ps -A |awk '$1 == %d {print $0}'", pid);
-	if (system(tmpbuf) == -1)
-		fprintf(stderr, "Warning: %s():system(3) (to show ps output)"
-			" failed\n", __func__);
+	snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+	fp = fopen(path, "r");
+	if (fp) {
+		if (fgets(comm, sizeof(comm), fp))
+			comm[strcspn(comm, "\n")] = '\0';
+		fclose(fp);
+	}
+	printf("CPU affinity mask for PID %d (%s):\n", pid, comm);
 
 	print_ruler(ncores);
 
@@ -68,85 +90,371 @@ static void disp_cpumask(pid_t pid, cpu_set_t *cpumask, unsigned int ncores)
 
 	printf("cpumask|");
 	for (i=ncores-1; i>=0; i--)
-		printf("%2u|", CPU_ISSET(i, cpumask));
+		printf("%2u|", CPU_ISSET_S(i, masksz, cpumask) ? 1 : 0);
 	printf("\n");
 	print_ruler(ncores);
 }
 
 static int query_cpu_affinity(pid_t pid)
 {
-	cpu_set_t cpumask;
+	cpu_set_t *cpumask = CPU_ALLOC(numcores);
 
-	CPU_ZERO(&cpumask);
-	if (sched_getaffinity(pid, sizeof(cpu_set_t), &cpumask) < 0) {
+	if (!cpumask)
+		return -1;
+	CPU_ZERO_S(masksz, cpumask);
+	if (sched_getaffinity(pid, masksz, cpumask) < 0) {
 		perror("sched_getaffinity() failed");
+		CPU_FREE(cpumask);
 		return -1;
 	}
-	disp_cpumask(pid, &cpumask, numcores);
+	disp_cpumask(pid, cpumask, numcores);
+	CPU_FREE(cpumask);
 
 	return 0;
 }
 
-static int set_cpu_affinity(pid_t pid, unsigned long bitmask)
+/*
+ * Set the affinity of @pid to @mask; bit 0 (the rightmost) is CPU 0.
+ * As always, it's parsed as by strtoul(..., 0) (f.e. 15 is CPUs 0-3, as is
+ * 0xf), thus limited to an unsigned long. For more CPUs than that, pass a hex
+ * value of any length with the leading 0x (f.e. 0x1,00000000,00000000).
+ */
+static int set_cpu_affinity(pid_t pid, const char *mask)
 {
-	cpu_set_t cpumask;
-	int i;
+	cpu_set_t *cpumask = CPU_ALLOC(numcores);
+	const char *hexmask = mask, *p;
+	unsigned long val;
+	char *end;
+	int i, cpu = 0, nib;
 
+	if (!cpumask)
+		return -1;
 	printf("\nSetting CPU affinity mask for PID %d now...\n", pid);
-	CPU_ZERO(&cpumask);
+	CPU_ZERO_S(masksz, cpumask);
 
-	/* Iterate over the given bitmask, setting CPU bits as required */
-	for (i=0; i<sizeof(unsigned long)*8; i++) {
-		/* printf("bit %d: %d\n", i, (bitmask >> i) & 1); */
-		if ((bitmask >> i) & 1)
-			CPU_SET(i, &cpumask);
+	if (strncmp(mask, "0x", 2) && strncmp(mask, "0X", 2)) {
+		errno = 0;
+		val = strtoul(mask, &end, 0);
+		if (errno || end == mask || *end) {
+			fprintf(stderr, "invalid CPU mask \"%s\" (for a wide mask, use a hex value"
+				" with the leading 0x)\n", mask);
+			CPU_FREE(cpumask);
+			return -1;
+		}
+		for (i = 0; i < sizeof(val) * 8 && i < numcores; i++)
+			if ((val >> i) & 1)
+				CPU_SET_S(i, masksz, cpumask);
+		goto set;
 	}
 
-	if (sched_setaffinity(pid, sizeof(cpu_set_t), &cpumask) < 0) {
+	hexmask += 2;
+	/* Iterate over the given hex bitmask, from its least significant nibble */
+	for (p = hexmask + strlen(hexmask) - 1; p >= hexmask; p--) {
+		if (*p == ',')	/* allow the 32-bit word separators of the kernel's format */
+			continue;
+		if (!isxdigit(*p)) {
+			fprintf(stderr, "invalid CPU mask \"%s\"\n", mask);
+			CPU_FREE(cpumask);
+			return -1;
+		}
+		nib = isdigit(*p) ? *p - '0' : tolower(*p) - 'a' + 10;
+		for (i = 0; i < 4; i++)
+			if ((nib >> i) & 1 && cpu + i < numcores)
+				CPU_SET_S(cpu + i, masksz, cpumask);
+		cpu += 4;
+	}
+
+set:
+	if (sched_setaffinity(pid, masksz, cpumask) < 0) {
 		perror("sched_setaffinity() failed");
+		CPU_FREE(cpumask);
 		return -1;
 	}
-	disp_cpumask(pid, &cpumask, numcores);
+	disp_cpumask(pid, cpumask, numcores);
+	CPU_FREE(cpumask);
 
 	return 0;
 }
 
-int main (int argc, char **argv)
+/*------------------------- The topology --------------------------------*/
+/* (read from /sys/devices/system/cpu; see cpu_topo.[ch]) */
+static struct cpu_topo *topo;
+
+/*------------------------- The benchmark -------------------------------*/
+#define MEMBUF_SZ	(64 * 1024 * 1024)	/* > the LLC */
+
+enum { K_CPU, K_MEM };
+
+struct worker {
+	pthread_t tid;
+	int cpu, kernel;
+	volatile uint64_t work;		/* # of work units done */
+	pthread_barrier_t *bar;
+	volatile int *stop;
+};
+
+static void pin_self(int cpu)
 {
-	FILE *fp;
-	char s[9];
-	pid_t pid = getpid();
-	unsigned long new_cpumask = 0x0;
+	cpu_set_t *set = CPU_ALLOC(numcores);
+
+	CPU_ZERO_S(masksz, set);
+	CPU_SET_S(cpu, masksz, set);
+	if (sched_setaffinity(0, masksz, set) < 0)
+		perror("sched_setaffinity");
+	CPU_FREE(set);
+}
+
+/*
+ * The kernels; a work unit is:
+ *  cpu: 1M iterations of an integer / FP dependency chain
+ *  mem: a read-modify-write sweep over 1 MB (one word per cache line) of a
+ *       private buffer much larger than the LLC
+ */
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t x = 88172645463325252ULL, *buf = NULL, i, off = 0;
+	double f = 1.0;
+
+	pin_self(w->cpu);
+	if (w->kernel == K_MEM) {
+		buf = malloc(MEMBUF_SZ);	/* first touched here, i.e., node-local */
+		if (!buf) {
+			fprintf(stderr, "worker (CPU %d): out of memory\n", w->cpu);
+			pthread_barrier_wait(w->bar);	/* else run_on() waits forever */
+			return NULL;
+		}
+		memset(buf, 1, MEMBUF_SZ);
+	}
+	pthread_barrier_wait(w->bar);
+	while (!*w->stop) {
+		if (w->kernel == K_CPU) {
+			for (i = 0; i < 1000000; i++) {
+				x ^= x << 13;
+				x ^= x >> 7;
+				x ^= x << 17;
+				f = f * 1.0000001 + (double)(x & 0xff);
+			}
+		} else {
+			for (i = 0; i < (1 << 20) / sizeof(uint64_t); i += 8)
+				buf[(off + i) % (MEMBUF_SZ / sizeof(uint64_t))]++;
+			off = (off + (1 << 20) / sizeof(uint64_t)) % (MEMBUF_SZ / sizeof(uint64_t));
+		}
+		w->work++;
+	}
+	if (f == 0.0 && x == 0)		/* keep the compiler from eliding the loop */
+		printf("!");
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Run @kernel on the @n CPUs @cpus concurrently for @ms milliseconds;
+ * returns the aggregate throughput in work units per second.
+ */
+static double run_on(const int *cpus, int n, int kernel, int ms)
+{
+	struct worker w[2];
+	pthread_barrier_t bar;
+	volatile int stop = 0;
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	uint64_t total = 0;
+	int i, ret;
+
+	pthread_barrier_init(&bar, NULL, n + 1);
+	for (i = 0; i < n; i++) {
+		w[i].cpu = cpus[i];
+		w[i].kernel = kernel;
+		w[i].work = 0;
+		w[i].bar = &bar;
+		w[i].stop = &stop;
+		ret = pthread_create(&w[i].tid, NULL, worker_fn, &w[i]);
+		if (ret) {
+			fprintf(stderr, "pthread_create failed: %s\n", strerror(ret));
+			exit(EXIT_FAILURE);
+		}
+	}
+	pthread_barrier_wait(&bar);
+	nanosleep(&ts, NULL);
+	stop = 1;
+	for (i = 0; i < n; i++) {
+		pthread_join(w[i].tid, NULL);
+		total += w[i].work;
+	}
+	pthread_barrier_destroy(&bar);
+	return total * 1000.0 / ms;
+}
 
-	if (argc > 1 && 
-		((!strncmp(argv[1], "--help", 6)) || (!strncmp(argv[1], "-h", 2)))) {
-		fprintf(stderr, "Usage: %s [PID] [new-CPU-mask]\n"
+enum { P_SAME, P_SMT, P_LLC, P_XLLC, P_NUMA, NR_PAIRS };
+static const char *pair_name[NR_PAIRS] = {
+	"same CPU", "SMT siblings", "same LLC", "other LLC", "other node"
+};
+
+/* Find an allowed CPU (other than @a) in the relation @rel to CPU @a */
+static int find_partner(int a, int rel)
+{
+	int b;
+
+	if (rel == P_SAME)
+		return a;
+	for (b = 0; b < numcores; b++) {
+		if (b == a || !CPU_ISSET_S(b, masksz, topo->allowed))
+			continue;
+		switch (rel) {
+		case P_SMT:
+			if (CPU_ISSET_S(b, masksz, topo->cpu[a].smt))
+				return b;
+			break;
+		case P_LLC:
+			if (CPU_ISSET_S(b, masksz, topo->cpu[a].llc_cpus) &&
+			    !CPU_ISSET_S(b, masksz, topo->cpu[a].smt))
+				return b;
+			break;
+		case P_XLLC:
+			if (!CPU_ISSET_S(b, masksz, topo->cpu[a].llc_cpus) &&
+			    topo->cpu[b].node == topo->cpu[a].node)
+				return b;
+			break;
+		case P_NUMA:
+			if (topo->cpu[b].node != topo->cpu[a].node)
+				return b;
+			break;
+		}
+	}
+	return -1;
+}
+
+static int bench(int ms)
+{
+	double base[2], tput[2];
+	int a, b, k, rel, cpus[2];
+	static const char *unit[2] = { "Mops/s", "GB/s" };
+
+	topo = cpu_topo_read();
+	if (!topo)
+		return -1;
+	for (a = 0; a < numcores && !CPU_ISSET_S(a, masksz, topo->allowed); a++)
+		;
+	printf("\nBenchmark: %d ms per run; compute (cpu) and memory-bound (mem) kernels\n", ms);
+	for (k = K_CPU; k <= K_MEM; k++)
+		base[k] = run_on(&a, 1, k, ms);
+	printf("%-13s %-7s %14s %6s %14s %6s\n", "placement", "cpus", "cpu (Mops/s)", "rel",
+	       "mem (GB/s)", "rel");
+	printf("%-13s %-7d %14.1f %6.2f %14.2f %6.2f\n", "lone thread", a, base[K_CPU],
+	       0.5, base[K_MEM] / 1024, 0.5);
+	for (rel = 0; rel < NR_PAIRS; rel++) {
+		b = find_partner(a, rel);
+		if (b < 0) {
+			printf("%-13s %-7s %14s\n", pair_name[rel], "-", "n/a (no such CPU)");
+			continue;
+		}
+		cpus[0] = a;
+		cpus[1] = b;
+		for (k = K_CPU; k <= K_MEM; k++)
+			tput[k] = run_on(cpus, 2, k, ms);
+		printf("%-13s %3d,%-3d %14.1f %6.2f %14.2f %6.2f\n", pair_name[rel], a, b,
+		       tput[K_CPU], tput[K_CPU] / (2 * base[K_CPU]),
+		       tput[K_MEM] / 1024, tput[K_MEM] / (2 * base[K_MEM]));
+	}
+	printf("(%s and %s are aggregates; rel = aggregate / (2 x lone thread))\n",
+	       unit[K_CPU], unit[K_MEM]);
+	cpu_topo_free(topo);
+	return 0;
+}
+
+/* Run @kernel on every pair of (allowed) CPUs: the NxN throughput matrix */
+static int matrix(int kernel, int ms)
+{
+	cpu_set_t *allowed = CPU_ALLOC(numcores);
+	int a, b, cpus[2];
+
+	if (!allowed)
+		return -1;
+	sched_getaffinity(0, masksz, allowed);
+	printf("\n%s kernel: aggregate throughput (%s) of two threads pinned to CPUs (row, col)\n",
+	       kernel == K_CPU ? "compute" : "memory", kernel == K_CPU ? "Mops/s" : "GB/s");
+	printf("cpu");
+	for (b = 0; b < numcores; b++)
+		if (CPU_ISSET_S(b, masksz, allowed))
+			printf(",%d", b);
+	printf("\n");
+	for (a = 0; a < numcores; a++) {
+		if (!CPU_ISSET_S(a, masksz, allowed))
+			continue;
+		printf("%d", a);
+		for (b = 0; b < numcores; b++) {
+			if (!CPU_ISSET_S(b, masksz, allowed))
+				continue;
+			cpus[0] = a;
+			cpus[1] = b;
+			printf(kernel == K_CPU ? ",%.1f" : ",%.2f",
+			       run_on(cpus, 2, kernel, ms) / (kernel == K_CPU ? 1 : 1024));
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+	CPU_FREE(allowed);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [PID] [new-CPU-mask]\n"
 		"(If using the optional params, you must at least pass"
 		" the process PID;\nwe (attempt to) set CPU affinity only if"
-		" new-CPU-mask is passed)\n", argv[0]);
-		exit(EXIT_SUCCESS);
-	}
+		" new-CPU-mask is passed; it's a number\n(f.e. 15 or 0xf), or a hex"
+		" value of any length with the leading 0x)\n"
+		"   or: %s -b [-d ms]          : the placement benchmark\n"
+		"   or: %s -M cpu|mem [-d ms]  : the NxN CPU pair throughput matrix\n"
+		" -d : the duration of each run in ms (default: 500 for -b, 100 for -M)\n",
+		name, name, name);
+}
 
-	fp = popen("nproc", "r");
-	if (!fp) {
-		fprintf(stderr, "%s: popen failed; can't detect # cores, aborting...\n", argv[0]);
-		exit(EXIT_FAILURE);
+int main (int argc, char **argv)
+{
+	pid_t pid = getpid();
+	int opt, do_bench = 0, mat = -1, ms = 0;
+
+	while ((opt = getopt(argc, argv, "bM:d:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			do_bench = 1;
+			break;
+		case 'M':
+			mat = !strcmp(optarg, "mem") ? K_MEM : K_CPU;
+			break;
+		case 'd':
+			ms = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
 	}
-	if (!fgets(s, sizeof(s), fp)) {
-		fprintf(stderr, "%s: fgets failed to read data; can't detect # cores, aborting...\n", argv[0]);
+
+	/* _CONF: the mask must cover all CPUs, even the (currently) offline ones */
+	numcores = sysconf(_SC_NPROCESSORS_CONF);
+	if ((int)numcores <= 0) {
+		fprintf(stderr, "%s: sysconf failed; can't detect # cores, aborting...\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
-	numcores = atoi(s);
+	masksz = CPU_ALLOC_SIZE(numcores);
 	printf("Detected %d CPU cores [for this process %s:%d]\n", numcores, argv[0], getpid());
 
-	if (argc >= 2)
-		pid = atoi(argv[1]);
+	if (do_bench || mat >= 0) {
+		if (do_bench && bench(ms > 0 ? ms : 500) < 0)
+			exit(EXIT_FAILURE);
+		if (mat >= 0 && matrix(mat, ms > 0 ? ms : 100) < 0)
+			exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
+
+	if (optind < argc)
+		pid = atoi(argv[optind]);
 
 	query_cpu_affinity(pid);
-	if (argc == 3) {
-		new_cpumask = strtoul(argv[2], 0, 0);
-		set_cpu_affinity(pid, new_cpumask);
-	}
+	if (optind + 1 < argc)
+		set_cpu_affinity(pid, argv[optind + 1]);
 
 	exit(EXIT_SUCCESS);
 }
@@ -11,9 +11,60 @@
 # * From: Ch 6 : Kernel and Memory Management Internals Essentials
 # ****************************************************************
 # * Brief Description:
+# * Count the processes, threads and kernel threads alive.
+# * If our ch6/countem_lkm kernel module is loaded (and we can read it's
+# * debugfs file), we use it: it does all the counting in a single task list
+# * walk within the kernel. Else, we fall back to the 'usual' way - running
+# * ps(1) (thrice).
+# *
+# * Options:
+# *  -p : force the ps(1) based method (even if the LKM is available)
+# *  -q : quiet; don't show the system release info
 # *
 # * For details, please refer the book, Ch 6.
 # ****************************************************************
+name=$(basename $0)
+COUNTEM_LKM_STATS=/sys/kernel/debug/countem/stats
+
+force_ps=0
+quiet=0
+while getopts "pqh" opt; do
+  case "${opt}" in
+    p) force_ps=1 ;;
+    q) quiet=1 ;;
+    *) echo "Usage: ${name} [-p] [-q]
+ -p : force the ps(1) based method (even if the countem_lkm LKM is available)
+ -q : quiet; don't show the system release info"
+       exit 1 ;;
+  esac
+done
+
+# Via our countem_lkm kernel module: one read, one task list walk
+count_via_lkm()
+{
+local stats=$(cat ${COUNTEM_LKM_STATS} 2>/dev/null)
+[ -z "${stats}" ] && return 1
+
+total_prcs=$(echo "${stats}" |awk '$1 == "processes" {print $2}')
+total_thrds=$(echo "${stats}" |awk '$1 == "threads" {print $2}')
+total_kthrds=$(echo "${stats}" |awk '$1 == "kthreads" {print $2}')
+method="countem_lkm (single task list walk)"
+return 0
+}
+
+# Via ps(1): three full walks over /proc
+count_via_ps()
+{
+total_prcs=$(ps -A|wc -l)
+# ps -LA shows all threads
+total_thrds=$(ps -LA|wc -l)
+# ps aux shows all kernel threads names (col 11) in square brackets; count 'em
+total_kthrds=$(ps aux|awk '{print $11}'|grep "^\["|wc -l)
+method="ps(1)"
+}
+
+
+[ ${quiet} -eq 0 ] && {
 echo "System release info:"
 which lsb_release >/dev/null
 if [ $? -eq 0 ] ; then
@@ -22,18 +73,22 @@ else
   [ -f /etc/issue ] && cat /etc/issue
   [ -f /etc/os-release ] && cat /etc/os-release
 fi
+}
 
-total_prcs=$(ps -A|wc -l)
-printf "\nTotal # of processes alive              = %9d\n" ${total_prcs}
+if [ ${force_ps} -eq 1 ] || ! count_via_lkm ; then
+  count_via_ps
+fi
 
-# ps -LA shows all threads
-total_thrds=$(ps -LA|wc -l)
+printf "\n[method: %s]\n" "${method}"
+printf "Total # of processes alive              = %9d\n" ${total_prcs}
 printf "Total # of threads alive                = %9d\n" ${total_thrds}
-
-# ps aux shows all kernel threads names (col 11) in square brackets; count 'em
-total_kthrds=$(ps aux|awk '{print $11}'|grep "^\["|wc -l)
-
 printf "Total # of kernel threads alive         = %9d\n" ${total_kthrds}
 printf "Thus, total # of usermode threads alive = %9d\n" $((${total_thrds}-${total_kthrds}))
 
+# The LKM gives us a lot more; show the per-state and per-policy breakdown too
+[ "${method}" != "ps(1)" ] && [ ${quiet} -eq 0 ] && {
+  printf "\nThreads by state / by scheduling policy:\n"
+  grep -E "^(state|policy)_" ${COUNTEM_LKM_STATS} |awk '{printf "  %-18s = %9d\n", $1, $2}'
+}
+
 exit 0
@@ -0,0 +1,55 @@
+#!/bin/bash
+# countem_bench.sh
+# ***************************************************************
+# * This program is part of the source code released for the book
+# *  "Linux Kernel Programming"
+# *  (c) Author: Kaiwan N Billimoria
+# *  Publisher:  Packt
+# *  GitHub repository:
+# *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+# *
+# * From: Ch 6 : Kernel and Memory Management Internals Essentials
+# ****************************************************************
+# * Brief Description:
+# * A simple timing benchmark: compare the time taken by our countem.sh
+# * script to count processes/threads via ps(1) against the same counting
+# * done via our countem_lkm kernel module (one debugfs read).
+# * Run as root (debugfs access), with the ch6/countem_lkm module loaded.
+# *
+# * For details, please refer the book, Ch 6.
+# ****************************************************************
+name=$(basename $0)
+TD=$(dirname $(realpath $0))
+STATS=/sys/kernel/debug/countem/stats
+LOOPS=${1:-10}
+
+[ $(id -u) -ne 0 ] && {
+  echo "${name}: need root (for debugfs access)"
+  exit 1
+}
+[ ! -r ${STATS} ] && {
+  echo "${name}: ${STATS} not readable; pl load the ch6/countem_lkm module first"
+  exit 1
+}
+
+# time_it <label> <cmd ...>
+# Run the command LOOPS times; show the average wall-clock time per run (ms)
+time_it()
+{
+local label="$1" t1 t2 i
+shift
+t1=$(date +%s%N)
+for i in $(seq 1 ${LOOPS}); do
+  "$@" >/dev/null
+done
+t2=$(date +%s%N)
+printf "%-40s : %10.3f ms/run\n" "${label}" $(bc <<< "scale=3; (${t2}-${t1})/${LOOPS}/1000000")
+}
+
+echo "${name}: ${LOOPS} runs each; $(awk '$1 == "threads" {print $2}' ${STATS}) threads alive"
+time_it "countem.sh via ps(1)" ${TD}/countem.sh -q -p
+time_it "countem.sh via countem_lkm" ${TD}/countem.sh -q
+time_it "raw read of ${STATS}" cat ${STATS}
+printf "%-40s : %10.3f ms\n" "in-kernel task list walk (last read)" \
+	$(bc <<< "scale=3; $(awk '$1 == "walk_ns" {print $2}' ${STATS})/1000000")
+exit 0
@@ -0,0 +1,167 @@
+/*
+ * ch6/countem_lkm/countem_lkm.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 6 : Kernel and Memory Management Internals Essentials
+ ****************************************************************
+ * Brief Description:
+ * The kernel-side counterpart of our ch6/countem.sh script. That script
+ * counts processes, threads and kernel threads by running ps(1) three times,
+ * i.e., three complete walks over /proc. Here, we instead walk the task list
+ * just *once*, under RCU, and count:
+ *  - processes, threads, kernel threads and usermode threads
+ *  - threads per (reported) task state: R, S, D, T, t, X, Z, P, I
+ *  - threads per scheduling policy
+ * The result is exposed via a single debugfs file:
+ *  /sys/kernel/debug/countem/stats
+ * in a simple 'key value' format, easy to parse from scripts.
+ *
+ * For details, please refer the book, Ch 6.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 10, 0)
+#include <linux/sched/signal.h>
+#endif
+
+#define OURDBGFS_DIR "countem"
+
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_DESCRIPTION("LKP book:ch6/countem_lkm:"
+" count processes/threads/kthreads (and more) in a single task list walk");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+/* The task states as reported to userspace; indexed by task_state_index(),
+ * this is the same string as that within task_index_to_char()
+ */
+static const char task_state_chars[] = "RSDTtXZPI";
+#define NR_STATES	(sizeof(task_state_chars) - 1)
+
+/* SCHED_NORMAL (0) ... SCHED_EXT (7); index 4 is unused (was SCHED_ISO) */
+#define NR_POLICIES	8
+static const char * const policy_names[NR_POLICIES] = {
+	"NORMAL", "FIFO", "RR", "BATCH", "ISO", "IDLE", "DEADLINE", "EXT"
+};
+
+struct task_counts {
+	unsigned long prcs, thrds, kthrds;
+	unsigned long state[NR_STATES];
+	unsigned long policy[NR_POLICIES];
+	s64 walk_ns;
+};
+
+static struct dentry *gparent;
+
+/*
+ * count_tasks()
+ * Walk the task list exactly once, filling in @tc.
+ * We're under rcu_read_lock() throughout, so we must not sleep; we also
+ * don't bother with task_lock() here as all we do is read a few word-sized
+ * members (a racy-but-consistent-enough snapshot, just like ps(1) itself).
+ */
+static void count_tasks(struct task_counts *tc)
+{
+	struct task_struct *g, *t;	/* 'g' : process ptr; 't': thread ptr */
+	unsigned int idx;
+	ktime_t t1;
+
+	memset(tc, 0, sizeof(*tc));
+	t1 = ktime_get();
+
+	rcu_read_lock();
+	do_each_thread(g, t) {
+		if (t == g)	/* the first thread of each process is the process */
+			tc->prcs++;
+		tc->thrds++;
+		if (t->flags & PF_KTHREAD)
+			tc->kthrds++;
+
+		idx = task_state_index(t);
+		if (idx < NR_STATES)
+			tc->state[idx]++;
+		if (t->policy < NR_POLICIES)
+			tc->policy[t->policy]++;
+	} while_each_thread(g, t);
+	rcu_read_unlock();
+
+	tc->walk_ns = ktime_to_ns(ktime_sub(ktime_get(), t1));
+}
+
+static int countem_show(struct seq_file *seq, void *v)
+{
+	struct task_counts counts, *tc = &counts;	/* small; fine on the stack */
+	int i;
+
+	count_tasks(tc);
+
+	seq_printf(seq, "processes %lu\n", tc->prcs);
+	seq_printf(seq, "threads %lu\n", tc->thrds);
+	seq_printf(seq, "kthreads %lu\n", tc->kthrds);
+	seq_printf(seq, "uthreads %lu\n", tc->thrds - tc->kthrds);
+	for (i = 0; i < NR_STATES; i++)
+		seq_printf(seq, "state_%c %lu\n", task_state_chars[i], tc->state[i]);
+	for (i = 0; i < NR_POLICIES; i++) {
+		if (i == 4)	/* SCHED_ISO: reserved, never used */
+			continue;
+		seq_printf(seq, "policy_%s %lu\n", policy_names[i], tc->policy[i]);
+	}
+	seq_printf(seq, "walk_ns %lld\n", tc->walk_ns);
+	return 0;
+}
+
+static int countem_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, countem_show, NULL);
+}
+
+static const struct file_operations countem_fops = {
+	.owner = THIS_MODULE,
+	.open = countem_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init countem_lkm_init(void)
+{
+	struct dentry *file;
+
+	gparent = debugfs_create_dir(OURDBGFS_DIR, NULL);
+	if (IS_ERR_OR_NULL(gparent)) {
+		pr_warn("debugfs_create_dir failed (is debugfs enabled/mounted?)\n");
+		return -ENODEV;
+	}
+	file = debugfs_create_file("stats", 0444, gparent, NULL, &countem_fops);
+	if (IS_ERR_OR_NULL(file)) {
+		pr_warn("debugfs_create_file failed\n");
+		debugfs_remove_recursive(gparent);
+		return -ENODEV;
+	}
+
+	pr_info("inserted; read /sys/kernel/debug/%s/stats\n", OURDBGFS_DIR);
+	return 0;		/* success */
+}
+
+static void __exit countem_lkm_exit(void)
+{
+	debugfs_remove_recursive(gparent);
+	pr_info("removed\n");
+}
+
+module_init(countem_lkm_init);
+module_exit(countem_lkm_exit);
@@ -11,6 +11,23 @@
  * From: Ch 6: Kernel and Memory Management Internals -Essentials
  ****************************************************************
  * Brief Description:
+ * Display a few members of the current process' task structure (at insmod
+ * and rmmod time).
+ *
+ * Additionally, we let userspace query the stats of *any* task(s): write one
+ * or more PIDs (separated by spaces, commas or newlines) into the debugfs
+ * file
+ *  /sys/kernel/debug/current_affairs/pids
+ * and then read it back via the same open file; a single read returns one
+ * line per PID with it's context switch and page fault counts, CPU,
+ * user/system time and kernel-mode stack start, all generated via the
+ * seq_file interface (no printk). The PID list is private to each open of
+ * the file, so concurrent users don't clobber each other's lists; if no
+ * PIDs have been written, the stats of the reader itself are shown. F.e.:
+ *  exec 3<> /sys/kernel/debug/current_affairs/pids
+ *  echo "1 $$" >&3 ; cat <&3 ; exec 3>&-
+ * (If debugfs isn't available, the module still loads; just without this
+ * file.)
  *
  * For details, please refer the book, Ch 6.
  */
@@ -21,14 +38,23 @@
 #include <linux/preempt.h>	/* in_task() */
 #include <linux/cred.h>		/* current_{e}{u,g}id() */
 #include <linux/uidgid.h>	/* {from,make}_kuid() */
+#include <linux/pid.h>		/* find_get_pid(), get_pid_task() */
+#include <linux/sched/task.h>	/* put_task_struct() */
+#include <linux/version.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/slab.h>
 
 #define OURMODNAME   "current_affairs"
+#define MAX_PIDS     128
 
 MODULE_AUTHOR("Kaiwan N Billimoria");
 MODULE_DESCRIPTION("LKP book:ch6/current_affairs: display a few members of"
-" the current process' task structure");
+" the current process' task structure; query stats of any PID via debugfs");
 MODULE_LICENSE("Dual MIT/GPL");
-MODULE_VERSION("0.1");
+MODULE_VERSION("0.2");
 
 static inline void show_ctx(char *nm)
 {
@@ -61,16 +87,177 @@ static inline void show_ctx(char *nm)
 		pr_alert("%s: in interrupt context [Should NOT Happen here!]\n", nm);
 }
 
+/*--- The debugfs 'pids' interface ---*/
+static struct dentry *gparent;
+
+/* The PID list; one per open file (hangs off the seq_file's private member) */
+struct pids_list {
+	struct mutex mtx;	/* protects pids[] and nr */
+	pid_t pids[MAX_PIDS];
+	int nr;
+};
+
+/*
+ * show_task_stats()
+ * Emit one line of stats for task @t (into the seq_file @seq).
+ * The caller holds a reference on @t, so it can't vanish under us; the
+ * (word-sized) counters we read are updated locklessly by the kernel anyway.
+ */
+static void show_task_stats(struct seq_file *seq, struct task_struct *t)
+{
+	u64 utime, stime;
+
+	/*
+	 * The raw t->utime/stime are tick-sampled (and, prior to 4.11, not in ns);
+	 * task_cputime_adjusted() gives us the (ns) values /proc reports.
+	 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+	task_cputime_adjusted(t, &utime, &stime);
+#else
+	cputime_t ut, st;
+
+	task_cputime_adjusted(t, &ut, &st);
+	utime = cputime_to_nsecs(ut);
+	stime = cputime_to_nsecs(st);
+#endif
+	seq_printf(seq, "%7d %7d %16s  %c %3d %10lu %10lu %10lu %10lu %15llu %15llu  0x%pK\n",
+		   task_pid_nr(t), task_tgid_nr(t), t->comm, task_state_to_char(t),
+		   task_cpu(t), t->nvcsw, t->nivcsw, t->min_flt, t->maj_flt,
+		   utime, stime, t->stack);
+}
+
+static int pids_show(struct seq_file *seq, void *v)
+{
+	struct pids_list *pl = seq->private;
+	struct task_struct *t;
+	struct pid *pid;
+	int i;
+
+	seq_puts(seq, "    PID    TGID             name  S cpu      nvcsw     nivcsw"
+		 "    min_flt    maj_flt        utime_ns        stime_ns  stack-start\n");
+
+	mutex_lock(&pl->mtx);
+	if (!pl->nr) {		/* no PIDs specified; show ourselves */
+		show_task_stats(seq, current);
+		goto out;
+	}
+	for (i = 0; i < pl->nr; i++) {
+		pid = find_get_pid(pl->pids[i]);
+		t = pid ? get_pid_task(pid, PIDTYPE_PID) : NULL;
+		put_pid(pid);
+		if (!t) {
+			seq_printf(seq, "%7d  <no such task>\n", pl->pids[i]);
+			continue;
+		}
+		show_task_stats(seq, t);
+		put_task_struct(t);
+	}
+ out:
+	mutex_unlock(&pl->mtx);
+	return 0;
+}
+
+static int pids_open(struct inode *inode, struct file *file)
+{
+	struct pids_list *pl = kzalloc(sizeof(*pl), GFP_KERNEL);
+	int ret;
+
+	if (!pl)
+		return -ENOMEM;
+	mutex_init(&pl->mtx);
+	ret = single_open(file, pids_show, pl);
+	if (ret)
+		kfree(pl);
+	return ret;
+}
+
+static int pids_release(struct inode *inode, struct file *file)
+{
+	kfree(((struct seq_file *)file->private_data)->private);
+	return single_release(inode, file);
+}
+
+/*
+ * pids_write()
+ * Parse the PID list written by userspace; it replaces the previous list
+ * (of this open file).
+ */
+static ssize_t pids_write(struct file *filp, const char __user *ubuf,
+			  size_t count, loff_t *off)
+{
+	struct pids_list *pl = ((struct seq_file *)filp->private_data)->private;
+	char *kbuf, *p, *tok;
+	pid_t newpids[MAX_PIDS];
+	int n = 0, val, ret;
+
+	if (count > PAGE_SIZE)
+		return -E2BIG;
+	kbuf = memdup_user_nul(ubuf, count);
+	if (IS_ERR(kbuf))
+		return PTR_ERR(kbuf);
+
+	p = kbuf;
+	while ((tok = strsep(&p, " ,\t\n")) != NULL) {
+		if (!*tok)
+			continue;
+		ret = kstrtoint(tok, 0, &val);
+		if (ret < 0 || val <= 0) {
+			kfree(kbuf);
+			return -EINVAL;
+		}
+		if (n >= MAX_PIDS) {
+			kfree(kbuf);
+			return -E2BIG;
+		}
+		newpids[n++] = val;
+	}
+	kfree(kbuf);
+
+	mutex_lock(&pl->mtx);
+	memcpy(pl->pids, newpids, n * sizeof(pid_t));
+	pl->nr = n;
+	mutex_unlock(&pl->mtx);
+
+	return count;
+}
+
+static const struct file_operations pids_fops = {
+	.owner = THIS_MODULE,
+	.open = pids_open,
+	.read = seq_read,
+	.write = pids_write,
+	.llseek = seq_lseek,
+	.release = pids_release,
+};
+
 static int __init current_affairs_init(void)
 {
+	struct dentry *file;
+
 	pr_info("%s: inserted\n", OURMODNAME);
 	pr_info(" sizeof(struct task_struct)=%zd\n", sizeof(struct task_struct));
 	show_ctx(OURMODNAME);
+
+	/* The debugfs 'pids' file's an extra; we load fine without it */
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent)) {
+		pr_warn("%s: debugfs_create_dir failed (is debugfs enabled/mounted?);"
+			" no 'pids' file\n", OURMODNAME);
+		gparent = NULL;
+		return 0;
+	}
+	file = debugfs_create_file("pids", 0644, gparent, NULL, &pids_fops);
+	if (IS_ERR_OR_NULL(file)) {
+		pr_warn("%s: debugfs_create_file failed; no 'pids' file\n", OURMODNAME);
+		debugfs_remove_recursive(gparent);
+		gparent = NULL;
+	}
 	return 0;		/* success */
 }
 
 static void __exit current_affairs_exit(void)
 {
+	debugfs_remove_recursive(gparent);
 	show_ctx(OURMODNAME);
 	pr_info("%s: removed\n", OURMODNAME);
 }
@@ -0,0 +1,348 @@
+/*
+ * ch6/foreach/thrd_stacksampler/thrd_stacksampler.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 6 : Kernel and MM Internals Essentials
+ ****************************************************************
+ * Brief Description:
+ * Our thrd_showall module shows where each thread's kernel-mode stack
+ * starts, but says nothing about how much of it is actually in use. This
+ * kernel module periodically samples the kernel stack usage of *all* threads
+ * alive, keeping:
+ *  - a histogram of the usage samples (in 1/16ths of THREAD_SIZE), and
+ *  - the top N threads by (high-water) stack usage, i.e., the ones closest
+ *    to overflowing their kernel stack.
+ * The report's available via debugfs:
+ *  cat /sys/kernel/debug/thrd_stacksampler/report
+ * (writing anything into it resets the stats).
+ *
+ * How do we estimate the usage? Two ways:
+ * a) with CONFIG_DEBUG_STACK_USAGE=y, the kernel stacks are zeroed at
+ *    allocation; the kernel's stack_not_used() helper scans up from the end
+ *    of the stack for the first non-zero word, i.e., we get the true
+ *    high-water mark ('canary scanning'), no matter when we sample.
+ * b) without it, we sample the current depth - the distance from the top of
+ *    the stack to the saved stack pointer - of every thread that's *not*
+ *    currently running (only on x86 and ARM64). Repeated sampling under
+ *    load gives a (lower bound) approximation of the high-water mark.
+ *
+ * Note: scanning a stack isn't cheap, and there may be thousands of threads.
+ * So, each period, we take references on (at most) SAMPLE_BATCH threads
+ * under RCU - resuming where the previous period left off - drop the RCU
+ * read lock, and only then measure each one, pinning its stack via
+ * try_get_task_stack() and rescheduling as needed. A full pass over all
+ * threads thus takes (nr_threads / SAMPLE_BATCH) periods.
+ *
+ * For details, please refer the book, Ch 6.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/sched/task_stack.h>	/* try_get_task_stack(), stack_not_used() */
+#include <linux/thread_info.h>		/* THREAD_SIZE */
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 10, 0)
+#include <linux/sched/signal.h>
+#endif
+
+#define OURMODNAME   "thrd_stacksampler"
+
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_DESCRIPTION("LKP book:ch6/foreach/thrd_stacksampler:"
+" periodically sample the kernel-mode stack usage of all threads");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static int sample_ms = 1000;
+module_param(sample_ms, int, 0644);
+MODULE_PARM_DESC(sample_ms, "sampling period in milliseconds (default 1000)");
+
+#define TOPN_MAX	64
+static int topn = 10;
+module_param(topn, int, 0444);
+MODULE_PARM_DESC(topn, "number of threads closest to overflow to report (max 64, default 10)");
+
+/* max # of threads sampled per period */
+#define SAMPLE_BATCH	256
+
+#define NR_BUCKETS	16
+#define BUCKET_SZ	(THREAD_SIZE / NR_BUCKETS)
+
+struct stk_top {
+	pid_t pid, tgid;
+	char comm[TASK_COMM_LEN];
+	unsigned long maxused;
+};
+
+static struct {
+	struct mutex mtx;	/* protects this structure */
+	unsigned long nr_samples, nr_passes;
+	unsigned long hist[NR_BUCKETS];
+	struct stk_top top[TOPN_MAX];
+	int nr_top;
+	unsigned long maxused;
+} stats;
+
+static struct delayed_work sample_work;
+/* used only by the (single) sampling work, so no locking needed */
+static struct task_struct *batch[SAMPLE_BATCH];
+static unsigned long cursor;	/* # of threads to skip at the next period */
+static struct dentry *gparent;
+
+#ifdef CONFIG_DEBUG_STACK_USAGE
+#define SAMPLE_MODE  "high-water mark (CONFIG_DEBUG_STACK_USAGE canary scan)"
+#elif defined(CONFIG_X86) || defined(CONFIG_ARM64)
+#define SAMPLE_MODE  "sampled depth (saved stack pointer of non-running threads)"
+#else
+#define SAMPLE_MODE  "unsupported (needs CONFIG_DEBUG_STACK_USAGE, or x86/ARM64)"
+#endif
+
+/*
+ * stack_used()
+ * Returns our estimate of the bytes of @t's kernel stack used, 0 if we can't
+ * tell. The caller holds a reference on both @t and its stack.
+ */
+static unsigned long stack_used(struct task_struct *t, void *stack)
+{
+	unsigned long base = (unsigned long)stack;
+
+	if (t->flags & PF_EXITING)
+		return 0;
+#ifdef CONFIG_DEBUG_STACK_USAGE
+	return THREAD_SIZE - stack_not_used(t);
+#else
+	{
+	unsigned long sp;
+
+#ifdef CONFIG_SMP
+	if (READ_ONCE(t->on_cpu))	/* running; it's saved SP is stale */
+		return 0;
+#endif
+#if defined(CONFIG_X86)
+	sp = READ_ONCE(t->thread.sp);
+#elif defined(CONFIG_ARM64)
+	sp = thread_saved_sp(t);
+#else
+	sp = 0;
+#endif
+	if (sp <= base || sp > base + THREAD_SIZE)
+		return 0;
+	return base + THREAD_SIZE - sp;	/* the stack grows down */
+	}
+#endif
+}
+
+/* Update the 'top N' table; the caller holds stats.mtx */
+static void update_top(struct task_struct *t, unsigned long used)
+{
+	int i, min = 0;
+
+	for (i = 0; i < stats.nr_top; i++) {
+		if (stats.top[i].pid == t->pid) {
+			if (used > stats.top[i].maxused)
+				stats.top[i].maxused = used;
+			return;
+		}
+		if (stats.top[i].maxused < stats.top[min].maxused)
+			min = i;
+	}
+	if (stats.nr_top < topn)
+		i = stats.nr_top++;
+	else if (used > stats.top[min].maxused)
+		i = min;
+	else
+		return;
+
+	stats.top[i].pid = t->pid;
+	stats.top[i].tgid = t->tgid;
+	memcpy(stats.top[i].comm, t->comm, TASK_COMM_LEN);
+	stats.top[i].comm[TASK_COMM_LEN - 1] = '\0';
+	stats.top[i].maxused = used;
+}
+
+/*
+ * Our (periodic) work function: sample the next batch of threads. Under RCU,
+ * we just skip the ones already done this pass and grab references on the
+ * next SAMPLE_BATCH; the (slow) stack scans happen outside of it.
+ */
+static void sample_stacks(struct work_struct *work)
+{
+	struct task_struct *g, *t;	/* 'g' : process ptr; 't': thread ptr */
+	unsigned long used, skip = cursor;
+	int i, nr = 0;
+	bool wrapped = true;
+	void *stack;
+
+	rcu_read_lock();
+	do_each_thread(g, t) {
+		if (skip) {
+			skip--;
+			continue;
+		}
+		if (nr == SAMPLE_BATCH) {
+			wrapped = false;
+			goto out_unlock;
+		}
+		get_task_struct(t);
+		batch[nr++] = t;
+	} while_each_thread(g, t);
+out_unlock:
+	rcu_read_unlock();
+	cursor = wrapped ? 0 : cursor + nr;
+
+	for (i = 0; i < nr; i++) {
+		t = batch[i];
+		stack = try_get_task_stack(t);
+		used = stack ? stack_used(t, stack) : 0;
+		if (stack)
+			put_task_stack(t);
+		if (used) {
+			mutex_lock(&stats.mtx);
+			stats.nr_samples++;
+			stats.hist[min_t(unsigned long, used / BUCKET_SZ, NR_BUCKETS - 1)]++;
+			if (used > stats.maxused)
+				stats.maxused = used;
+			update_top(t, used);
+			mutex_unlock(&stats.mtx);
+		}
+		put_task_struct(t);
+		cond_resched();
+	}
+	if (wrapped) {
+		mutex_lock(&stats.mtx);
+		stats.nr_passes++;
+		mutex_unlock(&stats.mtx);
+	}
+
+	schedule_delayed_work(&sample_work, msecs_to_jiffies(max(sample_ms, 10)));
+}
+
+static int cmp_top(const void *a, const void *b)
+{
+	const struct stk_top *x = a, *y = b;
+
+	return (x->maxused < y->maxused) - (x->maxused > y->maxused);
+}
+
+static int report_show(struct seq_file *seq, void *v)
+{
+	struct stk_top *top;
+	int i, j, nr_top, width;
+
+	top = kmalloc_array(TOPN_MAX, sizeof(*top), GFP_KERNEL);
+	if (!top)
+		return -ENOMEM;
+
+	mutex_lock(&stats.mtx);
+	seq_printf(seq, "mode: %s\nTHREAD_SIZE = %lu bytes; %lu samples over %lu passes"
+		   " (every %d ms, %d threads at a time)\nmax usage seen: %lu bytes (%lu%%)\n",
+		   SAMPLE_MODE, (unsigned long)THREAD_SIZE, stats.nr_samples,
+		   stats.nr_passes, sample_ms, SAMPLE_BATCH, stats.maxused,
+		   stats.maxused * 100 / THREAD_SIZE);
+
+	seq_puts(seq, "\nHistogram of stack usage samples:\n");
+	for (i = 0; i < NR_BUCKETS; i++) {
+		seq_printf(seq, " %6lu - %6lu : %10lu ", i * BUCKET_SZ,
+			   (i + 1) * BUCKET_SZ - 1, stats.hist[i]);
+		width = stats.nr_samples ? stats.hist[i] * 50 / stats.nr_samples : 0;
+		for (j = 0; j < width; j++)
+			seq_putc(seq, '#');
+		seq_putc(seq, '\n');
+	}
+
+	nr_top = stats.nr_top;
+	memcpy(top, stats.top, nr_top * sizeof(*top));
+	mutex_unlock(&stats.mtx);
+
+	sort(top, nr_top, sizeof(*top), cmp_top, NULL);
+	seq_printf(seq, "\nTop %d threads by kernel stack usage (closest to overflow first):\n"
+		   "    TGID     PID     Thread Name   used(bytes)  used%%  left(bytes)\n",
+		   nr_top);
+	for (i = 0; i < nr_top; i++)
+		seq_printf(seq, "%8d %8d %16s  %10lu   %3lu%%   %10lu\n",
+			   top[i].tgid, top[i].pid, top[i].comm, top[i].maxused,
+			   top[i].maxused * 100 / THREAD_SIZE,
+			   THREAD_SIZE - top[i].maxused);
+	kfree(top);
+	return 0;
+}
+
+static int report_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, report_show, NULL);
+}
+
+/* Any write resets the stats */
+static ssize_t report_write(struct file *filp, const char __user *ubuf,
+			    size_t count, loff_t *off)
+{
+	mutex_lock(&stats.mtx);
+	stats.nr_samples = stats.nr_passes = stats.maxused = 0;
+	memset(stats.hist, 0, sizeof(stats.hist));
+	stats.nr_top = 0;
+	mutex_unlock(&stats.mtx);
+	return count;
+}
+
+static const struct file_operations report_fops = {
+	.owner = THIS_MODULE,
+	.open = report_open,
+	.read = seq_read,
+	.write = report_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init thrd_stacksampler_init(void)
+{
+	struct dentry *file;
+
+	if (topn < 1 || topn > TOPN_MAX) {
+		pr_warn("invalid topn (%d), must be in the range [1-%d]\n", topn, TOPN_MAX);
+		return -EINVAL;
+	}
+	mutex_init(&stats.mtx);
+
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent)) {
+		pr_warn("debugfs_create_dir failed (is debugfs enabled/mounted?)\n");
+		return -ENODEV;
+	}
+	file = debugfs_create_file("report", 0644, gparent, NULL, &report_fops);
+	if (IS_ERR_OR_NULL(file)) {
+		pr_warn("debugfs_create_file failed\n");
+		debugfs_remove_recursive(gparent);
+		return -ENODEV;
+	}
+
+	INIT_DELAYED_WORK(&sample_work, sample_stacks);
+	schedule_delayed_work(&sample_work, 0);
+	pr_info("inserted; mode: %s; THREAD_SIZE=%lu\n", SAMPLE_MODE,
+		(unsigned long)THREAD_SIZE);
+	return 0;		/* success */
+}
+
+static void __exit thrd_stacksampler_exit(void)
+{
+	cancel_delayed_work_sync(&sample_work);
+	debugfs_remove_recursive(gparent);
+	pr_info("removed\n");
+}
+
+module_init(thrd_stacksampler_init);
+module_exit(thrd_stacksampler_exit);
@@ -0,0 +1,337 @@
+/*
+ * ch7/aslr_entropy/aslr_entropy.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 7: Kernel and Memory Management Internals Essentials
+ ****************************************************************
+ * Brief Description:
+ * Our ch7/ASLR_check.sh script shows ASLR at work by grep-ing
+ * /proc/self/maps a couple of times. How *much* randomness do we really
+ * get though? And what does it cost at process startup?
+ *
+ * This harness spawns (fork+exec by default, posix_spawn with -p) many
+ * short-lived instances of itself, 'jobs' of them in parallel. Each child
+ * records the base of its:
+ *  stack  (a local variable), mmap (a fresh anonymous mmap()), heap (the
+ *  initial program break), vdso (AT_SYSINFO_EHDR), exe (the address of
+ *  a routine of ours; PIE required) and libc (the address of a libc routine)
+ * into its slot in a shared temp file. For each region, we then compute:
+ *  - varbits : the # of address bits that changed at all,
+ *  - H(bits) : the sum of the per-bit (Shannon) entropies,
+ *  - H(bday) : an estimate from the # of colliding pairs (the 'birthday'
+ *              estimator; only meaningful while there are collisions, else
+ *              we just know it's at least the value shown).
+ * The first two are upper bounds (they assume the bits are independent).
+ *
+ * We also time every spawn (from fork/posix_spawn to the child having been
+ * reaped) and report the spawn rate and the latency percentiles; with -b we
+ * run with ASLR on and off (via personality(ADDR_NO_RANDOMIZE), i.e., like
+ * 'setarch -R'), quantifying ASLR's startup cost.
+ *
+ * For details, please refer the book, Ch 7.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <spawn.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/personality.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+enum { R_STACK, R_MMAP, R_HEAP, R_VDSO, R_EXE, R_LIBC, NR_REGIONS };
+static const char *region_name[NR_REGIONS] = {
+	"stack", "mmap", "heap", "vdso", "exe", "libc"
+};
+
+struct rec {
+	uint64_t base[NR_REGIONS];
+};
+
+static int nspawn = 2000, jobs, use_spawn;
+static char *self;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* The child: record our bases into slot @idx of the file @fd, and exit */
+static int child(int fd, int idx)
+{
+	struct rec r;
+	volatile int local;
+	void *p = mmap(NULL, 4096, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	r.base[R_STACK] = (uintptr_t)&local;
+	r.base[R_MMAP] = (p == MAP_FAILED) ? 0 : (uintptr_t)p;
+	r.base[R_HEAP] = (uintptr_t)sbrk(0);
+	r.base[R_VDSO] = getauxval(AT_SYSINFO_EHDR);
+	r.base[R_EXE] = (uintptr_t)&child;
+	r.base[R_LIBC] = (uintptr_t)&getauxval;
+	if (pwrite(fd, &r, sizeof(r), (off_t)idx * sizeof(r)) != sizeof(r))
+		return 1;
+	return 0;
+}
+
+/* Spawn the child for slot @idx; returns its PID, -1 on failure */
+static pid_t spawn_one(int fd, int idx, int norand)
+{
+	char sfd[16], sidx[16];
+	char *args[] = { self, "--child", sfd, sidx, NULL };
+	pid_t pid;
+
+	snprintf(sfd, sizeof(sfd), "%d", fd);
+	snprintf(sidx, sizeof(sidx), "%d", idx);
+	if (use_spawn) {
+		/* the personality's inherited; the caller's set it for us */
+		if (posix_spawn(&pid, self, NULL, NULL, args, environ))
+			return -1;
+		return pid;
+	}
+	pid = fork();
+	if (pid == 0) {
+		if (norand)
+			personality(ADDR_NO_RANDOMIZE);
+		execv(self, args);
+		_exit(127);
+	}
+	return pid;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Entropy estimates for region @r over the @n records */
+static void entropy(struct rec *recs, int n, int r, int *varbits, double *hbits,
+		    double *hbday, long long *collisions)
+{
+	uint64_t *v = malloc(n * sizeof(uint64_t)), diff = 0;
+	long long pairs = 0, run = 1;
+	int i, b, ones;
+	double p;
+
+	*hbits = 0;
+	for (b = 0; b < 64; b++) {
+		ones = 0;
+		for (i = 0; i < n; i++)
+			ones += (recs[i].base[r] >> b) & 1;
+		p = (double)ones / n;
+		if (p > 0 && p < 1)
+			*hbits += -p * log2(p) - (1 - p) * log2(1 - p);
+	}
+	for (i = 0; i < n; i++) {
+		v[i] = recs[i].base[r];
+		diff |= v[i] ^ v[0];
+	}
+	*varbits = __builtin_popcountll(diff);
+
+	/* # of colliding pairs: n^2 / (2 * pairs) estimates the # of values */
+	qsort(v, n, sizeof(uint64_t), cmp_u64);
+	for (i = 1; i <= n; i++) {
+		if (i < n && v[i] == v[i - 1]) {
+			run++;
+			continue;
+		}
+		pairs += run * (run - 1) / 2;
+		run = 1;
+	}
+	*collisions = pairs;
+	*hbday = log2((double)n * (n - 1) / 2 / (pairs ? pairs : 1));
+	free(v);
+}
+
+static int run(int norand)
+{
+	char tmpl[] = "/tmp/aslr_entropy.XXXXXX";
+	struct rec *recs;
+	uint64_t *lat, *start, t0, total;
+	pid_t *pids, pid;
+	int fd, i, j, inflight = 0, status, failed = 0, nlat = 0, nrec, varbits, r;
+	long long coll;
+	double hbits, hbday;
+	int oldpers = personality(0xffffffff);
+
+	fd = mkstemp(tmpl);
+	if (fd < 0) {
+		perror("mkstemp");
+		return -1;
+	}
+	unlink(tmpl);
+	if (ftruncate(fd, (off_t)nspawn * sizeof(struct rec)) < 0) {
+		perror("ftruncate");
+		return -1;
+	}
+	lat = calloc(nspawn, sizeof(uint64_t));
+	start = calloc(jobs, sizeof(uint64_t));
+	pids = calloc(jobs, sizeof(pid_t));
+	recs = calloc(nspawn, sizeof(struct rec));
+	if (!lat || !start || !pids || !recs) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+	if (use_spawn && norand)
+		personality(oldpers | ADDR_NO_RANDOMIZE);
+
+	/* keep 'jobs' children in flight */
+	t0 = now_ns();
+	for (i = 0; i < nspawn || inflight; ) {
+		if (i < nspawn && inflight < jobs) {
+			for (j = 0; pids[j]; j++)
+				;
+			start[j] = now_ns();
+			pids[j] = spawn_one(fd, i, norand);
+			if (pids[j] < 0) {
+				perror("spawn");
+				pids[j] = 0;
+				failed++;
+			} else {
+				inflight++;
+			}
+			i++;
+			continue;
+		}
+		pid = wait(&status);
+		if (pid < 0)
+			break;
+		for (j = 0; j < jobs && pids[j] != pid; j++)
+			;
+		if (j == jobs)
+			continue;
+		lat[nlat++] = now_ns() - start[j];
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed++;
+		pids[j] = 0;
+		inflight--;
+	}
+	total = now_ns() - t0;
+	if (use_spawn && norand)
+		personality(oldpers);
+
+	if (pread(fd, recs, nspawn * sizeof(struct rec), 0) != (ssize_t)(nspawn * sizeof(struct rec)))
+		perror("pread");
+	close(fd);
+	/* drop the (zeroed) slots of the children that failed */
+	for (i = 0, nrec = 0; i < nspawn; i++)
+		if (recs[i].base[R_STACK])
+			recs[nrec++] = recs[i];
+
+	qsort(lat, nlat, sizeof(uint64_t), cmp_u64);
+	printf("\nASLR %s (%s, %d jobs): %d spawns in %.3f s = %.0f spawns/s (%d failed)\n",
+	       norand ? "OFF" : "on ", use_spawn ? "posix_spawn" : "fork+exec", jobs, nspawn,
+	       total / 1e9, nspawn / (total / 1e9), failed);
+	if (nlat)
+		printf(" spawn->reaped latency (us): p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+		       lat[nlat / 2] / 1e3, lat[nlat * 9 / 10] / 1e3, lat[nlat * 99 / 100] / 1e3,
+		       lat[nlat - 1] / 1e3);
+	if (nrec < 2)
+		goto out;
+
+	printf(" %-6s %18s %8s %8s %8s %10s\n", "region", "sample", "varbits", "H(bits)",
+	       "H(bday)", "collisions");
+	for (r = 0; r < NR_REGIONS; r++) {
+		entropy(recs, nrec, r, &varbits, &hbits, &hbday, &coll);
+		printf(" %-6s %#18lx %8d %8.1f %s%7.1f %10lld\n", region_name[r],
+		       (unsigned long)recs[0].base[r], varbits, hbits, coll ? " " : ">",
+		       hbday, coll);
+	}
+out:
+	free(lat);
+	free(start);
+	free(pids);
+	free(recs);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-n spawns] [-j jobs] [-p] [-r | -b]\n"
+		" -n : # of processes to spawn (default %d)\n"
+		" -j : # of them in flight in parallel (default: # of CPUs)\n"
+		" -p : use posix_spawn(3) instead of fork+exec\n"
+		" -r : run with ASLR off (personality(ADDR_NO_RANDOMIZE))\n"
+		" -b : run with ASLR on and then off, to compare the spawn rate\n",
+		name, nspawn);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, norand = 0, both = 0;
+	FILE *fp;
+	int rvs = -1;
+
+	if (argc == 4 && !strcmp(argv[1], "--child"))
+		return child(atoi(argv[2]), atoi(argv[3]));
+
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "n:j:prbh")) != -1) {
+		switch (opt) {
+		case 'n':
+			nspawn = atoi(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'p':
+			use_spawn = 1;
+			break;
+		case 'r':
+			norand = 1;
+			break;
+		case 'b':
+			both = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nspawn < 2 || jobs < 1)
+		usage(argv[0]);
+
+	self = realpath("/proc/self/exe", NULL);
+	if (!self) {
+		perror("realpath");
+		exit(EXIT_FAILURE);
+	}
+	fp = fopen("/proc/sys/kernel/randomize_va_space", "r");
+	if (fp) {
+		if (fscanf(fp, "%d", &rvs) != 1)
+			rvs = -1;
+		fclose(fp);
+	}
+	printf("%s: randomize_va_space = %d; %d spawns per run\n", argv[0], rvs, nspawn);
+	if (rvs == 0)
+		printf(" (ASLR's globally off; all regions will show 0 bits)\n");
+
+	if (both) {
+		if (run(0) < 0 || run(1) < 0)
+			exit(EXIT_FAILURE);
+	} else if (run(norand) < 0) {
+		exit(EXIT_FAILURE);
+	}
+	free(self);
+	exit(EXIT_SUCCESS);
+}
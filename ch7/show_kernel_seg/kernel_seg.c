@@ -19,6 +19,19 @@
  * Optionally also displays key info of the user VAS if the module parameter
  * show_uservas is set to 1.
  *
+ * Besides the (static) boundaries, the debugfs file
+ *  <debugfs_mount>/show_kernel_seg/occupancy
+ * shows (x86_64 only) how full some of these regions are, live: the vmalloc
+ * and module regions' mapped bytes, # of mapped runs and largest free hole
+ * (a measure of vmalloc space fragmentation), and the direct map (lowmem)
+ * page size breakdown (4K/2M/1G, as the DirectMap* lines of /proc/meminfo).
+ * It's computed by walking the kernel page tables on every read, so you can
+ * track it over time on long-running systems.
+ * Extending the show_userspace_info() view of 'current', the debugfs file
+ *  <debugfs_mount>/show_kernel_seg/vmas
+ * analyzes the VMA layout of any process; see the 'VMA layout analyzer'
+ * comment below.
+ *
  * Useful! With show_uservas=1 we literally 'see' the full memory map of the
  * process, including kernel-space.
  * (Also, fyi, for a more detailed view of the kernel/user VAS, check out the
@@ -35,6 +48,12 @@
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/version.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/task.h>
+#include <linux/hugetlb.h>
+#include <linux/uaccess.h>
 #include <asm/pgtable.h>
 #include <asm/fixmap.h>
 #include "../../klib_llkd.h"
@@ -45,7 +64,7 @@
 MODULE_AUTHOR("Kaiwan N Billimoria");
 MODULE_DESCRIPTION("LKP book:ch7/kernel_seg: display some kernel segment details");
 MODULE_LICENSE("Dual MIT/GPL");
-MODULE_VERSION("0.1");
+MODULE_VERSION("0.2");
 
 /* Module parameters */
 static int show_uservas;
@@ -56,6 +75,179 @@ MODULE_PARM_DESC(show_uservas, "Show some user space VAS details; 0 = no (defaul
 
 extern void llkd_minsysinfo(void);	// it's in our klib_llkd 'library'
 
+static struct dentry *gparent;
+
+/* Is the page table entry a 'leaf', i.e., does it map a large page? */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+#define kseg_pud_leaf(pud)	pud_leaf(pud)
+#define kseg_pmd_leaf(pmd)	pmd_leaf(pmd)
+#elif defined(CONFIG_X86)
+#define kseg_pud_leaf(pud)	pud_large(pud)
+#define kseg_pmd_leaf(pmd)	pmd_large(pmd)
+#else
+#define kseg_pud_leaf(pud)	0
+#define kseg_pmd_leaf(pmd)	pmd_trans_huge(pmd)
+#endif
+
+#if defined(CONFIG_X86_64) && (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0))
+#define KSEG_OCCUPANCY
+
+enum { KSEG_4K, KSEG_2M, KSEG_1G, KSEG_NR_LEVELS };
+
+/* The occupancy of a kernel virtual address range */
+struct kseg_occ {
+	unsigned long mapped, by_level[KSEG_NR_LEVELS];
+	unsigned long nr_runs, free, hole, largest_hole, largest_hole_start;
+	unsigned long hole_start;
+	bool in_run;
+};
+
+static void kseg_account(struct kseg_occ *o, unsigned long addr, unsigned long len,
+			 int mapped_level)
+{
+	if (mapped_level >= 0) {
+		o->mapped += len;
+		o->by_level[mapped_level] += len;
+		if (!o->in_run)
+			o->nr_runs++;
+		o->in_run = true;
+		o->hole = 0;
+		return;
+	}
+	if (o->in_run || !o->hole)
+		o->hole_start = addr;
+	o->in_run = false;
+	o->free += len;
+	o->hole += len;
+	if (o->hole > o->largest_hole) {
+		o->largest_hole = o->hole;
+		o->largest_hole_start = o->hole_start;
+	}
+}
+
+/*
+ * Walk the kernel page tables over [start, end), skipping empty upper level
+ * entries in one go. init_mm isn't exported, but the kernel half of every
+ * x86_64 PGD is the same, so we use the one that's live (in CR3).
+ * We take no lock, so the tables can change under us: a concurrent (huge)
+ * vmap can turn a PMD that pointed to a PTE table into a leaf and free the
+ * PTE page (pmd_free_pte_page()). Were we to re-read *pmd, we could treat a
+ * leaf as a table or walk into a freed page. So (as GUP-fast does) we read
+ * each entry just once (READ_ONCE) and walk down from those snapshots, with
+ * IRQs off across a descent: the page-table page's freed only after a TLB
+ * flush IPI, which can't complete on this CPU till we're done. (Where the
+ * TLB's flushed without IPIs, f.e. via broadcast invalidation, that's not
+ * guaranteed; the window's tiny, but this is a debug aid, not production
+ * code.)
+ */
+static void kseg_walk(unsigned long start, unsigned long end, struct kseg_occ *o)
+{
+	pgd_t *pgd_base = __va(read_cr3_pa()), pgd;
+	unsigned long addr = start, next, sz, n = 0, flags;
+	p4d_t p4d;
+	pud_t pud;
+	pmd_t pmd;
+	int lvl;
+
+	memset(o, 0, sizeof(*o));
+	while (addr < end) {
+		lvl = -1;
+		local_irq_save(flags);
+		pgd = READ_ONCE(*(pgd_base + pgd_index(addr)));
+		if (pgd_none(pgd)) {
+			sz = PGDIR_SIZE;
+			goto next;
+		}
+		p4d = READ_ONCE(*p4d_offset(&pgd, addr));
+		if (p4d_none(p4d)) {
+			sz = P4D_SIZE;
+			goto next;
+		}
+		pud = READ_ONCE(*pud_offset(&p4d, addr));
+		sz = PUD_SIZE;
+		if (pud_none(pud) || !pud_present(pud))
+			goto next;
+		if (kseg_pud_leaf(pud)) {
+			lvl = KSEG_1G;
+			goto next;
+		}
+		pmd = READ_ONCE(*pmd_offset(&pud, addr));
+		sz = PMD_SIZE;
+		if (pmd_none(pmd) || !pmd_present(pmd))
+			goto next;
+		if (kseg_pmd_leaf(pmd)) {
+			lvl = KSEG_2M;
+			goto next;
+		}
+		sz = PAGE_SIZE;
+		if (pte_present(READ_ONCE(*pte_offset_kernel(&pmd, addr))))
+			lvl = KSEG_4K;
+next:
+		local_irq_restore(flags);
+		next = (addr & ~(sz - 1)) + sz;
+		if (next > end || next < addr)	/* the latter: wrapped around */
+			next = end;
+		kseg_account(o, addr, next - addr, lvl);
+		addr = next;
+		if (!(++n % 4096))
+			cond_resched();
+	}
+}
+
+static void kseg_show_region(struct seq_file *seq, const char *name,
+			     unsigned long start, unsigned long end)
+{
+	struct kseg_occ o;
+	unsigned long total = end - start;
+
+	kseg_walk(start, end, &o);
+	seq_printf(seq, "%-15s %px - %px [%9lu MB]\n"
+		   "  mapped: %lu kB (4K: %lu kB, 2M: %lu kB, 1G: %lu kB) in %lu runs\n"
+		   "  free: %lu MB; largest hole: %lu MB @ %px; fragmentation: %lu%%\n",
+		   name, (void *)start, (void *)end, total >> 20,
+		   o.mapped >> 10, o.by_level[KSEG_4K] >> 10, o.by_level[KSEG_2M] >> 10,
+		   o.by_level[KSEG_1G] >> 10, o.nr_runs, o.free >> 20, o.largest_hole >> 20,
+		   (void *)o.largest_hole_start,
+		   o.free ? 100 - (unsigned long)div64_u64((u64)o.largest_hole * 100, o.free) : 0);
+}
+
+static int occupancy_show(struct seq_file *seq, void *v)
+{
+	struct kseg_occ o;
+
+	kseg_show_region(seq, "vmalloc region:", VMALLOC_START, VMALLOC_END);
+	kseg_show_region(seq, "module region:", MODULES_VADDR, MODULES_END);
+
+	/* the direct map; same as the DirectMap* lines of /proc/meminfo */
+	kseg_walk(PAGE_OFFSET, (unsigned long)high_memory, &o);
+	seq_printf(seq, "%-15s %px - %px [%9lu MB]\n"
+		   "  DirectMap4k: %lu kB, DirectMap2M: %lu kB, DirectMap1G: %lu kB\n",
+		   "lowmem region:", (void *)PAGE_OFFSET, high_memory,
+		   ((unsigned long)high_memory - PAGE_OFFSET) >> 20, o.by_level[KSEG_4K] >> 10,
+		   o.by_level[KSEG_2M] >> 10, o.by_level[KSEG_1G] >> 10);
+	return 0;
+}
+#else
+static int occupancy_show(struct seq_file *seq, void *v)
+{
+	seq_puts(seq, "occupancy: only supported on x86_64 (4.14 on)\n");
+	return 0;
+}
+#endif /* KSEG_OCCUPANCY */
+
+static int occupancy_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, occupancy_show, NULL);
+}
+
+static const struct file_operations occupancy_fops = {
+	.owner = THIS_MODULE,
+	.open = occupancy_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 /*
  * show_userspace_info
  * Display some arch-independent details of the usermode VAS.
@@ -111,6 +303,413 @@ static void show_userspace_info(void)
 #endif
 }
 
+/*
+ * The VMA layout analyzer: for any process, write its PID into
+ *  <debugfs_mount>/show_kernel_seg/vmas
+ * and read it back to see, for every VMA (by ascending address):
+ *  its range, size, RSS, THP coverage, the gap from the previous VMA,
+ *  its permissions and what maps it,
+ * followed by a summary: the # of VMAs and gaps, the largest gap, the
+ * 'densest' (most VMAs) 1 GB windows of the VAS - the culprit regions - and
+ * a 'FRAGMENTED' flag if the # of VMAs crosses vma_frag_thresh or most of
+ * the VMAs are tiny. (A huge # of VMAs makes mmap(), munmap() and fork()
+ * slow, and can hit the vm.max_map_count limit.)
+ * Writing "<pid> summary" skips the per-VMA lines. PID 0 (the default)
+ * implies the process opening the file (for reading).
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+#define KSEG_VMAS
+
+static int vma_frag_thresh = 10000;
+module_param(vma_frag_thresh, int, 0660);
+MODULE_PARM_DESC(vma_frag_thresh, "# of VMAs beyond which an address space is flagged as fragmented (default 10000)");
+
+#define SMALL_VMA	(64 * 1024)	/* what we consider a 'tiny' VMA */
+#define NR_DENSE	5		/* # of densest 1 GB windows shown */
+
+static DEFINE_MUTEX(vmas_mtx);
+static pid_t vmas_pid;
+static bool vmas_summary_only;
+
+struct dense_win {
+	unsigned long base;
+	int nr;
+};
+
+/* Keep the NR_DENSE windows with the most VMAs, in descending order */
+static void dense_insert(struct dense_win *top, unsigned long base, int nr)
+{
+	int i, j;
+
+	for (i = 0; i < NR_DENSE; i++) {
+		if (nr > top[i].nr) {
+			for (j = NR_DENSE - 1; j > i; j--)
+				top[j] = top[j - 1];
+			top[i].base = base;
+			top[i].nr = nr;
+			return;
+		}
+	}
+}
+
+/*
+ * Walk the page tables over the VMA to get its RSS and THP (PMD-mapped)
+ * coverage. We hold the mmap lock (in read mode), and, as page tables can be
+ * freed via RCU on recent kernels, the RCU read lock while at the PTEs.
+ * HIGHPTE (32-bit) page tables aren't in lowmem, so we skip those.
+ */
+static void vma_rss(struct mm_struct *mm, struct vm_area_struct *vma,
+		    unsigned long *rss, unsigned long *thp)
+{
+	unsigned long addr = vma->vm_start, next, sz;
+	pgd_t *pgd;
+	p4d_t *p4d;
+	pud_t *pud, pudval;
+	pmd_t *pmd, pmdval;
+	pte_t *pte;
+	int i, n;
+
+	*rss = *thp = 0;
+	while (addr < vma->vm_end) {
+		pgd = pgd_offset(mm, addr);
+		sz = PGDIR_SIZE;
+		if (pgd_none(*pgd) || pgd_bad(*pgd))
+			goto next;
+		p4d = p4d_offset(pgd, addr);
+		sz = P4D_SIZE;
+		if (p4d_none(*p4d) || p4d_bad(*p4d))
+			goto next;
+		pud = pud_offset(p4d, addr);
+		pudval = READ_ONCE(*pud);
+		sz = PUD_SIZE;
+		if (pud_none(pudval) || !pud_present(pudval))
+			goto next;
+		if (kseg_pud_leaf(pudval)) {
+			*rss += PUD_SIZE;	/* (hugetlb) */
+			goto next;
+		}
+		pmd = pmd_offset(pud, addr);
+		pmdval = READ_ONCE(*pmd);
+		sz = PMD_SIZE;
+		if (pmd_none(pmdval) || !pmd_present(pmdval))
+			goto next;
+		if (kseg_pmd_leaf(pmdval)) {
+			*rss += PMD_SIZE;
+			if (!is_vm_hugetlb_page(vma))
+				*thp += PMD_SIZE;
+			goto next;
+		}
+#ifndef CONFIG_HIGHPTE
+		/* the PTEs of this PMD that lie within the VMA */
+		next = min((addr & PMD_MASK) + PMD_SIZE, vma->vm_end);
+		n = (next - addr) >> PAGE_SHIFT;
+		rcu_read_lock();
+		pte = pte_offset_kernel(&pmdval, addr);
+		for (i = 0; i < n; i++)
+			if (pte_present(READ_ONCE(pte[i])))
+				*rss += PAGE_SIZE;
+		rcu_read_unlock();
+#endif
+next:
+		next = (addr & ~(sz - 1)) + sz;
+		if (next > vma->vm_end || next < addr)
+			next = vma->vm_end;
+		addr = next;
+	}
+}
+
+/* What maps this VMA: the file, a 'special' name, [heap], [stack] or [anon] */
+static const char *vma_name(struct mm_struct *mm, struct vm_area_struct *vma,
+			    char *buf, int len)
+{
+	const char *name;
+
+	if (vma->vm_file) {
+		name = file_path(vma->vm_file, buf, len);
+		return IS_ERR(name) ? "[?]" : name;
+	}
+	if (vma->vm_ops && vma->vm_ops->name) {
+		name = vma->vm_ops->name(vma);	/* f.e. [vdso] */
+		if (name)
+			return name;
+	}
+	if (vma->vm_start <= mm->brk && vma->vm_end >= mm->start_brk)
+		return "[heap]";
+	if (vma->vm_start <= mm->start_stack && vma->vm_end >= mm->start_stack)
+		return "[stack]";
+	return "[anon]";
+}
+
+/*
+ * The 'vmas' file's a seq_file iterator (not single_open()): the listing can
+ * run to several MB for processes with 10k's of VMAs, and single_open()
+ * would redo the whole walk every time the buffer overflowed. Instead, each
+ * batch (a read()'s worth) takes and drops the mmap lock, resuming at the
+ * first VMA at or after the 'next_start' address. The records are: the
+ * header (SEQ_START_TOKEN), the VMAs and the summary (VMAS_SUMMARY). A record
+ * may be shown more than once (when it doesn't fit the buffer), but ->next()
+ * is called just once per record, so that's where we account it.
+ */
+#define VMAS_SUMMARY	((void *)2)
+
+struct vmas_iter {
+	struct mm_struct *mm;	/* NULL: no such process / no user VAS */
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	char *buf;		/* for the file path */
+	bool summary_only, done;
+	/* from here on, reset at every (re)start */
+	unsigned long next_start;	/* resume the walk here */
+	unsigned long prev_end, win;
+	int win_nr;
+	unsigned long cur_start, cur_rss, cur_thp;	/* the last VMA shown */
+	/* the stats */
+	unsigned long nr, nr_small, nr_gaps, max_gap, size, rss, thp;
+	struct dense_win top[NR_DENSE];
+};
+
+static inline void vmas_lock(struct mm_struct *mm)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	mmap_read_lock(mm);
+#else
+	down_read(&mm->mmap_sem);
+#endif
+}
+
+static inline void vmas_unlock(struct mm_struct *mm)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	mmap_read_unlock(mm);
+#else
+	up_read(&mm->mmap_sem);
+#endif
+}
+
+/* The first VMA at or after it->next_start, else the summary */
+static void *vmas_at(struct vmas_iter *it)
+{
+	struct vm_area_struct *vma = find_vma(it->mm, it->next_start);
+
+	return vma ? (void *)vma : VMAS_SUMMARY;
+}
+
+static void vma_rss_cached(struct vmas_iter *it, struct vm_area_struct *vma)
+{
+	if (it->cur_start == vma->vm_start)
+		return;
+	vma_rss(it->mm, vma, &it->cur_rss, &it->cur_thp);
+	it->cur_start = vma->vm_start;
+}
+
+static void *vmas_start(struct seq_file *seq, loff_t *pos)
+{
+	struct vmas_iter *it = seq->private;
+
+	if (*pos == 0) {	/* (re)start from scratch */
+		memset(&it->next_start, 0, sizeof(*it) - offsetof(struct vmas_iter, next_start));
+		it->cur_start = -1UL;
+		it->done = false;
+	}
+	if (!it->mm)
+		return *pos ? NULL : SEQ_START_TOKEN;
+	vmas_lock(it->mm);
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	return it->done ? NULL : vmas_at(it);
+}
+
+static void *vmas_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	struct vmas_iter *it = seq->private;
+	struct vm_area_struct *vma = v;
+	unsigned long gap;
+
+	++*pos;
+	if (!it->mm)
+		return NULL;
+	if (v == SEQ_START_TOKEN)
+		return vmas_at(it);
+	if (v == VMAS_SUMMARY) {
+		it->done = true;
+		return NULL;
+	}
+
+	/* account this VMA */
+	vma_rss_cached(it, vma);
+	gap = it->prev_end ? vma->vm_start - it->prev_end : 0;
+	if (gap) {
+		it->nr_gaps++;
+		if (gap > it->max_gap)
+			it->max_gap = gap;
+	}
+	if (vma->vm_end - vma->vm_start <= SMALL_VMA)
+		it->nr_small++;
+	it->size += vma->vm_end - vma->vm_start;
+	it->rss += it->cur_rss;
+	it->thp += it->cur_thp;
+	it->nr++;
+	/* the VMAs are in address order, so each 1 GB window's a run */
+	if ((vma->vm_start >> 30) != it->win) {
+		dense_insert(it->top, it->win << 30, it->win_nr);
+		it->win = vma->vm_start >> 30;
+		it->win_nr = 0;
+	}
+	it->win_nr++;
+	it->prev_end = it->next_start = vma->vm_end;
+
+	cond_resched();
+	return vmas_at(it);
+}
+
+static void vmas_stop(struct seq_file *seq, void *v)
+{
+	struct vmas_iter *it = seq->private;
+
+	if (it->mm)
+		vmas_unlock(it->mm);
+}
+
+static int vmas_show(struct seq_file *seq, void *v)
+{
+	struct vmas_iter *it = seq->private;
+	struct vm_area_struct *vma = v;
+	struct dense_win top[NR_DENSE];
+	bool fragmented;
+	unsigned long gap;
+	int i;
+
+	if (v == SEQ_START_TOKEN) {
+		if (!it->mm) {
+			if (it->comm[0])
+				seq_printf(seq, "PID %d (%s) has no user VAS\n", it->pid, it->comm);
+			else
+				seq_printf(seq, "no such process (PID %d)\n", it->pid);
+			return 0;
+		}
+		seq_printf(seq, "PID %d (%s)\n", it->pid, it->comm);
+		if (!it->summary_only)
+			seq_printf(seq, "%-33s %10s %10s %8s %10s %4s %s\n", "start - end",
+				   "size(kB)", "rss(kB)", "thp(kB)", "gap(kB)", "prot", "mapping");
+		return 0;
+	}
+	if (v == VMAS_SUMMARY) {
+		/* the last window's still 'open'; don't close it in it->top (we may be re-shown) */
+		memcpy(top, it->top, sizeof(top));
+		dense_insert(top, it->win << 30, it->win_nr);
+		fragmented = (it->nr >= vma_frag_thresh) ||
+			     (it->nr >= 1000 && it->nr_small * 2 > it->nr);
+		seq_printf(seq, "Summary: %lu VMAs (%lu tiny, <= %d kB), total %lu MB, RSS %lu MB, THP %lu MB\n"
+			   " %lu gaps, largest %lu MB\n densest 1 GB windows (# VMAs):",
+			   it->nr, it->nr_small, SMALL_VMA >> 10, it->size >> 20, it->rss >> 20,
+			   it->thp >> 20, it->nr_gaps, it->max_gap >> 20);
+		for (i = 0; i < NR_DENSE && top[i].nr; i++)
+			seq_printf(seq, " %px:%d", (void *)top[i].base, top[i].nr);
+		seq_printf(seq, "\n address space %s\n", fragmented ? "** FRAGMENTED **" : "ok");
+		return 0;
+	}
+	if (it->summary_only)
+		return 0;
+
+	vma_rss_cached(it, vma);
+	gap = it->prev_end ? vma->vm_start - it->prev_end : 0;
+	seq_printf(seq, "%px-%px %10lu %10lu %8lu %10lu %c%c%c%c %s\n",
+		   (void *)vma->vm_start, (void *)vma->vm_end,
+		   (vma->vm_end - vma->vm_start) >> 10, it->cur_rss >> 10, it->cur_thp >> 10,
+		   gap >> 10,
+		   vma->vm_flags & VM_READ ? 'r' : '-',
+		   vma->vm_flags & VM_WRITE ? 'w' : '-',
+		   vma->vm_flags & VM_EXEC ? 'x' : '-',
+		   vma->vm_flags & VM_MAYSHARE ? 's' : 'p',
+		   vma_name(it->mm, vma, it->buf, PATH_MAX));
+	return 0;
+}
+
+static const struct seq_operations vmas_sops = {
+	.start = vmas_start,
+	.next = vmas_next,
+	.stop = vmas_stop,
+	.show = vmas_show,
+};
+
+/* Resolve the process (as last written, 0: the opener) and grab its mm */
+static int vmas_open(struct inode *inode, struct file *file)
+{
+	struct vmas_iter *it;
+	struct task_struct *tsk;
+	pid_t pid;
+
+	it = __seq_open_private(file, &vmas_sops, sizeof(*it));
+	if (!it)
+		return -ENOMEM;
+	it->buf = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!it->buf) {
+		seq_release_private(inode, file);
+		return -ENOMEM;
+	}
+	mutex_lock(&vmas_mtx);
+	pid = vmas_pid;
+	it->summary_only = vmas_summary_only;
+	mutex_unlock(&vmas_mtx);
+
+	rcu_read_lock();
+	tsk = pid ? pid_task(find_vpid(pid), PIDTYPE_PID) : current;
+	if (tsk)
+		get_task_struct(tsk);
+	rcu_read_unlock();
+	it->pid = pid;
+	if (tsk) {
+		it->pid = task_pid_nr(tsk);
+		strscpy(it->comm, tsk->comm, sizeof(it->comm));
+		it->mm = get_task_mm(tsk);	/* NULL for kernel threads */
+		put_task_struct(tsk);
+	}
+	return 0;
+}
+
+static int vmas_release(struct inode *inode, struct file *file)
+{
+	struct vmas_iter *it = ((struct seq_file *)file->private_data)->private;
+
+	if (it->mm)
+		mmput(it->mm);
+	kfree(it->buf);
+	return seq_release_private(inode, file);
+}
+
+/* Parse "<pid> [summary]" */
+static ssize_t vmas_write(struct file *filp, const char __user *ubuf,
+			  size_t count, loff_t *off)
+{
+	char kbuf[32], mode[16] = "";
+	int pid, n;
+
+	if (count >= sizeof(kbuf))
+		return -E2BIG;
+	if (copy_from_user(kbuf, ubuf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+	n = sscanf(kbuf, "%d %15s", &pid, mode);
+	if (n < 1 || pid < 0 || (n == 2 && strcmp(mode, "summary")))
+		return -EINVAL;
+
+	mutex_lock(&vmas_mtx);
+	vmas_pid = pid;
+	vmas_summary_only = (n == 2);
+	mutex_unlock(&vmas_mtx);
+	return count;
+}
+
+static const struct file_operations vmas_fops = {
+	.owner = THIS_MODULE,
+	.open = vmas_open,
+	.read = seq_read,
+	.write = vmas_write,
+	.llseek = seq_lseek,
+	.release = vmas_release,
+};
+#endif /* KSEG_VMAS */
+
 /*
  * show_kernelseg_info
  * Display kernel segment details as applicable to the architecture we're
@@ -206,6 +805,8 @@ static void show_kernelseg_info(void)
 
 static int __init kernel_seg_init(void)
 {
+	struct dentry *file;
+
 	pr_info("%s: inserted\n", OURMODNAME);
 
 	/* Display some minimal system info
@@ -223,11 +824,29 @@ static int __init kernel_seg_init(void)
 		pr_info("%s: skipping show userspace...\n", OURMODNAME);
 	}
 
+	/* The debugfs files are extras; we load fine without them */
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent)) {
+		pr_warn("%s: debugfs_create_dir failed (is debugfs enabled/mounted?);"
+			" no occupancy/vmas files\n", OURMODNAME);
+		gparent = NULL;
+		return 0;
+	}
+	file = debugfs_create_file("occupancy", 0444, gparent, NULL, &occupancy_fops);
+	if (IS_ERR_OR_NULL(file))
+		pr_warn("%s: debugfs_create_file (occupancy) failed\n", OURMODNAME);
+#ifdef KSEG_VMAS
+	file = debugfs_create_file("vmas", 0644, gparent, NULL, &vmas_fops);
+	if (IS_ERR_OR_NULL(file))
+		pr_warn("%s: debugfs_create_file (vmas) failed\n", OURMODNAME);
+#endif
+
 	return 0;		/* success */
 }
 
 static void __exit kernel_seg_exit(void)
 {
+	debugfs_remove_recursive(gparent);
 	pr_info("%s: removed\n", OURMODNAME);
 }
 
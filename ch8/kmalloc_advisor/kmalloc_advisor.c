@@ -0,0 +1,451 @@
+/*
+ * ch8/kmalloc_advisor/kmalloc_advisor.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 8 : Kernel Memory Allocation for Module Authors, Part 1
+ ****************************************************************
+ * Brief Description:
+ * Our ch8/slab4_actualsz_wstg_plot LKM shows the percentage of memory wasted
+ * (ksize() - request) for a synthetic sweep of kmalloc() request sizes. This
+ * *userspace* tool does the same analysis for your *real* allocation sizes,
+ * and goes a step further: it recommends what to do about the waste.
+ *
+ * Input (a file or stdin) is either:
+ *  a) a histogram: lines of the form  'size [count]'  (count defaults to 1;
+ *     '#' starts a comment), or
+ *  b) an ftrace trace of the kmem:kmalloc (and kmalloc_node) events, f.e.:
+ *      echo 1 > /sys/kernel/tracing/events/kmem/kmalloc/enable
+ *      cat /sys/kernel/tracing/trace_pipe > kmalloc.trace   # ^C when done
+ *     Here, the bytes_req= and bytes_alloc= fields are used, and allocations
+ *     are also keyed by their call_site=, so the advice points at the code.
+ *
+ * We then compute the internal fragmentation - the bytes allocated minus
+ * the bytes requested - across the kmalloc caches, and rank these kinds of
+ * remedies by the memory they'd save:
+ *  - 'cache' : a custom slab cache (kmem_cache_create()) of exactly the
+ *    (aligned) object size; we charge it for the slab's tail waste and for
+ *    one (partially empty) slab of fixed overhead;
+ *  - 'shrink': shrink the structure (reorder members to remove padding,
+ *    use smaller types, ...) by a few bytes so that it fits into the next
+ *    smaller kmalloc cache;
+ *  - 'pages' : (for sizes beyond the largest kmalloc cache, which come from
+ *    the page allocator in power-of-2 pages) use alloc_pages_exact().
+ * Only the best remedy for each (call site, size) is shown.
+ *
+ * The kmalloc size classes are the usual SLUB ones (8 bytes to 8 KB, with
+ * the 96 and 192 byte caches); use -m to model an arch with a larger minimum
+ * alignment (f.e. 64 or 128 on some ARM64 systems), or -S to read the actual
+ * kmalloc-* caches from /proc/slabinfo (needs root).
+ *
+ * For details, please refer the book, Ch 8.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+
+#define MAXCLASSES	32
+#define SITELEN		64
+
+static unsigned long classes[MAXCLASSES] = {
+	8, 16, 32, 64, 96, 128, 192, 256, 512, 1024, 2048, 4096, 8192
+};
+static int nclasses = 13;
+static unsigned long pgsz, align = sizeof(void *);
+
+/* One distinct allocation: (call site, requested size) */
+struct alloc_rec {
+	char site[SITELEN];
+	unsigned long size, alloc;	/* requested; actually allocated (each) */
+	unsigned long long count;
+	int used;
+};
+
+/* A simple open-addressing hash table of the above, grown on demand */
+static struct alloc_rec *tbl;
+static size_t tblsz, nrecs;
+
+struct advice {
+	struct alloc_rec *r;
+	const char *action;
+	unsigned long newsz;
+	long long saves;
+};
+
+static unsigned long hash(const char *site, unsigned long size)
+{
+	unsigned long h = 5381 + size * 2654435761UL;
+
+	while (*site)
+		h = h * 33 + (unsigned char)*site++;
+	return h;
+}
+
+static void tbl_grow(void)
+{
+	struct alloc_rec *old = tbl, *r;
+	size_t oldsz = tblsz, i;
+
+	tblsz = tblsz ? tblsz * 2 : 4096;
+	tbl = calloc(tblsz, sizeof(*tbl));
+	if (!tbl) {
+		perror("calloc failed");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < oldsz; i++) {
+		if (!old[i].used)
+			continue;
+		r = &tbl[hash(old[i].site, old[i].size) & (tblsz - 1)];
+		while (r->used)
+			r = (r == &tbl[tblsz - 1]) ? tbl : r + 1;
+		*r = old[i];
+	}
+	free(old);
+}
+
+static void add(const char *site, unsigned long size, unsigned long alloc,
+		unsigned long long count)
+{
+	struct alloc_rec *r;
+
+	if (!size || !count)
+		return;
+	if (nrecs * 2 >= tblsz)
+		tbl_grow();
+	r = &tbl[hash(site, size) & (tblsz - 1)];
+	while (r->used && (r->size != size || strcmp(r->site, site)))
+		r = (r == &tbl[tblsz - 1]) ? tbl : r + 1;
+	if (!r->used) {
+		r->used = 1;
+		r->size = size;
+		r->alloc = alloc;
+		snprintf(r->site, sizeof(r->site), "%s", site);
+		nrecs++;
+	}
+	r->count += count;
+}
+
+/* The kmalloc class index for @size, or -1 if it's served by the page allocator */
+static int class_of(unsigned long size)
+{
+	int i;
+
+	for (i = 0; i < nclasses; i++)
+		if (size <= classes[i])
+			return i;
+	return -1;
+}
+
+static unsigned long pages_alloc(unsigned long size)
+{
+	unsigned long sz = pgsz;
+
+	while (sz < size)
+		sz <<= 1;
+	return sz;
+}
+
+static unsigned long kmalloc_alloc(unsigned long size)
+{
+	int c = class_of(size);
+
+	return c < 0 ? pages_alloc(size) : classes[c];
+}
+
+/* Parse 'key=<number>' out of a trace line; 0 if absent */
+static unsigned long field_ul(const char *line, const char *key)
+{
+	const char *p = strstr(line, key);
+
+	return p ? strtoul(p + strlen(key), NULL, 0) : 0;
+}
+
+static void parse(FILE *fp)
+{
+	char line[1024], site[SITELEN], *p;
+	unsigned long size, alloc;
+	unsigned long long count;
+	int n;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (strstr(line, "bytes_req=")) {	/* an ftrace line */
+			/*
+			 * Match the event name field, not just "kmalloc" anywhere:
+			 * the call_site (f.e. kmalloc_reserve) of some other kmem
+			 * event (like kmem_cache_alloc) can contain it too
+			 */
+			if (!strstr(line, ": kmalloc:") && !strstr(line, ": kmalloc_node:"))
+				continue;	/* some other kmem event */
+			size = field_ul(line, "bytes_req=");
+			alloc = field_ul(line, "bytes_alloc=");
+			site[0] = '\0';
+			p = strstr(line, "call_site=");
+			if (p && sscanf(p + 10, "%63s", site) != 1)
+				site[0] = '\0';
+			add(site, size, alloc ? alloc : kmalloc_alloc(size), 1);
+			continue;
+		}
+		p = line;
+		while (isspace((unsigned char)*p))
+			p++;
+		if (!*p || *p == '#')
+			continue;
+		count = 1;
+		n = sscanf(p, "%lu %llu", &size, &count);
+		if (n < 1) {
+			fprintf(stderr, "skipping unrecognized line: %s", line);
+			continue;
+		}
+		add("", size, kmalloc_alloc(size), count);
+	}
+}
+
+/* Replace our class table with the actual kmalloc-* caches in /proc/slabinfo */
+static int read_slabinfo(void)
+{
+	char line[512], name[64];
+	unsigned long objsz, tmp[MAXCLASSES];
+	int i, j, n = 0;
+	FILE *fp = fopen("/proc/slabinfo", "r");
+
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		/* name <active_objs> <num_objs> <objsize> ... ; only the 'plain' caches */
+		if (sscanf(line, "%63s %*u %*u %lu", name, &objsz) != 2)
+			continue;
+		if (strncmp(name, "kmalloc-", 8) || !isdigit((unsigned char)name[8]))
+			continue;
+		for (j = 0; j < n && tmp[j] != objsz; j++)
+			;
+		if (j == n && n < MAXCLASSES)
+			tmp[n++] = objsz;
+	}
+	fclose(fp);
+	if (!n)
+		return -1;
+	/* sort ascending (it's tiny) */
+	for (i = 0; i < n; i++)
+		for (j = i + 1; j < n; j++)
+			if (tmp[j] < tmp[i]) {
+				objsz = tmp[i];
+				tmp[i] = tmp[j];
+				tmp[j] = objsz;
+			}
+	memcpy(classes, tmp, n * sizeof(tmp[0]));
+	nclasses = n;
+	return 0;
+}
+
+/*
+ * custom_cache_cost()
+ * The memory a dedicated slab cache needs per object of @size: the aligned
+ * object size plus it's share of the slab's tail waste. Like SLUB, we pick
+ * the smallest slab order (up to 3) whose tail waste is <= 1/16 of the slab.
+ * The slab size is returned via @slabsz.
+ */
+static double custom_cache_cost(unsigned long size, unsigned long *slabsz)
+{
+	unsigned long objsz = (size + align - 1) / align * align, slab = pgsz;
+	int order;
+
+	for (order = 0; order <= 3; order++) {
+		slab = pgsz << order;
+		if (slab >= objsz && (slab % objsz) * 16 <= slab)
+			break;
+	}
+	if (order > 3)
+		slab = pgsz << 3;
+	*slabsz = slab;
+	if (slab < objsz)	/* too large for a slab; no point */
+		return -1;
+	return (double)slab / (slab / objsz);
+}
+
+static int cmp_advice(const void *a, const void *b)
+{
+	const struct advice *x = a, *y = b;
+
+	return (y->saves > x->saves) - (y->saves < x->saves);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-n top-N] [-m min-class] [-a align] [-S] [file]\n"
+		" file : a 'size [count]' histogram, or an ftrace trace of the kmem:kmalloc\n"
+		"        event (default: stdin)\n"
+		" -n N : show the top N recommendations (default 10; 0 = all)\n"
+		" -m M : smallest kmalloc class (arch minimum alignment), f.e. 64 (default 8)\n"
+		" -a A : object alignment for custom caches (default %zu)\n"
+		" -S   : use the kmalloc-* caches in /proc/slabinfo as the size classes\n",
+		name, sizeof(void *));
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long nallocs = 0, req = 0, alloced = 0;
+	unsigned long long c_cnt[MAXCLASSES + 1] = { 0 }, c_req[MAXCLASSES + 1] = { 0 },
+		c_alloc[MAXCLASSES + 1] = { 0 };
+	unsigned long minclass = 0, slabsz, exact;
+	long long saves, total_saves = 0;
+	struct advice *adv, best;
+	struct alloc_rec *r;
+	double cost;
+	size_t i;
+	int opt, topn = 10, nadv = 0, c, j;
+	FILE *fp = stdin;
+
+	while ((opt = getopt(argc, argv, "n:m:a:Sh")) != -1) {
+		switch (opt) {
+		case 'n':
+			topn = atoi(optarg);
+			break;
+		case 'm':
+			minclass = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			align = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			if (read_slabinfo() < 0) {
+				fprintf(stderr, "%s: couldn't read kmalloc caches from /proc/slabinfo"
+					" (need root?)\n", argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (topn < 0 || !align || (align & (align - 1)))
+		usage(argv[0]);
+	if (optind < argc) {
+		fp = fopen(argv[optind], "r");
+		if (!fp) {
+			perror(argv[optind]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	pgsz = sysconf(_SC_PAGESIZE);
+
+	/* -m: drop the classes that the minimum alignment makes disappear */
+	if (minclass) {
+		for (j = 0, c = 0; c < nclasses; c++)
+			if (classes[c] >= minclass && classes[c] % minclass == 0)
+				classes[j++] = classes[c];
+		nclasses = j;
+		if (!nclasses)
+			usage(argv[0]);
+	}
+
+	parse(fp);
+	if (fp != stdin)
+		fclose(fp);
+	if (!nrecs) {
+		fprintf(stderr, "%s: no allocations found in the input\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	adv = calloc(nrecs, sizeof(*adv));
+	if (!adv) {
+		perror("calloc failed");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < tblsz; i++) {
+		r = &tbl[i];
+		if (!r->used)
+			continue;
+		nallocs += r->count;
+		req += r->size * r->count;
+		alloced += r->alloc * r->count;
+		c = class_of(r->alloc);
+		if (c < 0 || classes[c] != r->alloc)
+			c = class_of(r->size);
+		if (c < 0)
+			c = MAXCLASSES;		/* the page allocator */
+		c_cnt[c] += r->count;
+		c_req[c] += r->size * r->count;
+		c_alloc[c] += r->alloc * r->count;
+
+		if (r->alloc == r->size)
+			continue;
+		if (c == MAXCLASSES) {
+			/* page allocator: alloc_pages_exact() frees the unused tail pages */
+			exact = (r->size + pgsz - 1) / pgsz * pgsz;
+			saves = (long long)(r->alloc - exact) * r->count;
+			if (saves > 0)
+				adv[nadv++] = (struct advice){ r, "pages", exact, saves };
+			continue;
+		}
+		/* a custom slab cache, charged one slab as fixed overhead ... */
+		best = (struct advice){ r, NULL, 0, 0 };
+		cost = custom_cache_cost(r->size, &slabsz);
+		if (cost > 0) {
+			saves = (long long)((r->alloc - cost) * r->count) - slabsz;
+			if (saves > 0)
+				best = (struct advice){ r, "cache",
+					(r->size + align - 1) / align * align, saves };
+		}
+		/* ... or shrink to fit the next smaller class, if it's within 1/8th */
+		c = class_of(r->size);
+		if (c > 0 && (r->size - classes[c - 1]) * 8 <= classes[c - 1]) {
+			saves = (long long)(classes[c] - classes[c - 1]) * r->count;
+			if (saves > best.saves)
+				best = (struct advice){ r, "shrink", classes[c - 1], saves };
+		}
+		if (best.action)
+			adv[nadv++] = best;
+	}
+
+	printf("%llu allocations (%zu distinct), %llu bytes requested, %llu bytes allocated\n"
+	       "internal fragmentation: %llu bytes (%.2f%% of allocated)\n\n",
+	       nallocs, nrecs, req, alloced, alloced - req,
+	       alloced ? (alloced - req) * 100.0 / alloced : 0);
+
+	printf("%12s  %12s  %14s  %14s  %14s  %7s\n",
+	       "cache", "allocs", "requested", "allocated", "wasted", "waste%");
+	for (c = 0; c <= MAXCLASSES; c++) {
+		char name[32];
+
+		if (!c_cnt[c])
+			continue;
+		if (c == MAXCLASSES)
+			snprintf(name, sizeof(name), "pages");
+		else
+			snprintf(name, sizeof(name), "kmalloc-%lu", classes[c]);
+		printf("%12s  %12llu  %14llu  %14llu  %14llu  %6.2f%%\n", name, c_cnt[c],
+		       c_req[c], c_alloc[c], c_alloc[c] - c_req[c],
+		       (c_alloc[c] - c_req[c]) * 100.0 / c_alloc[c]);
+	}
+
+	qsort(adv, nadv, sizeof(*adv), cmp_advice);
+	printf("\nRecommendations (by expected savings):\n"
+	       "%-24s %8s %12s %9s %-7s %9s %14s\n", "call site", "size", "count",
+	       "now", "action", "new size", "saves (bytes)");
+	for (j = 0; j < nadv && (!topn || j < topn); j++) {
+		r = adv[j].r;
+		printf("%-24s %8lu %12llu %9lu %-7s %9lu %14lld\n",
+		       r->site[0] ? r->site : "-", r->size, r->count, r->alloc,
+		       adv[j].action, adv[j].newsz, adv[j].saves);
+		total_saves += adv[j].saves;
+	}
+	if (!nadv)
+		printf(" (none; nothing worth fixing!)\n");
+	else
+		printf("\nexpected total savings (of the above): %lld bytes (%.2f%% of allocated)\n",
+		       total_saves, total_saves * 100.0 / alloced);
+	free(adv);
+	free(tbl);
+	exit(EXIT_SUCCESS);
+}
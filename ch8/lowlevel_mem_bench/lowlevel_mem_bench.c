@@ -0,0 +1,449 @@
+/*
+ * ch8/lowlevel_mem_bench/lowlevel_mem_bench.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 8: Kernel Memory Allocation for Module Authors, Part 1
+ ****************************************************************
+ * Brief Description:
+ * Our ch8/lowlevel_mem module allocates exactly one chunk via each of the
+ * page allocator (BSA) APIs. Here, we turn that into a benchmark: we run
+ * N kernel threads, each bound to a CPU, that repeatedly allocate and free
+ * memory at every order from 0 to (the max order - 1), with the GFP flags
+ * of your choice. Per order, we measure:
+ *  - the throughput (allocations/sec, summed over all threads),
+ *  - the alloc and free latency (avg, min, max), and the distribution of
+ *    the alloc latency (a log2 histogram, from which we derive p50/p99),
+ *  - failures: how many, and the iteration at which the first one occurred.
+ * To not just measure the per-CPU page lists' fast path, each thread
+ * allocates a 'batch' of blocks before freeing them.
+ *
+ * The results are available as CSV via debugfs:
+ *  /sys/kernel/debug/lowlevel_mem_bench/results.csv   : per-order summary
+ *  /sys/kernel/debug/lowlevel_mem_bench/latency.csv   : per-order histogram
+ * To correlate the results with fragmentation, we snapshot the BSA free
+ * lists (via our klib_llkd 'library' code) before and after each run and
+ * show the delta in the kernel log; optionally (frag_period_ms), we also
+ * show the free list changes periodically while the benchmark runs.
+ *
+ * The benchmark runs at module init; to rerun it (perhaps after fragmenting
+ * memory in some way), write anything into
+ *  /sys/kernel/debug/lowlevel_mem_bench/run
+ *
+ * Careful! With high orders and 'aggressive' GFP flags (f.e. without
+ * __GFP_NORETRY), expect reclaim and compaction; run this on a test system.
+ *
+ * For details, please refer the book, Ch 8.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include "../../klib_llkd.h"
+
+#define OURMODNAME    "lowlevel_mem_bench"
+
+MODULE_DESCRIPTION("ch8: page allocator (BSA) throughput and latency benchmark");
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_LICENSE("Dual MIT/GPL");
+
+static int nthreads;
+module_param(nthreads, int, 0644);
+MODULE_PARM_DESC(nthreads, "# of benchmark kthreads, each bound to a CPU (default: # online CPUs)");
+
+static int iters = 1024;
+module_param(iters, int, 0644);
+MODULE_PARM_DESC(iters, "# of allocations per order per thread (default 1024)");
+
+static int batch = 16;
+module_param(batch, int, 0644);
+MODULE_PARM_DESC(batch, "# of blocks allocated before they're freed (default 16)");
+
+static int max_order = LLKD_NR_ORDERS - 1;
+module_param(max_order, int, 0644);
+MODULE_PARM_DESC(max_order, "highest order to benchmark (default: the max order - 1)");
+
+static uint gfp = (__force uint)(GFP_KERNEL | __GFP_NOWARN);
+module_param(gfp, uint, 0644);
+MODULE_PARM_DESC(gfp, "the GFP flags (raw value; default GFP_KERNEL|__GFP_NOWARN)");
+
+static uint frag_period_ms;
+module_param(frag_period_ms, uint, 0444);
+MODULE_PARM_DESC(frag_period_ms, "if non-zero, show BSA free list changes every these many ms");
+
+#define NR_LAT_BUCKETS  32	/* log2(ns) buckets: [2^i, 2^(i+1)) ns */
+
+struct order_stats {
+	u64 allocs, fails, frees;
+	s64 first_fail_iter;	/* -1 => none */
+	u64 alloc_ns, alloc_min_ns, alloc_max_ns, free_ns;
+	u64 wall_ns;		/* time this thread spent on this order */
+	u64 lat_hist[NR_LAT_BUCKETS];
+};
+
+struct bench_thrd {
+	struct task_struct *task;
+	int cpu;
+	bool done;
+	struct page **pages;
+	struct order_stats os[LLKD_NR_ORDERS];
+};
+
+static struct bench_thrd *thrds;
+static int nr_thrds;
+static gfp_t run_gfp;
+static int run_max_order, run_iters, run_batch;
+static atomic_t nr_done;
+static DEFINE_MUTEX(run_mtx);	/* serializes (re)starting runs vs reading results */
+static struct dentry *gparent;
+static struct llkd_frag_snap *frag_before, *frag_after;
+
+static inline void lat_record(struct order_stats *os, u64 ns)
+{
+	int b = ns ? ilog2(ns) : 0;
+
+	os->lat_hist[min(b, NR_LAT_BUCKETS - 1)]++;
+}
+
+static void bench_one_order(struct bench_thrd *bt, int order)
+{
+	struct order_stats *os = &bt->os[order];
+	u64 t0, t1, wall0 = ktime_get_ns();
+	int i = 0, j, n;
+
+	os->first_fail_iter = -1;
+	os->alloc_min_ns = U64_MAX;
+	while (i < run_iters && !kthread_should_stop()) {
+		/* allocate a batch ... */
+		for (n = 0; n < run_batch && i < run_iters; n++, i++) {
+			t0 = ktime_get_ns();
+			bt->pages[n] = alloc_pages(run_gfp, order);
+			t1 = ktime_get_ns() - t0;
+			if (!bt->pages[n]) {
+				os->fails++;
+				if (os->first_fail_iter < 0)
+					os->first_fail_iter = i;
+				n--;	/* nothing to free for this one */
+				continue;
+			}
+			os->allocs++;
+			os->alloc_ns += t1;
+			os->alloc_min_ns = min(os->alloc_min_ns, t1);
+			os->alloc_max_ns = max(os->alloc_max_ns, t1);
+			lat_record(os, t1);
+		}
+		/* ... and free it */
+		for (j = 0; j < n; j++) {
+			t0 = ktime_get_ns();
+			__free_pages(bt->pages[j], order);
+			os->free_ns += ktime_get_ns() - t0;
+			os->frees++;
+		}
+		cond_resched();
+	}
+	if (!os->allocs)
+		os->alloc_min_ns = 0;
+	os->wall_ns = ktime_get_ns() - wall0;
+}
+
+/* The benchmark kthread; it's bound to CPU bt->cpu */
+static int bench_thread(void *arg)
+{
+	struct bench_thrd *bt = arg;
+	int order;
+
+	for (order = 0; order <= run_max_order && !kthread_should_stop(); order++)
+		bench_one_order(bt, order);
+
+	WRITE_ONCE(bt->done, true);
+	if (atomic_inc_return(&nr_done) == nr_thrds) {
+		pr_info("run complete (%d threads, orders 0-%d); see the results.csv file\n",
+			nr_thrds, run_max_order);
+		/* we're the last one; show how the run affected fragmentation */
+		llkd_frag_snapshot(frag_after);
+		llkd_frag_show_delta(frag_before, frag_after);
+	}
+
+	/* We must not exit until we're kthread_stop()-ed */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+	return 0;
+}
+
+/* Stop and free the threads of the previous run (if any); needs run_mtx */
+static void stop_run(void)
+{
+	int i;
+
+	for (i = 0; i < nr_thrds; i++) {
+		if (thrds[i].task)
+			kthread_stop(thrds[i].task);
+		kfree(thrds[i].pages);
+	}
+	vfree(thrds);
+	thrds = NULL;
+	nr_thrds = 0;
+}
+
+static int start_run(void)
+{
+	int cpu, i = 0, want;
+
+	if (max_order < 0 || max_order >= LLKD_NR_ORDERS || iters <= 0 || batch <= 0) {
+		pr_warn("invalid parameter(s): max_order=%d (0-%d), iters=%d, batch=%d\n",
+			max_order, LLKD_NR_ORDERS - 1, iters, batch);
+		return -EINVAL;
+	}
+	stop_run();
+
+	want = nthreads > 0 ? min_t(int, nthreads, num_online_cpus()) : num_online_cpus();
+	/* vzalloc: the per-order stats make this large-ish */
+	thrds = vzalloc(array_size(want, sizeof(*thrds)));
+	if (!thrds)
+		return -ENOMEM;
+
+	/* snapshot the params so that they can't change under a running benchmark */
+	run_gfp = (__force gfp_t)gfp;
+	run_max_order = max_order;
+	run_iters = iters;
+	run_batch = batch;
+	atomic_set(&nr_done, 0);
+	llkd_frag_snapshot(frag_before);
+
+	for_each_online_cpu(cpu) {
+		if (i == want)
+			break;
+		thrds[i].cpu = cpu;
+		thrds[i].pages = kcalloc(run_batch, sizeof(struct page *), GFP_KERNEL);
+		if (!thrds[i].pages)
+			goto err;
+		thrds[i].task = kthread_create(bench_thread, &thrds[i], "%s/%d",
+					       OURMODNAME, cpu);
+		if (IS_ERR(thrds[i].task)) {
+			thrds[i].task = NULL;
+			kfree(thrds[i].pages);
+			goto err;
+		}
+		kthread_bind(thrds[i].task, cpu);
+		i++;
+	}
+	nr_thrds = i;
+	for (i = 0; i < nr_thrds; i++)
+		wake_up_process(thrds[i].task);
+
+	pr_info("started: %d threads, orders 0-%d, %d iters/order, batch %d, gfp 0x%x\n",
+		nr_thrds, run_max_order, run_iters, run_batch, gfp);
+	return 0;
+ err:
+	nr_thrds = i;
+	stop_run();
+	return -ENOMEM;
+}
+
+/* Approximate percentile @pct from the summed log2 histogram @h */
+static u64 hist_pctile(const u64 *h, u64 total, int pct)
+{
+	u64 sum = 0, want = div_u64(total * pct, 100);
+	int b;
+
+	for (b = 0; b < NR_LAT_BUCKETS; b++) {
+		sum += h[b];
+		if (sum > want)
+			return 1ULL << (b + 1);	/* the bucket's upper bound */
+	}
+	return 0;
+}
+
+static int results_show(struct seq_file *seq, void *v)
+{
+	struct order_stats sum;
+	int order, t, b, done = 0;
+	u64 allocs_per_sec;
+
+	mutex_lock(&run_mtx);
+	for (t = 0; t < nr_thrds; t++)
+		done += READ_ONCE(thrds[t].done);
+	seq_printf(seq, "# %d/%d threads done; gfp=0x%x iters=%d batch=%d\n",
+		   done, nr_thrds, (__force uint)run_gfp, run_iters, run_batch);
+	seq_puts(seq, "order,size_kb,threads,allocs,fails,first_fail_iter,allocs_per_sec,"
+		 "alloc_ns_avg,alloc_ns_min,alloc_ns_max,alloc_ns_p50,alloc_ns_p99,free_ns_avg\n");
+
+	for (order = 0; order <= run_max_order && nr_thrds; order++) {
+		memset(&sum, 0, sizeof(sum));
+		sum.first_fail_iter = -1;
+		sum.alloc_min_ns = U64_MAX;
+		allocs_per_sec = 0;
+		for (t = 0; t < nr_thrds; t++) {
+			struct order_stats *os = &thrds[t].os[order];
+
+			sum.allocs += os->allocs;
+			sum.fails += os->fails;
+			sum.frees += os->frees;
+			sum.alloc_ns += os->alloc_ns;
+			sum.free_ns += os->free_ns;
+			if (os->allocs)
+				sum.alloc_min_ns = min(sum.alloc_min_ns, os->alloc_min_ns);
+			sum.alloc_max_ns = max(sum.alloc_max_ns, os->alloc_max_ns);
+			if (os->first_fail_iter >= 0 && (sum.first_fail_iter < 0 ||
+			    os->first_fail_iter < sum.first_fail_iter))
+				sum.first_fail_iter = os->first_fail_iter;
+			for (b = 0; b < NR_LAT_BUCKETS; b++)
+				sum.lat_hist[b] += os->lat_hist[b];
+			/* the threads run concurrently: their rates add up */
+			if (os->wall_ns)
+				allocs_per_sec += div64_u64(os->allocs * NSEC_PER_SEC, os->wall_ns);
+		}
+		if (!sum.allocs)
+			sum.alloc_min_ns = 0;
+
+		seq_printf(seq, "%d,%lu,%d,%llu,%llu,%lld,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+			   order, (PAGE_SIZE << order) >> 10, nr_thrds, sum.allocs, sum.fails,
+			   sum.first_fail_iter, allocs_per_sec,
+			   sum.allocs ? div64_u64(sum.alloc_ns, sum.allocs) : 0,
+			   sum.alloc_min_ns, sum.alloc_max_ns,
+			   hist_pctile(sum.lat_hist, sum.allocs, 50),
+			   hist_pctile(sum.lat_hist, sum.allocs, 99),
+			   sum.frees ? div64_u64(sum.free_ns, sum.frees) : 0);
+	}
+	mutex_unlock(&run_mtx);
+	return 0;
+}
+
+static int latency_show(struct seq_file *seq, void *v)
+{
+	int order, t, b;
+	u64 cnt;
+
+	mutex_lock(&run_mtx);
+	seq_puts(seq, "order,lat_ns_lo,lat_ns_hi,count\n");
+	for (order = 0; order <= run_max_order && nr_thrds; order++) {
+		for (b = 0; b < NR_LAT_BUCKETS; b++) {
+			cnt = 0;
+			for (t = 0; t < nr_thrds; t++)
+				cnt += thrds[t].os[order].lat_hist[b];
+			if (cnt)
+				seq_printf(seq, "%d,%llu,%llu,%llu\n", order,
+					   b ? 1ULL << b : 0, 1ULL << (b + 1), cnt);
+		}
+	}
+	mutex_unlock(&run_mtx);
+	return 0;
+}
+
+static int results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, results_show, NULL);
+}
+
+static int latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, latency_show, NULL);
+}
+
+static ssize_t run_write(struct file *filp, const char __user *ubuf,
+			 size_t count, loff_t *off)
+{
+	int ret;
+
+	mutex_lock(&run_mtx);
+	if (atomic_read(&nr_done) < nr_thrds) {
+		mutex_unlock(&run_mtx);
+		return -EBUSY;	/* a run's still in progress */
+	}
+	ret = start_run();
+	mutex_unlock(&run_mtx);
+	return ret < 0 ? ret : count;
+}
+
+static const struct file_operations results_fops = {
+	.owner = THIS_MODULE,
+	.open = results_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct file_operations latency_fops = {
+	.owner = THIS_MODULE,
+	.open = latency_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct file_operations run_fops = {
+	.owner = THIS_MODULE,
+	.write = run_write,
+};
+
+static int __init lowlevel_mem_bench_init(void)
+{
+	int ret = -ENOMEM;
+
+	frag_before = kzalloc(sizeof(*frag_before), GFP_KERNEL);
+	frag_after = kzalloc(sizeof(*frag_after), GFP_KERNEL);
+	if (!frag_before || !frag_after)
+		goto out_free;
+
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent)) {
+		pr_warn("debugfs_create_dir failed (is debugfs enabled/mounted?)\n");
+		ret = -ENODEV;
+		goto out_free;
+	}
+	debugfs_create_file("results.csv", 0444, gparent, NULL, &results_fops);
+	debugfs_create_file("latency.csv", 0444, gparent, NULL, &latency_fops);
+	debugfs_create_file("run", 0200, gparent, NULL, &run_fops);
+
+	if (frag_period_ms)
+		llkd_frag_timer_start(frag_period_ms);
+
+	mutex_lock(&run_mtx);
+	ret = start_run();
+	mutex_unlock(&run_mtx);
+	if (ret == 0)
+		return 0;
+
+	llkd_frag_timer_stop();
+	debugfs_remove_recursive(gparent);
+ out_free:
+	kfree(frag_after);
+	kfree(frag_before);
+	return ret;
+}
+
+static void __exit lowlevel_mem_bench_exit(void)
+{
+	debugfs_remove_recursive(gparent);
+	mutex_lock(&run_mtx);
+	stop_run();
+	mutex_unlock(&run_mtx);
+	llkd_frag_timer_stop();
+	kfree(frag_after);
+	kfree(frag_before);
+	pr_info("removed\n");
+}
+
+module_init(lowlevel_mem_bench_init);
+module_exit(lowlevel_mem_bench_exit);
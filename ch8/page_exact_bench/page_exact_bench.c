@@ -0,0 +1,404 @@
+/*
+ * ch8/page_exact_bench/page_exact_bench.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 8: Kernel Memory Allocation for Module Authors, Part 1
+ ****************************************************************
+ * Brief Description:
+ * Our ch8/page_exact_loop module shows off the alloc_pages_exact() API, but
+ * doesn't tell us what it buys us, nor what it costs. This module benchmarks
+ * it against the 'usual' power-of-2 page allocation, i.e.,
+ *  __get_free_pages(gfp, get_order(size))
+ * sweeping the request size from 4 KB to 4 MB ('steps' sizes per doubling,
+ * so we get the 'odd' sizes in between the powers of 2 as well). Per size
+ * and API, we record:
+ *  - the pages consumed and the bytes wasted (internal fragmentation),
+ *  - the alloc and free latency (avg ns),
+ *  - the failure rate.
+ * alloc_pages_exact() allocates the power-of-2 block and then gives the
+ * unused tail pages back to the BSA one page at a time; that's where it's
+ * extra cost comes from (and, on the free side, free_pages_exact() frees
+ * page by page too).
+ *
+ * To measure under memory pressure and fragmentation, set pressure_mb: we
+ * then grab that much memory in single pages and free every other one of
+ * them before the sweep (we show the BSA free lists, via our klib_llkd
+ * 'library' code, after doing so).
+ *
+ * The results are available as CSV via debugfs:
+ *  /sys/kernel/debug/page_exact_bench/results.csv
+ * and the 'crossover points' - the sizes at which the faster API changes,
+ * and at which the (space) savings of alloc_pages_exact() become zero - are
+ * shown in the kernel log. The sweep runs at module init; to rerun it,
+ * write anything into /sys/kernel/debug/page_exact_bench/run
+ *
+ * For details, please refer the book, Ch 8.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include "../../klib_llkd.h"
+
+#define OURMODNAME    "page_exact_bench"
+
+MODULE_DESCRIPTION("ch8: alloc_pages_exact() vs power-of-2 page allocation benchmark");
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static int steps = 4;
+module_param(steps, int, 0644);
+MODULE_PARM_DESC(steps, "# of request sizes per doubling of size, 1-16 (default 4)");
+
+static int iters = 64;
+module_param(iters, int, 0644);
+MODULE_PARM_DESC(iters, "# of rounds per size and API (default 64)");
+
+static int batch = 8;
+module_param(batch, int, 0644);
+MODULE_PARM_DESC(batch, "# of buffers allocated per round before they're freed (default 8)");
+
+static int pressure_mb;
+module_param(pressure_mb, int, 0644);
+MODULE_PARM_DESC(pressure_mb,
+"Memory pressure: grab this many MB in single pages, then free every other one (default 0)");
+
+#define MIN_SIZE	(4 * 1024UL)
+#define MAX_SIZE	(4 * 1024 * 1024UL)
+#define MAX_STEPS	16
+#define MAX_SIZES	(11 * MAX_STEPS + 1)	/* 4K to 4M is 10 doublings */
+#define BENCH_GFP	(GFP_KERNEL | __GFP_NORETRY | __GFP_NOWARN)
+
+enum { API_EXACT, API_POW2, NR_APIS };
+static const char * const api_name[NR_APIS] = { "alloc_pages_exact", "__get_free_pages" };
+
+struct api_stats {
+	u64 alloc_ns, free_ns;	/* summed over the successful allocations */
+	u32 allocs, fails;
+};
+
+struct size_result {
+	size_t size;
+	unsigned int order;
+	struct api_stats st[NR_APIS];
+};
+
+static DEFINE_MUTEX(run_mtx);	/* protects all of the below */
+static struct size_result *results;
+static int nr_results, run_iters, run_batch, run_pressure_mb;
+static struct llkd_frag_snap *frag;
+static struct dentry *gparent;
+
+static void *api_alloc(int api, size_t sz)
+{
+	if (api == API_EXACT)
+		return alloc_pages_exact(sz, BENCH_GFP);
+	return (void *)__get_free_pages(BENCH_GFP, get_order(sz));
+}
+
+static void api_free(int api, void *p, size_t sz)
+{
+	if (api == API_EXACT)
+		free_pages_exact(p, sz);
+	else
+		free_pages((unsigned long)p, get_order(sz));
+}
+
+/* One round: allocate (up to) run_batch buffers of @sz bytes, then free them */
+static void bench_round(int api, size_t sz, void **bufs, struct api_stats *st)
+{
+	u64 t0;
+	int i, n = 0;
+
+	for (i = 0; i < run_batch; i++) {
+		t0 = ktime_get_ns();
+		bufs[n] = api_alloc(api, sz);
+		if (!bufs[n]) {
+			st->fails++;
+			continue;
+		}
+		st->alloc_ns += ktime_get_ns() - t0;
+		st->allocs++;
+		n++;
+	}
+	for (i = 0; i < n; i++) {
+		t0 = ktime_get_ns();
+		api_free(api, bufs[i], sz);
+		st->free_ns += ktime_get_ns() - t0;
+	}
+}
+
+/*
+ * Pressure: grab @mb MB in single pages and free every other one, leaving
+ * the rest fragmented. Returns the array of pages held (free with
+ * release_pressure()), NULL if there's nothing held.
+ */
+static struct page **apply_pressure(int mb, unsigned long *nr)
+{
+	unsigned long i, n = ((unsigned long)mb << 20) >> PAGE_SHIFT;
+	struct page **pages;
+
+	*nr = 0;
+	if (!n)
+		return NULL;
+	pages = vzalloc(array_size(n, sizeof(*pages)));
+	if (!pages)
+		return NULL;
+	for (i = 0; i < n; i++) {
+		pages[i] = alloc_page(BENCH_GFP);
+		if (!pages[i])
+			break;
+	}
+	*nr = i;
+	for (i = 0; i < *nr; i += 2) {
+		__free_page(pages[i]);
+		pages[i] = NULL;
+	}
+	pr_info("pressure: holding %lu of %lu pages (every other one of those allocated)\n",
+		*nr / 2, n);
+	return pages;
+}
+
+static void release_pressure(struct page **pages, unsigned long nr)
+{
+	unsigned long i;
+
+	if (!pages)
+		return;
+	for (i = 0; i < nr; i++)
+		if (pages[i])
+			__free_page(pages[i]);
+	vfree(pages);
+}
+
+static u64 avg_ns(u64 sum, u32 n)
+{
+	return n ? div_u64(sum, n) : 0;
+}
+
+/* alloc + free latency of @api for result @r; U64_MAX if it never succeeded */
+static u64 pair_ns(const struct size_result *r, int api)
+{
+	const struct api_stats *st = &r->st[api];
+
+	if (!st->allocs)
+		return U64_MAX;
+	return avg_ns(st->alloc_ns, st->allocs) + avg_ns(st->free_ns, st->allocs);
+}
+
+static size_t pow2_bytes(const struct size_result *r)
+{
+	return PAGE_SIZE << r->order;
+}
+
+/* Show the crossover points in the kernel log; the caller holds run_mtx */
+static void show_crossovers(void)
+{
+	int i, faster, prev_faster = -1, saves, prev_saves = -1;
+
+	pr_info("crossover points (alloc+free latency; space savings of alloc_pages_exact()):\n");
+	for (i = 0; i < nr_results; i++) {
+		struct size_result *r = &results[i];
+
+		faster = pair_ns(r, API_EXACT) <= pair_ns(r, API_POW2) ? API_EXACT : API_POW2;
+		if (prev_faster >= 0 && faster != prev_faster)
+			pr_info(" %7zu KB: %s becomes the faster one (%llu vs %llu ns)\n",
+				r->size >> 10, api_name[faster], pair_ns(r, faster),
+				pair_ns(r, !faster));
+		prev_faster = faster;
+
+		saves = PAGE_ALIGN(r->size) < pow2_bytes(r);
+		if (prev_saves >= 0 && saves != prev_saves)
+			pr_info(" %7zu KB: alloc_pages_exact() %s\n", r->size >> 10,
+				saves ? "saves memory again" : "saves nothing (a power of 2)");
+		prev_saves = saves;
+
+		if (r->st[API_EXACT].fails != r->st[API_POW2].fails)
+			pr_info(" %7zu KB: failures: exact %u, pow2 %u (of %u)\n", r->size >> 10,
+				r->st[API_EXACT].fails, r->st[API_POW2].fails,
+				run_iters * run_batch);
+	}
+}
+
+/* Run the sweep; the caller holds run_mtx */
+static int run_bench(void)
+{
+	struct page **held;
+	unsigned long nr_held;
+	void **bufs;
+	size_t base, sz;
+	int i, j, api, n = 0;
+
+	if (steps < 1 || steps > MAX_STEPS || iters <= 0 || batch <= 0 || pressure_mb < 0) {
+		pr_warn("invalid parameter(s): steps=%d (1-%d), iters=%d, batch=%d, pressure_mb=%d\n",
+			steps, MAX_STEPS, iters, batch, pressure_mb);
+		return -EINVAL;
+	}
+	run_iters = iters;
+	run_batch = batch;
+	run_pressure_mb = pressure_mb;
+
+	bufs = kcalloc(run_batch, sizeof(void *), GFP_KERNEL);
+	if (!bufs)
+		return -ENOMEM;
+	memset(results, 0, MAX_SIZES * sizeof(*results));
+
+	held = apply_pressure(run_pressure_mb, &nr_held);
+	if (held) {
+		llkd_frag_snapshot(frag);
+		llkd_frag_show(frag);
+	}
+
+	/* sizes: 'steps' sizes per doubling, from MIN to MAX_SIZE */
+	for (base = MIN_SIZE; base <= MAX_SIZE; base <<= 1) {
+		for (j = 0; j < steps && n < MAX_SIZES; j++) {
+			sz = base + base * j / steps;
+			if (sz > MAX_SIZE || (n && sz <= results[n - 1].size))
+				continue;
+			if (get_order(sz) >= LLKD_NR_ORDERS)
+				continue;	/* beyond the BSA's max order */
+			results[n].size = sz;
+			results[n].order = get_order(sz);
+			/* interleave the APIs, so that neither gets a 'warmer' BSA */
+			for (i = 0; i < run_iters; i++) {
+				for (api = 0; api < NR_APIS; api++)
+					bench_round((api + i) % NR_APIS, sz, bufs,
+						    &results[n].st[(api + i) % NR_APIS]);
+				cond_resched();
+			}
+			n++;
+		}
+	}
+	nr_results = n;
+
+	release_pressure(held, nr_held);
+	kfree(bufs);
+	pr_info("done: %d sizes, %d rounds x %d buffers per size and API, pressure %d MB;"
+		" see the results.csv file\n", nr_results, run_iters, run_batch, run_pressure_mb);
+	show_crossovers();
+	return 0;
+}
+
+static int results_show(struct seq_file *seq, void *v)
+{
+	int i, api;
+
+	mutex_lock(&run_mtx);
+	seq_printf(seq, "# iters=%d batch=%d pressure_mb=%d page_size=%lu\n",
+		   run_iters, run_batch, run_pressure_mb, PAGE_SIZE);
+	seq_puts(seq, "size,pages_exact,pages_pow2,waste_exact,waste_pow2,saved_bytes");
+	for (api = 0; api < NR_APIS; api++)
+		seq_printf(seq, ",%s_alloc_ns,%s_free_ns,%s_fail_pct",
+			   api == API_EXACT ? "exact" : "pow2",
+			   api == API_EXACT ? "exact" : "pow2",
+			   api == API_EXACT ? "exact" : "pow2");
+	seq_putc(seq, '\n');
+
+	for (i = 0; i < nr_results; i++) {
+		struct size_result *r = &results[i];
+		size_t exact = PAGE_ALIGN(r->size);
+
+		seq_printf(seq, "%zu,%lu,%lu,%zu,%zu,%zu", r->size,
+			   exact >> PAGE_SHIFT, 1UL << r->order, exact - r->size,
+			   pow2_bytes(r) - r->size, pow2_bytes(r) - exact);
+		for (api = 0; api < NR_APIS; api++) {
+			struct api_stats *st = &r->st[api];
+			u32 tries = st->allocs + st->fails;
+
+			seq_printf(seq, ",%llu,%llu,%u", avg_ns(st->alloc_ns, st->allocs),
+				   avg_ns(st->free_ns, st->allocs),
+				   tries ? st->fails * 100 / tries : 0);
+		}
+		seq_putc(seq, '\n');
+	}
+	mutex_unlock(&run_mtx);
+	return 0;
+}
+
+static int results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, results_show, NULL);
+}
+
+static ssize_t run_write(struct file *filp, const char __user *ubuf,
+			 size_t count, loff_t *off)
+{
+	int ret;
+
+	if (!mutex_trylock(&run_mtx))
+		return -EBUSY;	/* a run's still in progress */
+	ret = run_bench();
+	mutex_unlock(&run_mtx);
+	return ret < 0 ? ret : count;
+}
+
+static const struct file_operations results_fops = {
+	.owner = THIS_MODULE,
+	.open = results_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct file_operations run_fops = {
+	.owner = THIS_MODULE,
+	.write = run_write,
+};
+
+static int __init page_exact_bench_init(void)
+{
+	int ret = -ENOMEM;
+
+	results = kcalloc(MAX_SIZES, sizeof(*results), GFP_KERNEL);
+	frag = kzalloc(sizeof(*frag), GFP_KERNEL);
+	if (!results || !frag)
+		goto out_free;
+
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent)) {
+		pr_warn("debugfs_create_dir failed (is debugfs enabled/mounted?)\n");
+		ret = -ENODEV;
+		goto out_free;
+	}
+	debugfs_create_file("results.csv", 0444, gparent, NULL, &results_fops);
+	debugfs_create_file("run", 0200, gparent, NULL, &run_fops);
+
+	mutex_lock(&run_mtx);
+	ret = run_bench();
+	mutex_unlock(&run_mtx);
+	if (ret == 0)
+		return 0;
+
+	debugfs_remove_recursive(gparent);
+ out_free:
+	kfree(frag);
+	kfree(results);
+	return ret;
+}
+
+static void __exit page_exact_bench_exit(void)
+{
+	debugfs_remove_recursive(gparent);
+	kfree(frag);
+	kfree(results);
+	pr_info("removed\n");
+}
+
+module_init(page_exact_bench_init);
+module_exit(page_exact_bench_exit);
@@ -35,6 +35,14 @@ MODULE_VERSION("0.1");
 			 * alloc failing, as we only free in the cleanup code path...
 			 */
 void show_phy_pages(const void *kaddr, size_t len, bool contiguity_check);
+struct seq_file;
+int show_phy_pages_compact(const void *kaddr, size_t len, struct seq_file *seq,
+			   char *buf, size_t bufsz);
+
+static bool compact;
+module_param(compact, bool, 0644);
+MODULE_PARM_DESC(compact,
+"show the physical pages as coalesced extents (one line per physically contiguous run), not page by page (default 0)");
 
 static void *gptr[MAXTIMES];
 /* Lets ask for 33 KB; the 'regular' PA/BSA APIs will end up giving
@@ -64,7 +72,10 @@ static int __init page_exact_loop_init(void)
 		// lets 'poison' it..
 		memset(gptr[i], 'x', gsz);
 
-		show_phy_pages(gptr[i], gsz, 1);
+		if (compact)
+			show_phy_pages_compact(gptr[i], gsz, NULL, NULL, 0);
+		else
+			show_phy_pages(gptr[i], gsz, 1);
 		msleep(100);
 	}
 
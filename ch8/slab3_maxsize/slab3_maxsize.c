@@ -11,12 +11,35 @@
  * From: Ch 8 : Linux Kernel Memory Allocation for Module Authors, Part 1
  ****************************************************************
  * Brief Description:
+ * Find the largest piece of memory kmalloc() can allocate. By default, we
+ * (slowly!) loop, incrementing the size by 'stepsz' bytes until it fails.
+ *
+ * With bsearch=1, we instead *binary search* for the largest allocation that
+ * succeeds - in O(log n) steps, down to a granularity of 'gran' bytes and
+ * with an upper bound of 'max_mb' MB - for each of these allocators:
+ *  kmalloc(), kvmalloc(), vmalloc(), alloc_pages_exact() and
+ *  dma_alloc_coherent() (the latter on a dummy platform device; it uses CMA
+ *  when the kernel has it configured, else the page allocator).
+ * The probes run concurrently, one kthread per allocator; as they compete
+ * for the same free memory, the results of the 'large' allocators (vmalloc,
+ * kvmalloc) are best read as 'what was possible under this load'. All
+ * allocations use __GFP_NORETRY | __GFP_NOWARN so that a failed probe
+ * neither invokes the OOM killer nor spams the kernel log; just a compact
+ * summary table is printed at the end.
  *
  * For details, please refer the book, Ch 8.
  */
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/platform_device.h>
+#include <linux/dma-mapping.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
 
 #define OURMODNAME   "slab3_maxsize"
 
@@ -30,6 +53,18 @@ module_param(stepsz, int, 0644);
 MODULE_PARM_DESC(stepsz,
 "Amount to increase allocation by on each loop iteration (default=200000");
 
+static bool bsearch;
+module_param(bsearch, bool, 0444);
+MODULE_PARM_DESC(bsearch,
+"Binary search for the max allocation of several allocators concurrently (default=0)");
+static uint max_mb;
+module_param(max_mb, uint, 0444);
+MODULE_PARM_DESC(max_mb,
+"[bsearch] upper bound of the search in MB (default=0: half the RAM)");
+static uint gran;
+module_param(gran, uint, 0444);
+MODULE_PARM_DESC(gran, "[bsearch] granularity of the search in bytes (default=0: PAGE_SIZE)");
+
 static int test_maxallocsz(void)
 {
 	size_t size2alloc = 0;
@@ -48,9 +83,220 @@ static int test_maxallocsz(void)
 	return 0;
 }
 
+/*------------------------ The binary search mode --------------------------*/
+#define PROBE_GFP	(GFP_KERNEL | __GFP_NORETRY | __GFP_NOWARN)
+
+struct prober;
+struct probe_ops {
+	const char *name;
+	void *(*alloc)(struct prober *p, size_t sz);
+	void (*free)(struct prober *p, void *ptr, size_t sz);
+};
+
+struct prober {
+	const struct probe_ops *ops;
+	struct task_struct *task;
+	struct completion done;
+	dma_addr_t dma_handle;
+	size_t maxsz;		/* the result */
+	bool at_limit;		/* the upper bound itself succeeded */
+	int steps;
+	u64 ns;
+};
+
+static struct platform_device *dma_pdev;
+
+static void *kmalloc_alloc(struct prober *p, size_t sz)
+{
+	return kmalloc(sz, PROBE_GFP);
+}
+static void kmalloc_free(struct prober *p, void *ptr, size_t sz)
+{
+	kfree(ptr);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 12, 0)
+static void *kvmalloc_alloc(struct prober *p, size_t sz)
+{
+	return kvmalloc(sz, PROBE_GFP);
+}
+static void kvmalloc_free(struct prober *p, void *ptr, size_t sz)
+{
+	kvfree(ptr);
+}
+#endif
+
+static void *vmalloc_alloc(struct prober *p, size_t sz)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	return __vmalloc(sz, PROBE_GFP);
+#else
+	return __vmalloc(sz, PROBE_GFP, PAGE_KERNEL);
+#endif
+}
+static void vmalloc_free(struct prober *p, void *ptr, size_t sz)
+{
+	vfree(ptr);
+}
+
+static void *pages_exact_alloc(struct prober *p, size_t sz)
+{
+	return alloc_pages_exact(sz, PROBE_GFP);
+}
+static void pages_exact_free(struct prober *p, void *ptr, size_t sz)
+{
+	free_pages_exact(ptr, sz);
+}
+
+static void *dma_coherent_alloc(struct prober *p, size_t sz)
+{
+	return dma_alloc_coherent(&dma_pdev->dev, sz, &p->dma_handle, PROBE_GFP);
+}
+static void dma_coherent_free(struct prober *p, void *ptr, size_t sz)
+{
+	dma_free_coherent(&dma_pdev->dev, sz, ptr, p->dma_handle);
+}
+
+static const struct probe_ops probes[] = {
+	{ "kmalloc", kmalloc_alloc, kmalloc_free },
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 12, 0)
+	{ "kvmalloc", kvmalloc_alloc, kvmalloc_free },
+#endif
+	{ "vmalloc", vmalloc_alloc, vmalloc_free },
+	{ "alloc_pages_exact", pages_exact_alloc, pages_exact_free },
+	{ "dma_alloc_coherent", dma_coherent_alloc, dma_coherent_free },
+};
+#define NR_PROBES	ARRAY_SIZE(probes)
+
+static size_t probe_gran, probe_limit;
+
+/* Does an allocation of @sz bytes succeed? (it's immediately freed) */
+static bool try_alloc(struct prober *p, size_t sz)
+{
+	void *ptr = p->ops->alloc(p, sz);
+
+	p->steps++;
+	pr_debug("%s(%zu) = %px\n", p->ops->name, sz, ptr);
+	if (!ptr)
+		return false;
+	p->ops->free(p, ptr, sz);
+	return true;
+}
+
+/*
+ * The prober kthread: binary search, in units of probe_gran bytes, for the
+ * largest allocation that succeeds; the invariant being that 'lo' units
+ * succeed (or lo is 0) and 'hi' units fail.
+ */
+static int prober_thread(void *arg)
+{
+	struct prober *p = arg;
+	size_t lo = 0, hi = probe_limit / probe_gran, mid;
+	u64 t0 = ktime_get_ns();
+
+	if (try_alloc(p, hi * probe_gran)) {
+		lo = hi;
+		p->at_limit = true;
+	}
+	while (hi - lo > 1 && !kthread_should_stop()) {
+		mid = lo + (hi - lo) / 2;
+		if (try_alloc(p, mid * probe_gran))
+			lo = mid;
+		else
+			hi = mid;
+		cond_resched();
+	}
+	p->maxsz = lo * probe_gran;
+	p->ns = ktime_get_ns() - t0;
+	complete(&p->done);
+
+	/* We must not exit until we're kthread_stop()-ed */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+	return 0;
+}
+
+static int test_maxallocsz_bsearch(void)
+{
+	struct prober *pr;
+	unsigned long totalram;
+	u64 t0;
+	int i, n = 0;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+	totalram = totalram_pages();
+#else
+	totalram = totalram_pages;
+#endif
+	probe_gran = gran ? gran : PAGE_SIZE;
+	probe_limit = max_mb ? (size_t)max_mb << 20 : (totalram / 2) << PAGE_SHIFT;
+	if (probe_limit < probe_gran) {
+		pr_warn("invalid params: max_mb=%u, gran=%u\n", max_mb, gran);
+		return -EINVAL;
+	}
+
+	pr = kcalloc(NR_PROBES, sizeof(*pr), GFP_KERNEL);
+	if (!pr)
+		return -ENOMEM;
+
+	/* dma_alloc_coherent() needs a device; a dummy platform device will do */
+	dma_pdev = platform_device_register_simple(OURMODNAME, -1, NULL, 0);
+	if (IS_ERR(dma_pdev) || dma_coerce_mask_and_coherent(&dma_pdev->dev, DMA_BIT_MASK(64))) {
+		pr_warn("couldn't set up a DMA-capable platform device; skipping dma_alloc_coherent\n");
+		if (!IS_ERR(dma_pdev))
+			platform_device_unregister(dma_pdev);
+		dma_pdev = NULL;
+	}
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < NR_PROBES; i++) {
+		if (probes[i].alloc == dma_coherent_alloc && !dma_pdev)
+			continue;
+		pr[i].ops = &probes[i];
+		init_completion(&pr[i].done);
+		pr[i].task = kthread_create(prober_thread, &pr[i], "%s/%d", OURMODNAME, i);
+		if (IS_ERR(pr[i].task)) {
+			pr[i].task = NULL;
+			continue;
+		}
+		wake_up_process(pr[i].task);
+		n++;
+	}
+	for (i = 0; i < NR_PROBES; i++) {
+		if (!pr[i].task)
+			continue;
+		wait_for_completion(&pr[i].done);
+		kthread_stop(pr[i].task);
+	}
+
+	pr_info("binary search: %d allocators in parallel, granularity %zu bytes, limit %zu MB;"
+		" total time %llu ms\n", n, probe_gran, probe_limit >> 20,
+		div_u64(ktime_get_ns() - t0, NSEC_PER_MSEC));
+	pr_info("%20s  %16s  %10s  %6s  %10s\n", "allocator", "max size (bytes)", "(KB)",
+		"steps", "time (us)");
+	for (i = 0; i < NR_PROBES; i++) {
+		if (!pr[i].task)
+			continue;
+		pr_info("%20s %c%16zu  %10zu  %6d  %10llu\n", pr[i].ops->name,
+			pr[i].at_limit ? '>' : ' ', pr[i].maxsz, pr[i].maxsz >> 10,
+			pr[i].steps, div_u64(pr[i].ns, NSEC_PER_USEC));
+	}
+
+	if (dma_pdev)
+		platform_device_unregister(dma_pdev);
+	kfree(pr);
+	return 0;
+}
+
 static int __init slab3_maxsize_init(void)
 {
 	pr_info("%s: inserted\n", OURMODNAME);
+	if (bsearch)
+		return test_maxallocsz_bsearch();
 	return test_maxallocsz();
 }
 
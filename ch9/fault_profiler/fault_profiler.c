@@ -0,0 +1,313 @@
+/*
+ * ch9/fault_profiler/fault_profiler.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 9: Kernel Memory Allocation for Module Authors Part 2
+ ****************************************************************
+ * Brief Description:
+ *
+ * Our ch9/oom_killer_try app shows demand paging at work: nothing's
+ * physically allocated until a page is first touched. But what does that
+ * cost? This user mode app profiles it: for each of these strategies, it
+ * sets up a buffer of the given size and then touches every page of it
+ * (the 'access' phase, i.e., what your latency-sensitive code would see):
+ *  malloc   : plain malloc(); all faults are taken at access time
+ *  mmap     : an anonymous private mmap(); same, minus the allocator
+ *  populate : mmap(MAP_POPULATE); the kernel prefaults it at mmap() time
+ *  thp      : a 2 MB aligned mmap() + madvise(MADV_HUGEPAGE); a fault can
+ *             now map a whole 2 MB (transparent) huge page
+ *  memset   : malloc() + a memset() 'prefault' pass before access
+ * For every phase (alloc / prefault / access) we report the time, the minor
+ * and major faults (via perf software counters when available, else via
+ * getrusage(2)), the faults per page and the time per fault and per page.
+ *
+ * The prefault and access phases are run in chunks; after each chunk we
+ * sample the elapsed time, the faults, the fault rate and the RSS, giving a
+ * time series (written as CSV with -o) of the RSS growth over time.
+ *
+ * Note: the perf counters only count faults raised by user mode accesses;
+ * the ones the kernel takes on our behalf (MAP_POPULATE) show up only via
+ * getrusage(2); use -g to see them.
+ * Major faults need I/O: you'll only see them for anonymous memory when it's
+ * been swapped out (try a size close to your free RAM).
+ *
+ * For details, please refer the book, Ch 9.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define MB		(1024UL * 1024)
+#define HPAGE_SIZE	(2 * MB)
+
+enum { STRAT_MALLOC, STRAT_MMAP, STRAT_POPULATE, STRAT_THP, STRAT_MEMSET, NR_STRAT };
+static const char *strat_name[NR_STRAT] = { "malloc", "mmap", "populate", "thp", "memset" };
+
+struct counts {
+	uint64_t ns, minflt, majflt;
+};
+
+static size_t pgsz;
+static int nsamples = 20;
+static FILE *csv;
+static int fd_min = -1, fd_maj = -1;	/* perf software counters */
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int perf_open(uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	attr.exclude_kernel = 1;	/* works with perf_event_paranoid = 2 too */
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Snapshot the time and the fault counts */
+static void snap(struct counts *c)
+{
+	struct rusage ru;
+	uint64_t vmin, vmaj;
+
+	/* both from the perf counters, or (if either read fails) both from rusage */
+	if (fd_min >= 0 && fd_maj >= 0 &&
+	    read(fd_min, &vmin, sizeof(vmin)) == sizeof(vmin) &&
+	    read(fd_maj, &vmaj, sizeof(vmaj)) == sizeof(vmaj)) {
+		c->minflt = vmin;
+		c->majflt = vmaj;
+	} else {
+		getrusage(RUSAGE_SELF, &ru);
+		c->minflt = ru.ru_minflt;
+		c->majflt = ru.ru_majflt;
+	}
+	c->ns = now_ns();
+}
+
+static void delta(struct counts *d, const struct counts *a, const struct counts *b)
+{
+	d->ns = b->ns - a->ns;
+	d->minflt = b->minflt - a->minflt;
+	d->majflt = b->majflt - a->majflt;
+}
+
+static long rss_kb(void)
+{
+	long size, rss = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+
+	if (!fp)
+		return -1;
+	if (fscanf(fp, "%ld %ld", &size, &rss) != 2)
+		rss = -1;
+	fclose(fp);
+	return rss < 0 ? rss : rss * (long)(pgsz / 1024);
+}
+
+/*
+ * Write to every page of @buf (or memset() it all, if @do_memset), in
+ * 'nsamples' chunks, sampling after each one. The totals (excluding the time
+ * and faults taken by the sampling itself) are returned in @tot.
+ */
+static void run_phase(int s, const char *phase, char *buf, size_t len,
+		      int do_memset, uint64_t t_start, struct counts *tot)
+{
+	size_t chunk = (len / nsamples + pgsz - 1) & ~(pgsz - 1), off, end, i;
+	struct counts prev, cur, d;
+
+	memset(tot, 0, sizeof(*tot));
+	snap(&prev);
+	for (off = 0; off < len; off = end) {
+		end = off + chunk < len ? off + chunk : len;
+		if (do_memset)
+			memset(buf + off, 0xa5, end - off);
+		else
+			for (i = off; i < end; i += pgsz)
+				buf[i] = (char)i;
+		snap(&cur);
+		delta(&d, &prev, &cur);
+		tot->ns += d.ns;
+		tot->minflt += d.minflt;
+		tot->majflt += d.majflt;
+		if (csv) {
+			fprintf(csv, "%s,%s,%.1f,%zu,%lu,%lu,%ld,%.0f\n", strat_name[s], phase,
+				(cur.ns - t_start) / 1e3, end, (unsigned long)tot->minflt,
+				(unsigned long)tot->majflt, rss_kb(),
+				d.ns ? (d.minflt + d.majflt) * 1e9 / d.ns : 0.0);
+			snap(&cur);
+		}
+		prev = cur;
+	}
+}
+
+static void report(const char *phase, const struct counts *c, size_t npages)
+{
+	uint64_t nflt = c->minflt + c->majflt;
+
+	printf("  %-9s %10.3f ms  minflt %8lu  majflt %6lu  flt/page %6.3f  ns/fault %8.0f  ns/page %8.1f\n",
+	       phase, c->ns / 1e6, (unsigned long)c->minflt, (unsigned long)c->majflt,
+	       (double)nflt / npages, nflt ? (double)c->ns / nflt : 0.0,
+	       (double)c->ns / npages);
+}
+
+static int run_strategy(int s, size_t len)
+{
+	struct counts a0, a1, alloc, pre = { 0 }, acc;
+	size_t npages = len / pgsz;
+	char *buf, *map = NULL;
+	size_t maplen = 0;
+	long rss0 = rss_kb();
+	uint64_t t_start;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+	snap(&a0);
+	t_start = a0.ns;
+	switch (s) {
+	case STRAT_MALLOC:
+	case STRAT_MEMSET:
+		buf = malloc(len);
+		if (!buf) {
+			perror("malloc");
+			return -1;
+		}
+		break;
+	case STRAT_POPULATE:
+		flags |= MAP_POPULATE;
+		/* fallthrough */
+	case STRAT_MMAP:
+		maplen = len;
+		map = buf = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (buf == MAP_FAILED) {
+			perror("mmap");
+			return -1;
+		}
+		break;
+	case STRAT_THP:
+		/* over-allocate so that we can align the start to a huge page */
+		maplen = len + HPAGE_SIZE;
+		map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (map == MAP_FAILED) {
+			perror("mmap");
+			return -1;
+		}
+		buf = (char *)(((uintptr_t)map + HPAGE_SIZE - 1) & ~(HPAGE_SIZE - 1));
+		if (madvise(buf, len, MADV_HUGEPAGE) < 0)
+			perror("madvise(MADV_HUGEPAGE) (THP disabled?)");
+		break;
+	default:
+		return -1;
+	}
+	snap(&a1);
+	delta(&alloc, &a0, &a1);
+
+	if (s == STRAT_MEMSET)
+		run_phase(s, "prefault", buf, len, 1, t_start, &pre);
+	run_phase(s, "access", buf, len, 0, t_start, &acc);
+
+	printf("%s: %zu pages; RSS grew by %ld kB\n", strat_name[s], npages, rss_kb() - rss0);
+	report("alloc", &alloc, npages);
+	if (s == STRAT_MEMSET)
+		report("prefault", &pre, npages);
+	report("access", &acc, npages);
+	printf("  %-9s %10.3f ms\n", "total", (alloc.ns + pre.ns + acc.ns) / 1e6);
+
+	if (map)
+		munmap(map, maplen);
+	else
+		free(buf);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-s size-in-MB] [-S strategy] [-n samples] [-o file.csv] [-g]\n"
+		" -s : buffer size in MB (default 256)\n"
+		" -S : run just this strategy: malloc|mmap|populate|thp|memset (default: all)\n"
+		" -n : # of samples (chunks) per phase for the time series (default 20)\n"
+		" -o : write the time series as CSV to this file\n"
+		" -g : use getrusage(2) even if the perf software counters are available\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	size_t len = 256 * MB;
+	int opt, s, only = -1, use_perf = 1;
+
+	while ((opt = getopt(argc, argv, "s:S:n:o:gh")) != -1) {
+		switch (opt) {
+		case 's':
+			len = strtoul(optarg, NULL, 0) * MB;
+			break;
+		case 'S':
+			for (s = 0; s < NR_STRAT; s++)
+				if (!strcmp(optarg, strat_name[s]))
+					only = s;
+			if (only < 0)
+				usage(argv[0]);
+			break;
+		case 'n':
+			nsamples = atoi(optarg);
+			break;
+		case 'o':
+			csv = fopen(optarg, "w");
+			if (!csv) {
+				perror("fopen");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'g':
+			use_perf = 0;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!len || nsamples < 1)
+		usage(argv[0]);
+
+	pgsz = getpagesize();
+	if (use_perf) {
+		fd_min = perf_open(PERF_COUNT_SW_PAGE_FAULTS_MIN);
+		fd_maj = perf_open(PERF_COUNT_SW_PAGE_FAULTS_MAJ);
+	}
+	printf("%s: PID %d; %zu MB buffer; faults counted via %s\n", argv[0], getpid(),
+	       len / MB, (fd_min >= 0 && fd_maj >= 0) ? "perf sw counters" : "getrusage()");
+	if (csv)
+		fprintf(csv, "strategy,phase,t_us,bytes,minflt,majflt,rss_kb,faults_per_sec\n");
+
+	for (s = 0; s < NR_STRAT; s++) {
+		if (only >= 0 && s != only)
+			continue;
+		if (run_strategy(s, len) < 0)
+			exit(EXIT_FAILURE);
+	}
+	if (csv)
+		fclose(csv);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,391 @@
+/*
+ * ch9/hugebuf/hugebuf.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 9 : Kernel Memory Allocation for Module Authors Part 2
+ ****************************************************************
+ * Brief Description:
+ * Our ch9/vmalloc_demo module's 5 MB kvmalloc() lands in the vmalloc region,
+ * mapped by 4K PTEs; for large, randomly accessed in-kernel tables, that
+ * means lots of TLB misses. Here, we show a 'large buffer' allocator that
+ * prefers memory mapped by large pages, falling back step by step:
+ *  1. compound pages: a single alloc_pages(__GFP_COMP) block (physically
+ *     contiguous and direct-mapped, thus mapped by large pages), if the size
+ *     fits within the max order;
+ *  2. dma_alloc_coherent() on a dummy platform device: for larger sizes,
+ *     it's served from the CMA area when there's one (CONFIG_DMA_CMA=y and
+ *     a CMA reservation), else from the page allocator; we check the
+ *     pageblock's migratetype to report which;
+ *  3. an array of 2 MB (PMD-sized) compound 'chunks': each one's
+ *     direct-mapped by a large page, but the buffer's not virtually
+ *     contiguous, so it must be accessed via hb_ptr() (allow_chunks=1);
+ *  4. vmalloc_huge() (5.18 on): vmalloc space, but mapped with huge
+ *     mappings where the arch supports it (HAVE_ARCH_HUGE_VMALLOC);
+ *  5. plain vmalloc().
+ * The backing actually used is reported. At init, we allocate a size_mb MB
+ * buffer this way (and keep it until unload).
+ *
+ * With bench=1, we force each backing in turn for a bench_mb MB buffer and
+ * run a random pointer-chasing walk over it, counting the dTLB read misses
+ * via a kernel perf event counter (perf_event_create_kernel_counter()); you
+ * should see far fewer of them for the large page backed buffers.
+ *
+ * For details, please refer the book, Ch 9.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/platform_device.h>
+#include <linux/dma-mapping.h>
+#include <linux/perf_event.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+#include <linux/sizes.h>
+#include <linux/version.h>
+#include "../../klib_llkd.h"	/* LLKD_NR_ORDERS */
+
+#define OURMODNAME   "hugebuf"
+
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_DESCRIPTION("LKP book:ch9/hugebuf: large-page backed large buffer allocator");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static int size_mb = 16;
+module_param(size_mb, int, 0644);
+MODULE_PARM_DESC(size_mb, "size of the buffer allocated at init, in MB (defaults to 16)");
+
+static bool allow_chunks = true;
+module_param(allow_chunks, bool, 0644);
+MODULE_PARM_DESC(allow_chunks, "allow a (virtually discontiguous) array of 2 MB chunks (defaults to 1)");
+
+static bool bench;
+module_param(bench, bool, 0644);
+MODULE_PARM_DESC(bench, "run the random access / dTLB miss benchmark for every backing (default 0)");
+
+static int bench_mb = 64;
+module_param(bench_mb, int, 0644);
+MODULE_PARM_DESC(bench_mb, "bench: buffer size in MB (defaults to 64)");
+
+enum hb_backing {
+	HB_COMPOUND, HB_DMA, HB_CHUNKS, HB_VMALLOC_HUGE, HB_VMALLOC, HB_NR, HB_NONE = HB_NR
+};
+static const char * const hb_name[HB_NR] = {
+	"compound pages", "dma_alloc_coherent", "2 MB compound chunks",
+	"vmalloc_huge", "vmalloc"
+};
+
+struct hugebuf {
+	enum hb_backing backing;
+	size_t size;
+	void *addr;		/* NULL for HB_CHUNKS */
+	struct page **chunks;	/* HB_CHUNKS: the compound pages */
+	int nr_chunks;
+	dma_addr_t dma_handle;	/* HB_DMA */
+	bool cma;		/* HB_DMA: served from the CMA area? */
+};
+
+#define HB_GFP		(GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY)
+#define CHUNK_SHIFT	21	/* 2 MB */
+#define CHUNK_ORDER	(CHUNK_SHIFT - PAGE_SHIFT)
+
+static struct platform_device *dma_pdev;
+static struct hugebuf gbuf;
+
+/* The address of byte @off of the buffer; works for all backings */
+static inline void *hb_ptr(const struct hugebuf *hb, size_t off)
+{
+	if (likely(hb->addr))
+		return hb->addr + off;
+	return page_address(hb->chunks[off >> CHUNK_SHIFT]) + (off & (SZ_2M - 1));
+}
+
+/*
+ * Was this DMA buffer actually carved out of the CMA area? dma_alloc_coherent()
+ * silently falls back to the page allocator when there's no (or not enough)
+ * CMA, so we look up the pageblock's migratetype. The buffer may have been
+ * remapped (non-coherent arches), so handle a vmalloc-space address too.
+ */
+static bool hb_is_cma(const void *addr)
+{
+	struct page *page = NULL;
+
+	if (virt_addr_valid(addr))
+		page = virt_to_page(addr);
+	else if (is_vmalloc_addr(addr))
+		page = vmalloc_to_page(addr);
+	return page && is_migrate_cma_page(page);
+}
+
+/* The backing's name, qualified by whether CMA was used for the DMA one */
+static const char *hb_label(const struct hugebuf *hb)
+{
+	if (hb->backing == HB_DMA)
+		return hb->cma ? "dma_alloc_coherent (CMA)" : "dma_alloc_coherent (no CMA)";
+	return hb_name[hb->backing];
+}
+
+static void hb_free(struct hugebuf *hb)
+{
+	int i;
+
+	switch (hb->backing) {
+	case HB_COMPOUND:
+		__free_pages(virt_to_page(hb->addr), get_order(hb->size));
+		break;
+	case HB_DMA:
+		dma_free_coherent(&dma_pdev->dev, hb->size, hb->addr, hb->dma_handle);
+		break;
+	case HB_CHUNKS:
+		for (i = 0; i < hb->nr_chunks; i++)
+			if (hb->chunks[i])
+				__free_pages(hb->chunks[i], CHUNK_ORDER);
+		kvfree(hb->chunks);
+		break;
+	case HB_VMALLOC_HUGE:
+	case HB_VMALLOC:
+		vfree(hb->addr);
+		break;
+	default:
+		break;
+	}
+	memset(hb, 0, sizeof(*hb));
+	hb->backing = HB_NONE;
+}
+
+/* Try to allocate @size bytes with backing @b; 0 on success */
+static int hb_try(struct hugebuf *hb, size_t size, enum hb_backing b)
+{
+	struct page *page;
+	int i;
+
+	memset(hb, 0, sizeof(*hb));
+	hb->size = size;
+	switch (b) {
+	case HB_COMPOUND:
+		if (get_order(size) >= LLKD_NR_ORDERS)
+			return -E2BIG;
+		page = alloc_pages(HB_GFP | __GFP_COMP, get_order(size));
+		if (!page)
+			return -ENOMEM;
+		hb->addr = page_address(page);
+		break;
+	case HB_DMA:
+		if (!dma_pdev)
+			return -ENODEV;
+		hb->addr = dma_alloc_coherent(&dma_pdev->dev, size, &hb->dma_handle, HB_GFP);
+		if (!hb->addr)
+			return -ENOMEM;
+		hb->cma = hb_is_cma(hb->addr);
+		break;
+	case HB_CHUNKS:
+		if (!allow_chunks || CHUNK_ORDER >= LLKD_NR_ORDERS)
+			return -EINVAL;
+		hb->nr_chunks = DIV_ROUND_UP(size, SZ_2M);
+		hb->chunks = kvcalloc(hb->nr_chunks, sizeof(struct page *), GFP_KERNEL);
+		if (!hb->chunks)
+			return -ENOMEM;
+		hb->backing = HB_CHUNKS;	/* so that hb_free() cleans up */
+		for (i = 0; i < hb->nr_chunks; i++) {
+			hb->chunks[i] = alloc_pages(HB_GFP | __GFP_COMP, CHUNK_ORDER);
+			if (!hb->chunks[i]) {
+				hb_free(hb);
+				return -ENOMEM;
+			}
+		}
+		break;
+	case HB_VMALLOC_HUGE:
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+		hb->addr = vmalloc_huge(size, GFP_KERNEL | __GFP_NOWARN);
+		if (!hb->addr)
+			return -ENOMEM;
+		break;
+#else
+		return -EOPNOTSUPP;
+#endif
+	case HB_VMALLOC:
+		hb->addr = vmalloc(size);
+		if (!hb->addr)
+			return -ENOMEM;
+		break;
+	default:
+		return -EINVAL;
+	}
+	hb->backing = b;
+	return 0;
+}
+
+/* Allocate @size bytes with the 'best' backing available; 0 on success */
+static int hb_alloc(struct hugebuf *hb, size_t size)
+{
+	enum hb_backing b;
+
+	for (b = 0; b < HB_NR; b++)
+		if (!hb_try(hb, size, b))
+			return 0;
+	hb->backing = HB_NONE;
+	return -ENOMEM;
+}
+
+/*------------------------------ The benchmark -----------------------------*/
+#ifdef CONFIG_PERF_EVENTS
+static struct perf_event *dtlb_counter_start(void)
+{
+	struct perf_event_attr attr = {
+		.type = PERF_TYPE_HW_CACHE,
+		.size = sizeof(struct perf_event_attr),
+		.config = PERF_COUNT_HW_CACHE_DTLB |
+			  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+		.pinned = 1,
+		.exclude_user = 1,
+	};
+	struct perf_event *ev;
+
+	ev = perf_event_create_kernel_counter(&attr, -1, current, NULL, NULL);
+	return IS_ERR(ev) ? NULL : ev;
+}
+
+static u64 dtlb_counter_read(struct perf_event *ev)
+{
+	u64 enabled, running;
+
+	return ev ? perf_event_read_value(ev, &enabled, &running) : 0;
+}
+
+static void dtlb_counter_stop(struct perf_event *ev)
+{
+	if (ev)
+		perf_event_release_kernel(ev);
+}
+#else
+static struct perf_event *dtlb_counter_start(void) { return NULL; }
+static u64 dtlb_counter_read(struct perf_event *ev) { return 0; }
+static void dtlb_counter_stop(struct perf_event *ev) { }
+#endif
+
+/* Link all cache lines of @hb into one random cycle (Sattolo's algorithm) */
+static void hb_link_random(struct hugebuf *hb, u32 *perm, size_t nlines)
+{
+	u64 x = get_random_u32() | 1;
+	size_t i, j;
+	u32 tmp;
+
+	for (i = 0; i < nlines; i++)
+		perm[i] = i;
+	for (i = nlines - 1; i > 0; i--) {
+		x ^= x << 13;	/* xorshift64 */
+		x ^= x >> 7;
+		x ^= x << 17;
+		j = x % i;
+		tmp = perm[i];
+		perm[i] = perm[j];
+		perm[j] = tmp;
+	}
+	for (i = 0; i < nlines; i++)
+		*(u64 *)hb_ptr(hb, (size_t)perm[i] * L1_CACHE_BYTES) =
+			(u64)perm[(i + 1) % nlines] * L1_CACHE_BYTES;
+}
+
+static void run_bench(void)
+{
+	size_t size = (size_t)bench_mb << 20, nlines = size / L1_CACHE_BYTES, i;
+	struct hugebuf hb;
+	struct perf_event *ev;
+	enum hb_backing b;
+	u64 t0, alloc_us, ns, misses, off;
+	u32 *perm;
+	int ret;
+
+	if (nlines > U32_MAX) {
+		pr_warn("bench_mb (%d) too large\n", bench_mb);
+		return;
+	}
+	perm = vmalloc(array_size(nlines, sizeof(u32)));
+	if (!perm)
+		return;
+	ev = dtlb_counter_start();
+	if (!ev)
+		pr_info("no dTLB miss counter available (no PMU / perf events?); showing just the times\n");
+
+	pr_info("random access over %d MB (%zu lines of %d bytes), per backing:\n",
+		bench_mb, nlines, L1_CACHE_BYTES);
+	pr_info("%27s  %10s  %12s  %16s\n", "backing", "alloc (us)", "ns/access",
+		"dTLB miss/access");
+	for (b = 0; b < HB_NR; b++) {
+		t0 = ktime_get_ns();
+		ret = hb_try(&hb, size, b);
+		alloc_us = div_u64(ktime_get_ns() - t0, NSEC_PER_USEC);
+		if (ret) {
+			pr_info("%27s  n/a (%d)\n", hb_name[b], ret);
+			continue;
+		}
+		hb_link_random(&hb, perm, nlines);
+
+		misses = dtlb_counter_read(ev);
+		t0 = ktime_get_ns();
+		for (i = 0, off = 0; i < nlines; i++)
+			off = READ_ONCE(*(u64 *)hb_ptr(&hb, off));
+		ns = ktime_get_ns() - t0;
+		misses = dtlb_counter_read(ev) - misses;
+
+		pr_info("%27s  %10llu  %12llu  %12llu.%03llu\n", hb_label(&hb), alloc_us,
+			div_u64(ns, nlines), div_u64(misses, nlines),
+			div_u64(misses * 1000, nlines) % 1000);
+		hb_free(&hb);
+		cond_resched();
+	}
+	dtlb_counter_stop(ev);
+	vfree(perm);
+}
+
+static int __init hugebuf_init(void)
+{
+	if (size_mb < 1 || bench_mb < 1) {
+		pr_warn("invalid parameter(s): size_mb=%d, bench_mb=%d\n", size_mb, bench_mb);
+		return -EINVAL;
+	}
+
+	/* dma_alloc_coherent() needs a device; a dummy platform device will do */
+	dma_pdev = platform_device_register_simple(OURMODNAME, -1, NULL, 0);
+	if (IS_ERR(dma_pdev) || dma_coerce_mask_and_coherent(&dma_pdev->dev, DMA_BIT_MASK(64))) {
+		if (!IS_ERR(dma_pdev))
+			platform_device_unregister(dma_pdev);
+		dma_pdev = NULL;
+	}
+
+	if (hb_alloc(&gbuf, (size_t)size_mb << 20)) {
+		pr_warn("couldn't allocate %d MB with any backing\n", size_mb);
+		if (dma_pdev)
+			platform_device_unregister(dma_pdev);
+		return -ENOMEM;
+	}
+	pr_info("inserted; %d MB buffer allocated via %s (%s)\n", size_mb, hb_label(&gbuf),
+		gbuf.addr ? (is_vmalloc_addr(gbuf.addr) ? "vmalloc space" : "direct-mapped")
+			  : "direct-mapped chunks; use hb_ptr()");
+	if (bench)
+		run_bench();
+	return 0;
+}
+
+static void __exit hugebuf_exit(void)
+{
+	hb_free(&gbuf);
+	if (dma_pdev)
+		platform_device_unregister(dma_pdev);
+	pr_info("removed\n");
+}
+
+module_init(hugebuf_init);
+module_exit(hugebuf_exit);
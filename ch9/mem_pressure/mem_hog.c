@@ -0,0 +1,133 @@
+/*
+ * ch9/mem_pressure/mem_hog.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 9: Kernel Memory Allocation for Module Authors Part 2
+ ****************************************************************
+ * Brief Description:
+ *
+ * The memory 'hog' for our mem_pressure.sh harness. Unlike ch9/oom_killer_try,
+ * it allocates at a controlled rate: every 'tick' it mmap()s and touches
+ * (faults in) a chunk of anonymous memory, ramping up at 'rate' MB/s until
+ * 'max' MB are held (it then keeps re-touching all of it, keeping up the
+ * pressure), or until it's killed (by the OOM killer!).
+ *
+ * Every tick, it prints (as CSV, to stdout) the time, the total held, the
+ * time taken to touch the memory (the new chunk while ramping up, all of it
+ * when holding) and the worst single chunk's latency; when the cgroup's near its
+ * memory.high / memory.max limit, this includes the time spent in direct
+ * reclaim (and throttling), i.e., the reclaim latency the app sees.
+ *
+ * Meant to be run by the ch9/mem_pressure/mem_pressure.sh script, within a
+ * cgroup v2 memory-limited sub-group; run it standalone at your own risk!
+ *
+ * For details, please refer the book, Ch 9.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define MB	(1024UL * 1024)
+#define MAX_CHUNKS	65536
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Write to every page of the chunk; returns the time it took in ns */
+static uint64_t touch(char *p, size_t len, size_t pgsz, char val)
+{
+	uint64_t t0 = now_ns();
+	size_t i;
+
+	for (i = 0; i < len; i += pgsz)
+		p[i] = val;
+	return now_ns() - t0;
+}
+
+int main(int argc, char **argv)
+{
+	static char *chunk[MAX_CHUNKS];
+	size_t pgsz = getpagesize(), chunk_sz;
+	unsigned long rate, max_mb, tick_ms, nchunks, n = 0, i, pass = 0;
+	uint64_t t_start, t_next, t_now, lat, lat_max;
+
+	if (argc < 4) {
+		fprintf(stderr,
+			"Usage: %s rate-MB/s max-MB tick-ms\n"
+			" Allocates (and touches) rate*tick/1000 MB every tick-ms milliseconds,\n"
+			" up to max-MB; then keeps re-touching it all. Prints CSV to stdout.\n",
+			argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	rate = strtoul(argv[1], NULL, 0);
+	max_mb = strtoul(argv[2], NULL, 0);
+	tick_ms = strtoul(argv[3], NULL, 0);
+	chunk_sz = (rate * MB * tick_ms / 1000 + pgsz - 1) & ~(pgsz - 1);
+	if (!rate || !max_mb || !tick_ms || !chunk_sz) {
+		fprintf(stderr, "%s: invalid parameter(s)\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	nchunks = max_mb * MB / chunk_sz;
+	if (nchunks > MAX_CHUNKS) {
+		fprintf(stderr, "%s: too many chunks (%lu > %d); increase tick-ms\n",
+			argv[0], nchunks, MAX_CHUNKS);
+		exit(EXIT_FAILURE);
+	}
+
+	setvbuf(stdout, NULL, _IOLBF, 0);	/* we're usually redirected */
+	printf("t_ms,held_mb,touch_lat_us,max_chunk_lat_us\n");
+	t_start = t_next = now_ns();
+	for (;;) {
+		lat_max = 0;
+		if (n < nchunks) {	/* ramp up */
+			chunk[n] = mmap(NULL, chunk_sz, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (chunk[n] == MAP_FAILED) {
+				perror("mmap");
+				exit(EXIT_FAILURE);
+			}
+			lat = lat_max = touch(chunk[n], chunk_sz, pgsz, (char)n);
+			n++;
+		} else {		/* hold: re-touch it all (swapped out pages fault back in) */
+			pass++;
+			lat = 0;
+			for (i = 0; i < n; i++) {
+				uint64_t l = touch(chunk[i], chunk_sz, pgsz, (char)pass);
+
+				lat += l;
+				if (l > lat_max)
+					lat_max = l;
+			}
+		}
+		printf("%.1f,%.1f,%lu,%lu\n", (now_ns() - t_start) / 1e6,
+		       (double)n * chunk_sz / MB, (unsigned long)(lat / 1000),
+		       (unsigned long)(lat_max / 1000));
+
+		t_next += tick_ms * 1000000ULL;
+		t_now = now_ns();
+		if (t_next > t_now) {
+			uint64_t d = t_next - t_now;
+			struct timespec ts = { d / 1000000000ULL, d % 1000000000ULL };
+
+			nanosleep(&ts, NULL);
+		} else {
+			t_next = t_now;	/* we're falling behind; don't try to catch up */
+		}
+	}
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,254 @@
+#!/bin/bash
+# ch9/mem_pressure/mem_pressure.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Programming"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Programming
+# ****************************************************************
+# Brief Description:
+# A controlled memory-pressure harness. Our ch9/oom_killer_try app allocates
+# without bound until the OOM killer strikes - the whole system's at risk.
+# Here, we instead place a memory 'hog' (mem_hog.c) into a cgroup v2
+# sub-group with memory.max (and optionally memory.high / memory.swap.max)
+# set; it ramps up its allocation at a given rate. Meanwhile, we sample the
+# sub-group's:
+#  - memory.current,
+#  - memory.pressure (PSI): the some/full avg10 values and the stall time
+#    within each interval (the reclaim / refault 'latency' the group's tasks
+#    suffered),
+#  - memory.stat: anon, file, pgscan, pgsteal, pgmajfault, workingset_refault,
+#  - memory.events: the high, max, oom and oom_kill event counts,
+# as a time series, into the CSV file ${OUTDIR}/mem_pressure.csv.
+# The hog itself records the latency it sees to touch its memory per tick
+# (which includes the time spent in direct reclaim) into ${OUTDIR}/mem_hog.csv.
+#
+# We limit only our sub-group, so its reclaim and OOM behaviour can be
+# measured reproducibly on one machine, without risking the host.
+#
+# For details, pl refer to the book Ch 9.
+#
+# Additional Ref:
+# https://www.kernel.org/doc/html/latest/admin-guide/cgroup-v2.html#memory
+# https://www.kernel.org/doc/html/latest/accounting/psi.html
+name=$(basename $0)
+TD=$(dirname $(realpath $0))
+HOG=${TD}/mem_hog
+TDIR=mem_pressure_test
+
+# Defaults
+MAX_MB=256
+HIGH_MB=""
+SWAP_MB=""
+RATE=64      # MB/s
+HOG_MB=512
+TICK_MS=100
+INTERVAL=1   # seconds
+DURATION=30  # seconds
+OUTDIR=.
+
+usage()
+{
+  echo "Usage: ${name} [-m max-MB] [-H high-MB] [-s swap-max-MB] [-r rate-MB/s]
+    [-M hog-MB] [-t tick-ms] [-i interval-s] [-d duration-s] [-o outdir]
+ -m : the sub-group's memory.max (default ${MAX_MB} MB)
+ -H : the sub-group's memory.high (default: not set, i.e., 'max')
+ -s : the sub-group's memory.swap.max (default: not set, i.e., 'max')
+ -r : the hog's allocation rate (default ${RATE} MB/s)
+ -M : the total the hog allocates (default ${HOG_MB} MB); keep it > max-MB
+      to see reclaim and (without enough swap) the OOM killer at work
+ -t : the hog's tick (default ${TICK_MS} ms)
+ -i : the sampling interval, in whole seconds (default ${INTERVAL} s)
+ -d : how long to run (default ${DURATION} s)
+ -o : the output directory for the CSV files (default: .)"
+  exit 1
+}
+
+# cleanup
+remove_subgroup()
+{
+[ -d ${CGV2_MNT}/${TDIR} ] && {
+  echo "[+] Removing our memory sub-group"
+  if [ -f ${CGV2_MNT}/${TDIR}/cgroup.kill ] ; then   # 5.14 on
+    echo 1 > ${CGV2_MNT}/${TDIR}/cgroup.kill
+  else
+    kill -9 $(cat ${CGV2_MNT}/${TDIR}/cgroup.procs) 2>/dev/null
+  fi
+  sleep 0.5
+  rmdir ${CGV2_MNT}/${TDIR}
+}
+} # end remove_subgroup()
+
+# Final cleanup: also turn off the memory controller, if we enabled it
+cleanup()
+{
+remove_subgroup
+[ ${MEM_ENABLED} -eq 1 ] && {
+  echo "-memory" > ${CGV2_MNT}/cgroup.subtree_control 2>/dev/null
+  MEM_ENABLED=0
+}
+} # end cleanup()
+
+setup_cgv2_mem()
+{
+echo "[+] Adding a 'memory' controller to the cgroups v2 hierarchy"
+grep -qw memory ${CGV2_MNT}/cgroup.subtree_control || {
+  echo "+memory" > ${CGV2_MNT}/cgroup.subtree_control || {
+    echo "Adding memory controller failed, aborting."; exit 1
+  }
+  MEM_ENABLED=1
+}
+echo "[+] Create a sub-group under it (here: ${CGV2_MNT}/${TDIR})"
+mkdir ${CGV2_MNT}/${TDIR} || {
+  echo "Warning! creating sub-dir ${CGV2_MNT}/${TDIR} failed..."
+  exit 1
+}
+echo "$((MAX_MB*1024*1024))" > ${CGV2_MNT}/${TDIR}/memory.max || {
+  echo "Error! updating memory.max for our sub-group failed"
+  exit 1
+}
+[ ! -z "${HIGH_MB}" ] && {
+  echo "$((HIGH_MB*1024*1024))" > ${CGV2_MNT}/${TDIR}/memory.high || {
+    echo "Error! updating memory.high for our sub-group failed"
+    exit 1
+  }
+}
+[ ! -z "${SWAP_MB}" ] && {
+  echo "$((SWAP_MB*1024*1024))" > ${CGV2_MNT}/${TDIR}/memory.swap.max || {
+    echo "Error! updating memory.swap.max for our sub-group failed"
+    exit 1
+  }
+}
+echo "memory.max=$(cat ${CGV2_MNT}/${TDIR}/memory.max) memory.high=$(cat ${CGV2_MNT}/${TDIR}/memory.high) \
+memory.swap.max=$(cat ${CGV2_MNT}/${TDIR}/memory.swap.max 2>/dev/null)"
+} # end setup_cgv2_mem()
+
+# Print the value of the key $1 in the flat keyed file $2 (0 if absent)
+getkey()
+{
+awk -v k=$1 '$1 == k {v=$2} END {print v+0}' $2
+}
+
+# PSI: print the avg10 and total values of the "some" and "full" lines
+get_psi()
+{
+awk '{ for (i = 2; i <= NF; i++) { split($i, a, "="); v[$1 "_" a[1]] = a[2] } }
+ END { printf("%s,%s,%s,%s", v["some_avg10"]+0, v["full_avg10"]+0,
+              v["some_total"]+0, v["full_total"]+0) }' $1
+}
+
+# Sample the sub-group until the hog dies or the duration's up
+sample()
+{
+local cg=${CGV2_MNT}/${TDIR} t=0
+local psi some full refault prev_some prev_full
+
+psi=$(get_psi ${cg}/memory.pressure)
+prev_some=$(echo ${psi} | cut -d, -f3)
+prev_full=$(echo ${psi} | cut -d, -f4)
+
+echo "t_s,current_mb,psi_some_avg10,psi_full_avg10,stall_some_ms,stall_full_ms,\
+anon_mb,file_mb,pgscan,pgsteal,pgmajfault,workingset_refault,\
+ev_high,ev_max,ev_oom,ev_oom_kill" > ${CSV}
+while [ ${t} -lt ${DURATION} ] && kill -0 ${hogpid} 2>/dev/null ; do
+  psi=$(get_psi ${cg}/memory.pressure)
+  some=$(echo ${psi} | cut -d, -f3)
+  full=$(echo ${psi} | cut -d, -f4)
+  # workingset_refault got split into _anon and _file in 5.9
+  refault=$(( $(getkey workingset_refault ${cg}/memory.stat) + \
+              $(getkey workingset_refault_anon ${cg}/memory.stat) + \
+              $(getkey workingset_refault_file ${cg}/memory.stat) ))
+  echo "${t},$(($(cat ${cg}/memory.current)/1048576)),\
+$(echo ${psi} | cut -d, -f1,2),$(((some-prev_some)/1000)),$(((full-prev_full)/1000)),\
+$(($(getkey anon ${cg}/memory.stat)/1048576)),$(($(getkey file ${cg}/memory.stat)/1048576)),\
+$(getkey pgscan ${cg}/memory.stat),$(getkey pgsteal ${cg}/memory.stat),\
+$(getkey pgmajfault ${cg}/memory.stat),${refault},\
+$(getkey high ${cg}/memory.events),$(getkey max ${cg}/memory.events),\
+$(getkey oom ${cg}/memory.events),$(getkey oom_kill ${cg}/memory.events)" >> ${CSV}
+  prev_some=${some} ; prev_full=${full}
+  tail -n1 ${CSV}
+  sleep ${INTERVAL}
+  t=$((t+INTERVAL))
+done
+} # end sample()
+
+
+### "main" here
+
+[ $(id -u) -ne 0 ] && {
+   echo "$0: need root."
+   exit 1
+}
+while getopts "m:H:s:r:M:t:i:d:o:h" opt; do
+  case "${opt}" in
+    m) MAX_MB=${OPTARG} ;;
+    H) HIGH_MB=${OPTARG} ;;
+    s) SWAP_MB=${OPTARG} ;;
+    r) RATE=${OPTARG} ;;
+    M) HOG_MB=${OPTARG} ;;
+    t) TICK_MS=${OPTARG} ;;
+    i) INTERVAL=${OPTARG} ;;
+    d) DURATION=${OPTARG} ;;
+    o) OUTDIR=${OPTARG} ;;
+    *) usage ;;
+  esac
+done
+
+[ ! -x ${HOG} ] && {
+  echo "${name}: the mem_hog program isn't built; running make ..."
+  make -C ${TD} mem_hog || exit 1
+}
+
+mount |grep -q cgroup2 || {
+  echo "No cgroup2 filesystem mounted? Pl mount one first; aborting..."
+  exit 1
+}
+export CGV2_MNT=$(mount |grep cgroup2 |head -n1 |awk '{print $3}')
+[ -z "${CGV2_MNT}" ] && {
+  echo "cgroup2 filesystem not acquired, aborting..."
+  exit 1
+}
+[ ! -f ${CGV2_MNT}/cgroup.controllers ] || grep -qw memory ${CGV2_MNT}/cgroup.controllers || {
+  echo "The memory controller isn't available on the cgroup v2 hierarchy, aborting..."
+  exit 1
+}
+
+mkdir -p ${OUTDIR} || exit 1
+CSV=${OUTDIR}/mem_pressure.csv
+HOGCSV=${OUTDIR}/mem_hog.csv
+
+remove_subgroup
+MEM_ENABLED=0
+trap cleanup EXIT
+trap 'exit 1' INT QUIT TERM
+setup_cgv2_mem
+
+echo "[+] Launch the hog (${RATE} MB/s, up to ${HOG_MB} MB) within our sub-group"
+# the subshell moves itself into the sub-group and then becomes the hog
+( echo ${BASHPID} > ${CGV2_MNT}/${TDIR}/cgroup.procs && \
+  exec ${HOG} ${RATE} ${HOG_MB} ${TICK_MS} ) > ${HOGCSV} &
+hogpid=$!
+sleep 0.1
+grep -q "^0::/${TDIR}$" /proc/${hogpid}/cgroup 2>/dev/null || {
+  echo "Warning! the hog (PID ${hogpid}) isn't in our sub-group ${TDIR}"
+}
+
+echo "[+] Sampling every ${INTERVAL}s for up to ${DURATION}s into ${CSV}"
+sample
+
+if kill -0 ${hogpid} 2>/dev/null ; then
+  echo "[+] Time's up; the hog survived"
+  kill ${hogpid}
+  wait ${hogpid} 2>/dev/null
+else
+  wait ${hogpid} 2>/dev/null
+  stat=$?
+  [ ${stat} -eq 137 ] && echo "[+] the hog was SIGKILL-ed (OOM killed?)" \
+   || echo "[+] the hog exited with status ${stat}"
+fi
+echo "memory.events:"
+cat ${CGV2_MNT}/${TDIR}/memory.events
+echo "Time series: ${CSV} (the sub-group) and ${HOGCSV} (the hog's touch latencies)"
+exit 0		# cleanup() runs via the EXIT trap
@@ -0,0 +1,61 @@
+#!/bin/bash
+# ch9/query_process_oom/bench.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Programming"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Programming
+# ****************************************************************
+# Brief Description:
+# Compare the time taken to query the OOM score of all processes by our
+# ch9/query_process_oom.sh script versus our C query_process_oom app, both
+# as a one-shot run and in it's (fd-caching) refresh mode.
+# Optionally pass the number of (sleeping) dummy processes to create first,
+# so as to see how both scale (f.e. 5000).
+#
+# Details: refer to the LKP book, Ch 9
+name=$(basename $0)
+TD=$(dirname $(realpath $0))
+APP=${TD}/query_process_oom
+SCRIPT=${TD}/../query_process_oom.sh
+LOOPS=10
+
+[ ! -x ${APP} ] && {
+  echo "${name}: ${APP} not built; run 'make' first"
+  exit 1
+}
+
+nprcs=${1:-0}
+[ ${nprcs} -gt 0 ] && {
+  echo "${name}: creating ${nprcs} sleeping processes..."
+  for i in $(seq 1 ${nprcs}); do
+    sleep 3600 &
+  done
+  trap "kill $(jobs -p |tr '\n' ' ') 2>/dev/null" EXIT
+}
+
+ms_since()
+{
+echo $(( ($(date +%s%N) - $1) / 1000000 ))
+}
+
+echo "${name}: $(ls -d /proc/[0-9]* |wc -l) processes alive"
+
+t1=$(date +%s%N)
+for i in $(seq 1 ${LOOPS}); do
+  ${APP} >/dev/null
+done
+printf "%-40s : %9d ms/run (avg over %d runs)\n" "query_process_oom (C), one-shot" \
+	$(( $(ms_since ${t1}) / LOOPS )) ${LOOPS}
+
+# refresh mode: 1 ms interval (the minimum; 0 means one-shot), the app itself
+# reports the time per scan
+printf "%-40s : %s\n" "query_process_oom (C), refresh mode" \
+	"$(${APP} -n 1 -i 1 -c ${LOOPS} |grep "scanned in" |tail -n1)"
+
+t1=$(date +%s%N)
+bash ${SCRIPT} >/dev/null
+printf "%-40s : %9d ms/run (1 run)\n" "query_process_oom.sh (script)" $(ms_since ${t1})
+exit 0
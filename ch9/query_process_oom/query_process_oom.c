@@ -0,0 +1,324 @@
+/*
+ * ch9/query_process_oom/query_process_oom.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 9: Kernel Memory Allocation for Module Authors Part 2
+ ****************************************************************
+ * Brief Description:
+ * A *userspace* C equivalent of our ch9/query_process_oom.sh script: query
+ * the OOM score of all processes alive, emitting a list sorted by OOM score
+ * (highest - i.e., the likeliest OOM killer victim - first), along with the
+ * oom_score_adj value and the RSS of each process.
+ *
+ * The script runs choom(1) - plus awk and cut - once per process. Here, we
+ * make a single pass over /proc and read each process's oom_score,
+ * oom_score_adj and statm pseudo-files via openat(2)/pread(2) relative to
+ * the /proc/<pid> dir fd; no processes are spawned.
+ *
+ * In 'refresh' mode (-i), we keep the per-process file descriptors open
+ * across iterations and simply pread(2) them again at offset 0; thus, a
+ * refresh costs (mostly) just three small reads per process. Once a process
+ * dies, reads on it's stale fds fail (ESRCH) and we drop them.
+ *
+ * For details, please refer the book, Ch 9.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+struct oom_rec {
+	pid_t pid;
+	int fd_score, fd_adj, fd_statm;	/* -1 => not (or no longer) cached */
+	long score, adj, rss_kb;
+	char comm[17];
+	int valid;
+};
+
+static long pgsz_kb;
+static int cache_fds = 1;
+
+static void close_rec(struct oom_rec *r)
+{
+	if (r->fd_score >= 0)
+		close(r->fd_score);
+	if (r->fd_adj >= 0)
+		close(r->fd_adj);
+	if (r->fd_statm >= 0)
+		close(r->fd_statm);
+	r->fd_score = r->fd_adj = r->fd_statm = -1;
+}
+
+/* pread the (small) pseudo-file @fd from offset 0 and parse a long from it */
+static int read_long(int fd, long *val)
+{
+	char buf[64];
+	ssize_t n;
+
+	n = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+	*val = strtol(buf, NULL, 10);
+	return 0;
+}
+
+/* statm: size resident shared text lib data dt (in pages); we want the 2nd */
+static int read_rss(int fd, long *rss_kb)
+{
+	char buf[128];
+	long size, resident;
+	ssize_t n;
+
+	n = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+	if (sscanf(buf, "%ld %ld", &size, &resident) != 2)
+		return -1;
+	*rss_kb = resident * pgsz_kb;
+	return 0;
+}
+
+static int open_rec(int procfd, struct oom_rec *r)
+{
+	char path[64];
+	int fd;
+
+	snprintf(path, sizeof(path), "%d/oom_score", r->pid);
+	r->fd_score = openat(procfd, path, O_RDONLY | O_CLOEXEC);
+	snprintf(path, sizeof(path), "%d/oom_score_adj", r->pid);
+	r->fd_adj = openat(procfd, path, O_RDONLY | O_CLOEXEC);
+	snprintf(path, sizeof(path), "%d/statm", r->pid);
+	r->fd_statm = openat(procfd, path, O_RDONLY | O_CLOEXEC);
+	if (r->fd_score < 0 || r->fd_adj < 0 || r->fd_statm < 0) {
+		if (errno == EMFILE || errno == ENFILE)
+			cache_fds = 0;	/* out of fds; stop caching from now on */
+		close_rec(r);
+		return -1;
+	}
+
+	/* the name is read just once; it's not expected to change (much) */
+	snprintf(path, sizeof(path), "%d/comm", r->pid);
+	fd = openat(procfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		ssize_t n = read(fd, r->comm, sizeof(r->comm) - 1);
+
+		if (n > 0) {
+			r->comm[n] = '\0';
+			if (r->comm[n - 1] == '\n')
+				r->comm[n - 1] = '\0';
+		}
+		close(fd);
+	}
+	return 0;
+}
+
+static int read_rec(struct oom_rec *r)
+{
+	if (read_long(r->fd_score, &r->score) < 0 ||
+	    read_long(r->fd_adj, &r->adj) < 0 ||
+	    read_rss(r->fd_statm, &r->rss_kb) < 0)
+		return -1;
+	return 0;
+}
+
+/* Refresh the values of record @r; returns -1 if the process is gone */
+static int refresh_rec(int procfd, struct oom_rec *r)
+{
+	int ret;
+
+	if (r->fd_score >= 0) {
+		/* cached fds; if they're stale, the PID may have been reused */
+		ret = read_rec(r);
+		if (!ret)
+			goto out;
+		close_rec(r);
+	}
+	if (open_rec(procfd, r) < 0)
+		return -1;
+	ret = read_rec(r);
+ out:
+	if (ret < 0 || !cache_fds)
+		close_rec(r);
+	return ret;
+}
+
+static int cmp_pid(const void *a, const void *b)
+{
+	return ((const struct oom_rec *)a)->pid - ((const struct oom_rec *)b)->pid;
+}
+
+/* Highest OOM score first; ties broken by RSS (larger first) */
+static int cmp_score(const void *a, const void *b)
+{
+	const struct oom_rec *x = *(struct oom_rec * const *)a;
+	const struct oom_rec *y = *(struct oom_rec * const *)b;
+
+	if (x->score != y->score)
+		return y->score > x->score ? 1 : -1;
+	if (x->rss_kb != y->rss_kb)
+		return y->rss_kb > x->rss_kb ? 1 : -1;
+	return x->pid - y->pid;
+}
+
+/*
+ * scan()
+ * One pass over /proc. The previous scan's records @old (sorted by PID) are
+ * merged in, so that their cached fds get reused; the new (sorted) array is
+ * returned via @newp and it's length as the return value.
+ */
+static int scan(int procfd, DIR *proc, struct oom_rec *old, int nold,
+		struct oom_rec **newp)
+{
+	struct oom_rec *recs = NULL, *tmp;
+	struct dirent *de;
+	int n = 0, max = 0, i, j = 0;
+
+	rewinddir(proc);
+	while ((de = readdir(proc))) {
+		if (de->d_name[0] < '0' || de->d_name[0] > '9')
+			continue;
+		if (n == max) {
+			max = max ? max * 2 : 1024;
+			tmp = realloc(recs, max * sizeof(*recs));
+			if (!tmp) {
+				perror("realloc failed");
+				exit(EXIT_FAILURE);
+			}
+			recs = tmp;
+		}
+		memset(&recs[n], 0, sizeof(recs[n]));
+		recs[n].pid = atoi(de->d_name);
+		recs[n].fd_score = recs[n].fd_adj = recs[n].fd_statm = -1;
+		n++;
+	}
+	qsort(recs, n, sizeof(*recs), cmp_pid);
+
+	/* merge: reuse the old records' fds; close those of processes gone */
+	for (i = 0; i < n; i++) {
+		while (j < nold && old[j].pid < recs[i].pid)
+			close_rec(&old[j++]);
+		if (j < nold && old[j].pid == recs[i].pid)
+			recs[i] = old[j++];
+		recs[i].valid = (refresh_rec(procfd, &recs[i]) == 0);
+	}
+	while (j < nold)
+		close_rec(&old[j++]);
+
+	*newp = recs;
+	return n;
+}
+
+static void show(struct oom_rec *recs, int n, int topn, double ms)
+{
+	struct oom_rec **sorted;
+	int i, nvalid = 0;
+
+	sorted = malloc(n * sizeof(*sorted));
+	if (!sorted) {
+		perror("malloc failed");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < n; i++)
+		if (recs[i].valid)
+			sorted[nvalid++] = &recs[i];
+	qsort(sorted, nvalid, sizeof(*sorted), cmp_score);
+
+	printf("%9s  %24s   %10s  %7s  %10s\n",
+	       "PID", "Name", "OOM Score", "OOM adj", "RSS (KB)");
+	for (i = 0; i < nvalid && (!topn || i < topn); i++)
+		printf("%9d  %24s   %10ld  %7ld  %10ld\n", sorted[i]->pid,
+		       sorted[i]->comm, sorted[i]->score, sorted[i]->adj,
+		       sorted[i]->rss_kb);
+	printf("[%d processes scanned in %.3f ms]\n", nvalid, ms);
+	fflush(stdout);
+	free(sorted);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-n top-N] [-i interval-ms [-c count]]\n"
+		" -n N  : show only the top N processes (by OOM score); default: all\n"
+		" -i ms : refresh mode: rescan every 'ms' milliseconds\n"
+		" -c C  : in refresh mode, stop after C iterations (default: forever)\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct oom_rec *recs = NULL, *newrecs;
+	struct timespec t1, t2, ts;
+	struct rlimit rlim;
+	int opt, n = 0, topn = 0, interval_ms = 0, count = 0, iter = 0, procfd;
+	DIR *proc;
+
+	while ((opt = getopt(argc, argv, "n:i:c:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			topn = atoi(optarg);
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		case 'c':
+			count = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (topn < 0 || interval_ms < 0 || count < 0)
+		usage(argv[0]);
+
+	pgsz_kb = sysconf(_SC_PAGESIZE) / 1024;
+	/* we cache 3 fds per process in refresh mode; ask for as many as allowed */
+	if (interval_ms && !getrlimit(RLIMIT_NOFILE, &rlim)) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+	if (!interval_ms)
+		cache_fds = 0;
+
+	proc = opendir("/proc");
+	if (!proc) {
+		perror("opendir /proc failed");
+		exit(EXIT_FAILURE);
+	}
+	procfd = dirfd(proc);
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		n = scan(procfd, proc, recs, n, &newrecs);
+		free(recs);
+		recs = newrecs;
+		clock_gettime(CLOCK_MONOTONIC, &t2);
+		show(recs, n, topn, (t2.tv_sec - t1.tv_sec) * 1000.0 +
+		     (t2.tv_nsec - t1.tv_nsec) / 1e6);
+
+		if (!interval_ms || (count && ++iter >= count))
+			break;
+		ts.tv_sec = interval_ms / 1000;
+		ts.tv_nsec = (interval_ms % 1000) * 1000000L;
+		nanosleep(&ts, NULL);
+		printf("\n");
+	} while (1);
+
+	closedir(proc);
+	free(recs);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,415 @@
+/*
+ * ch9/slab_custom_pool/slab_custom_pool.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 9 : Kernel Memory Allocation for Module Authors, Part 2
+ ****************************************************************
+ * Brief Description:
+ * Our ch9/slab_custom module creates a custom slab cache and allocates just
+ * one object from it. Here, we wrap that very cache in an object pool, as
+ * a 'production' driver might:
+ *  - per-CPU 'magazines' of ready-to-use (i.e., already constructed) objects;
+ *    the alloc and free fast paths just pop/push a pointer, under an
+ *    uncontended per-CPU spinlock;
+ *  - when a magazine runs empty, it's refilled (half way) in one go via
+ *    kmem_cache_alloc_bulk(); when it's full, half of it is given back via
+ *    kmem_cache_free_bulk();
+ *  - a shrinker, so that under memory pressure the kernel can reclaim the
+ *    idle objects sitting in the magazines.
+ * The slab debug flags (SLAB_POISON | SLAB_RED_ZONE) the slab_custom demo
+ * always uses are now optional (the 'debug' parameter), so that production
+ * doesn't pay for poisoning and red-zoning on every alloc/free.
+ *
+ * As with any slab cache with a constructor, objects must be returned to the
+ * pool in their constructed state.
+ * The pool API must not be used in interrupt (hardirq or softirq) context.
+ *
+ * At init, we benchmark allocs/sec (an alloc+free of 'batch' objects at a
+ * time) for our pool against plain kmem_cache_alloc() and kmalloc().
+ *
+ * For details, please refer the book, Ch 9.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/shrinker.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
+
+#define OURMODNAME   "slab_custom_pool"
+#define OURCACHENAME "our_ctx"
+
+static int use_ctor = 1;
+module_param(use_ctor, int, 0);
+MODULE_PARM_DESC(use_ctor, "if set to 1 (default), our custom ctor routine"
+" will initialize slabmem; when 0, no custom constructor will run");
+
+static bool debug;
+module_param(debug, bool, 0);
+MODULE_PARM_DESC(debug, "create the cache with SLAB_POISON | SLAB_RED_ZONE (default 0)");
+
+#define MAG_MAX		64
+static int mag_size = 32;
+module_param(mag_size, int, 0);
+MODULE_PARM_DESC(mag_size, "# of objects per per-CPU magazine, 2-64 (default 32)");
+
+static int bench_iters = 100000;
+module_param(bench_iters, int, 0);
+MODULE_PARM_DESC(bench_iters, "# of objects alloc'ed and freed per benchmark (default 100000; 0 = none)");
+
+static int batch = 16;
+module_param(batch, int, 0);
+MODULE_PARM_DESC(batch, "# of objects held at a time during the benchmark, 1-64 (default 16)");
+
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_DESCRIPTION("LKP book:ch9/slab_custom_pool: a per-CPU object pool over a custom slab cache");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+/* The same 'demo' structure as in ch9/slab_custom */
+struct myctx {
+	u32 iarr[10];
+	u64 uarr[10];
+	char uname[128], passwd[16], config[64];
+};
+
+struct pool_mag {
+	spinlock_t lock;
+	int nr;
+	void *objs[MAG_MAX];
+	unsigned long hits, refills, flushes;	/* stats */
+};
+
+struct obj_pool {
+	struct kmem_cache *cache;
+	struct pool_mag __percpu *mags;
+	int mag_size;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	struct shrinker *shrinker;
+#else
+	struct shrinker shrinker;
+#endif
+};
+
+static struct obj_pool gpool;
+
+/*
+ * pool_alloc - get an object from the pool.
+ * The fast path pops one off this CPU's magazine; when it's empty, we refill
+ * it (half way) with a single kmem_cache_alloc_bulk() call - outside the lock,
+ * as that may sleep (depending on @gfp).
+ */
+static void *pool_alloc(struct obj_pool *pool, gfp_t gfp)
+{
+	void *tmp[MAG_MAX / 2], *obj = NULL;
+	struct pool_mag *mag;
+	int n, i;
+
+	mag = get_cpu_ptr(pool->mags);
+	spin_lock(&mag->lock);
+	if (likely(mag->nr)) {
+		obj = mag->objs[--mag->nr];
+		mag->hits++;
+	}
+	spin_unlock(&mag->lock);
+	put_cpu_ptr(pool->mags);
+	if (likely(obj))
+		return obj;
+
+	/* slow path: bulk refill; one object's for the caller, the rest are cached */
+	n = kmem_cache_alloc_bulk(pool->cache, gfp, pool->mag_size / 2, tmp);
+	if (!n)
+		return NULL;
+	obj = tmp[--n];
+
+	mag = get_cpu_ptr(pool->mags);	/* we may be on another CPU by now; fine */
+	spin_lock(&mag->lock);
+	mag->refills++;
+	for (i = 0; i < n && mag->nr < pool->mag_size; i++)
+		mag->objs[mag->nr++] = tmp[i];
+	spin_unlock(&mag->lock);
+	put_cpu_ptr(pool->mags);
+	if (i < n)	/* no room (we raced with frees); give the rest back */
+		kmem_cache_free_bulk(pool->cache, n - i, &tmp[i]);
+	return obj;
+}
+
+/*
+ * pool_free - return an object (in it's constructed state!) to the pool.
+ * When this CPU's magazine is full, half of it is handed back to the slab
+ * cache with a single kmem_cache_free_bulk() call.
+ */
+static void pool_free(struct obj_pool *pool, void *obj)
+{
+	void *tmp[MAG_MAX / 2];
+	struct pool_mag *mag;
+	int n = 0;
+
+	mag = get_cpu_ptr(pool->mags);
+	spin_lock(&mag->lock);
+	if (unlikely(mag->nr >= pool->mag_size)) {
+		n = pool->mag_size / 2;
+		mag->nr -= n;
+		memcpy(tmp, &mag->objs[mag->nr], n * sizeof(void *));
+		mag->flushes++;
+	}
+	mag->objs[mag->nr++] = obj;
+	spin_unlock(&mag->lock);
+	put_cpu_ptr(pool->mags);
+	if (n)
+		kmem_cache_free_bulk(pool->cache, n, tmp);
+}
+
+/* Free up to @nr idle objects from the magazines; returns the # freed */
+static unsigned long pool_drain(struct obj_pool *pool, unsigned long nr)
+{
+	void *tmp[MAG_MAX];
+	struct pool_mag *mag;
+	unsigned long freed = 0;
+	int cpu, n;
+
+	for_each_possible_cpu(cpu) {
+		if (freed >= nr)
+			break;
+		mag = per_cpu_ptr(pool->mags, cpu);
+		spin_lock(&mag->lock);
+		n = min_t(unsigned long, mag->nr, nr - freed);
+		mag->nr -= n;
+		memcpy(tmp, &mag->objs[mag->nr], n * sizeof(void *));
+		spin_unlock(&mag->lock);
+		if (n)
+			kmem_cache_free_bulk(pool->cache, n, tmp);
+		freed += n;
+	}
+	return freed;
+}
+
+/*------------------------------ The shrinker ------------------------------*/
+static struct obj_pool *shrinker_to_pool(struct shrinker *s)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	return s->private_data;
+#else
+	return container_of(s, struct obj_pool, shrinker);
+#endif
+}
+
+static unsigned long pool_shrink_count(struct shrinker *s, struct shrink_control *sc)
+{
+	struct obj_pool *pool = shrinker_to_pool(s);
+	unsigned long nr = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		nr += READ_ONCE(per_cpu_ptr(pool->mags, cpu)->nr);
+#ifdef SHRINK_EMPTY
+	return nr ? nr : SHRINK_EMPTY;
+#else
+	return nr;
+#endif
+}
+
+static unsigned long pool_shrink_scan(struct shrinker *s, struct shrink_control *sc)
+{
+	unsigned long freed = pool_drain(shrinker_to_pool(s), sc->nr_to_scan);
+
+	pr_debug("shrinker: asked for %lu, freed %lu idle objects\n", sc->nr_to_scan, freed);
+	return freed ? freed : SHRINK_STOP;
+}
+
+static int pool_register_shrinker(struct obj_pool *pool)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	pool->shrinker = shrinker_alloc(0, OURMODNAME);
+	if (!pool->shrinker)
+		return -ENOMEM;
+	pool->shrinker->count_objects = pool_shrink_count;
+	pool->shrinker->scan_objects = pool_shrink_scan;
+	pool->shrinker->seeks = DEFAULT_SEEKS;
+	pool->shrinker->private_data = pool;
+	shrinker_register(pool->shrinker);
+	return 0;
+#else
+	pool->shrinker.count_objects = pool_shrink_count;
+	pool->shrinker.scan_objects = pool_shrink_scan;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	return register_shrinker(&pool->shrinker, OURMODNAME);
+#else
+	return register_shrinker(&pool->shrinker);
+#endif
+#endif
+}
+
+static void pool_unregister_shrinker(struct obj_pool *pool)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	shrinker_free(pool->shrinker);
+#else
+	unregister_shrinker(&pool->shrinker);
+#endif
+}
+
+/*------------------------- The cache and the pool -------------------------*/
+/* Our constructor; unlike slab_custom's, it's silent (it runs a lot here) */
+static void our_ctor(void *new)
+{
+	memset(new, 0, sizeof(struct myctx));
+}
+
+static int pool_create(struct obj_pool *pool)
+{
+	slab_flags_t flags = SLAB_HWCACHE_ALIGN;	/* good for performance */
+	int cpu, ret;
+
+	if (debug)
+		flags |= SLAB_POISON | SLAB_RED_ZONE;
+	pool->cache = kmem_cache_create(OURCACHENAME, sizeof(struct myctx), sizeof(long),
+					flags, use_ctor == 1 ? our_ctor : NULL);
+	if (!pool->cache) {
+		pr_warn("kmem_cache_create() failed\n");
+		return -ENOMEM;
+	}
+
+	pool->mag_size = mag_size;
+	pool->mags = alloc_percpu(struct pool_mag);
+	if (!pool->mags) {
+		ret = -ENOMEM;
+		goto out_cache;
+	}
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(pool->mags, cpu)->lock);
+
+	ret = pool_register_shrinker(pool);
+	if (ret)
+		goto out_mags;
+	return 0;
+
+ out_mags:
+	free_percpu(pool->mags);
+ out_cache:
+	kmem_cache_destroy(pool->cache);
+	return ret;
+}
+
+static void pool_destroy(struct obj_pool *pool)
+{
+	pool_unregister_shrinker(pool);
+	pool_drain(pool, ULONG_MAX);
+	free_percpu(pool->mags);
+	kmem_cache_destroy(pool->cache);
+}
+
+static void pool_show_stats(struct obj_pool *pool)
+{
+	unsigned long hits = 0, refills = 0, flushes = 0, cached = 0;
+	struct pool_mag *mag;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		mag = per_cpu_ptr(pool->mags, cpu);
+		spin_lock(&mag->lock);
+		hits += mag->hits;
+		refills += mag->refills;
+		flushes += mag->flushes;
+		cached += mag->nr;
+		spin_unlock(&mag->lock);
+	}
+	pr_info("pool: %lu fast-path allocs, %lu bulk refills, %lu bulk flushes; %lu objects cached\n",
+		hits, refills, flushes, cached);
+}
+
+/*------------------------------ The benchmark -----------------------------*/
+enum { BENCH_POOL, BENCH_CACHE, BENCH_KMALLOC, NR_BENCH };
+static const char * const bench_name[NR_BENCH] = {
+	"pool_alloc/free", "kmem_cache_alloc/free", "kmalloc/kfree"
+};
+
+/* Alloc and free bench_iters objects, 'batch' of them at a time; returns ns */
+static u64 bench_one(int which)
+{
+	void *objs[MAG_MAX];
+	u64 t0 = ktime_get_ns();
+	int i, j;
+
+	for (i = 0; i < bench_iters; i += batch) {
+		for (j = 0; j < batch; j++) {
+			if (which == BENCH_POOL)
+				objs[j] = pool_alloc(&gpool, GFP_KERNEL);
+			else if (which == BENCH_CACHE)
+				objs[j] = kmem_cache_alloc(gpool.cache, GFP_KERNEL);
+			else
+				objs[j] = kmalloc(sizeof(struct myctx), GFP_KERNEL);
+		}
+		for (j = 0; j < batch; j++) {
+			if (!objs[j])
+				continue;
+			if (which == BENCH_POOL)
+				pool_free(&gpool, objs[j]);
+			else if (which == BENCH_CACHE)
+				kmem_cache_free(gpool.cache, objs[j]);
+			else
+				kfree(objs[j]);
+		}
+		cond_resched();
+	}
+	return ktime_get_ns() - t0;
+}
+
+static void run_bench(void)
+{
+	u64 ns;
+	int which;
+
+	pr_info("benchmark: %d objects of %zu bytes (cache object size %u), %d at a time;"
+		" debug flags %s\n", bench_iters, sizeof(struct myctx),
+		kmem_cache_size(gpool.cache), batch, debug ? "on" : "off");
+	pr_info("%24s  %12s  %14s\n", "API", "ns/pair", "allocs/sec");
+	for (which = 0; which < NR_BENCH; which++) {
+		ns = bench_one(which);
+		pr_info("%24s  %12llu  %14llu\n", bench_name[which],
+			div_u64(ns, bench_iters), div64_u64((u64)bench_iters * NSEC_PER_SEC, ns ? ns : 1));
+	}
+	pool_show_stats(&gpool);
+}
+
+static int __init slab_custom_pool_init(void)
+{
+	int ret;
+
+	if (mag_size < 2 || mag_size > MAG_MAX || batch < 1 || batch > MAG_MAX ||
+	    bench_iters < 0) {
+		pr_warn("invalid parameter(s): mag_size=%d (2-%d), batch=%d (1-%d), bench_iters=%d\n",
+			mag_size, MAG_MAX, batch, MAG_MAX, bench_iters);
+		return -EINVAL;
+	}
+	ret = pool_create(&gpool);
+	if (ret)
+		return ret;
+	pr_info("inserted; pool over cache %s: object size %u, %d objects per magazine\n",
+		OURCACHENAME, kmem_cache_size(gpool.cache), gpool.mag_size);
+	if (bench_iters)
+		run_bench();
+	return 0;
+}
+
+static void __exit slab_custom_pool_exit(void)
+{
+	pool_show_stats(&gpool);
+	pool_destroy(&gpool);
+	pr_info("pool and custom cache destroyed; removed\n");
+}
+
+module_init(slab_custom_pool_init);
+module_exit(slab_custom_pool_exit);
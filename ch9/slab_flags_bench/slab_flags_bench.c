@@ -0,0 +1,247 @@
+/*
+ * ch9/slab_flags_bench/slab_flags_bench.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 9 : Kernel Memory Allocation for Module Authors, Part 2
+ ****************************************************************
+ * Brief Description:
+ * Our slab_custom, poison_test and slab_custom_mult modules all hard-code
+ * SLAB_POISON | SLAB_RED_ZONE | SLAB_HWCACHE_ALIGN. What do these (debug)
+ * flags cost? This module quantifies it: for every combination of
+ *  SLAB_POISON, SLAB_RED_ZONE, SLAB_HWCACHE_ALIGN and SLAB_STORE_USER
+ * - with and without a constructor (the same one as slab_custom's, minus
+ * the printk) - it creates a custom cache for the slab_custom 'myctx'
+ * structure, runs the same alloc/free workload on it and reports:
+ *  - ns per alloc/free pair,
+ *  - the object stride: the distance between adjacent objects in a slab,
+ *    i.e., the object size *including* the debug metadata (red zones, the
+ *    alloc/free tracking info, alignment padding),
+ *  - the actual memory consumed per object: the growth in slab memory
+ *    (the NR_SLAB_UNRECLAIMABLE[_B] counter) while holding 'nobj' objects,
+ *    which includes the slab's tail waste (it's system-wide, so other
+ *    activity adds a little noise).
+ *
+ * Notes:
+ * - the debug flags only take effect with CONFIG_SLUB_DEBUG=y (with
+ *   SLUB); else, they're silently ignored and all combinations perform alike.
+ * - SLUB doesn't poison objects of caches that have a constructor; so,
+ *   SLAB_POISON is a lot cheaper with ctor=1.
+ *
+ * The results are shown in the kernel log when the module's loaded.
+ *
+ * For details, please refer the book, Ch 9.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmstat.h>
+#include <linux/sort.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
+#include <linux/sched.h>	/* current */
+
+#define OURMODNAME   "slab_flags_bench"
+
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_DESCRIPTION("LKP book:ch9/slab_flags_bench: cost of the slab (debug) flags");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static int iters = 100000;
+module_param(iters, int, 0);
+MODULE_PARM_DESC(iters, "# of alloc/free pairs per combination (default 100000)");
+
+static int batch = 16;
+module_param(batch, int, 0);
+MODULE_PARM_DESC(batch, "# of objects held at a time during the timed workload, 1-64 (default 16)");
+
+static int nobj = 8192;
+module_param(nobj, int, 0);
+MODULE_PARM_DESC(nobj, "# of objects held to measure the memory per object (default 8192)");
+
+/* The same 'demo' structure as in ch9/slab_custom */
+struct myctx {
+	u32 iarr[10];
+	u64 uarr[10];
+	char uname[128], passwd[16], config[64];
+};
+
+static const struct {
+	slab_flags_t flag;
+	const char *name;
+} flagtbl[] = {
+	{ SLAB_POISON, "POISON" },
+	{ SLAB_RED_ZONE, "RED_ZONE" },
+	{ SLAB_HWCACHE_ALIGN, "HWCACHE_ALIGN" },
+	{ SLAB_STORE_USER, "STORE_USER" },
+};
+#define NR_FLAGS	ARRAY_SIZE(flagtbl)
+#define MAX_BATCH	64
+
+/* slab_custom's constructor, minus the printk */
+static void our_ctor(void *new)
+{
+	struct myctx *ctx = new;
+	struct task_struct *p = current;
+
+	memset(ctx, 0, sizeof(struct myctx));
+	snprintf(ctx->config, 6 * sizeof(u64) + 5, "%d.%d,%ld.%ld,%ld,%ld",
+		 p->tgid, p->pid, p->nvcsw, p->nivcsw, p->min_flt, p->maj_flt);
+}
+
+/* Bytes of unreclaimable slab memory, system-wide */
+static unsigned long slab_bytes(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	return global_node_page_state_pages(NR_SLAB_UNRECLAIMABLE_B) << PAGE_SHIFT;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+	return global_node_page_state(NR_SLAB_UNRECLAIMABLE) << PAGE_SHIFT;
+#else
+	return global_page_state(NR_SLAB_UNRECLAIMABLE) << PAGE_SHIFT;
+#endif
+}
+
+static int cmp_ptr(const void *a, const void *b)
+{
+	unsigned long x = *(unsigned long *)a, y = *(unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The timed workload: alloc and free 'iters' objects, 'batch' at a time */
+static u64 run_workload(struct kmem_cache *cachep)
+{
+	void *objs[MAX_BATCH];
+	u64 t0 = ktime_get_ns();
+	int i, j;
+
+	for (i = 0; i < iters; i += batch) {
+		for (j = 0; j < batch; j++)
+			objs[j] = kmem_cache_alloc(cachep, GFP_KERNEL);
+		for (j = 0; j < batch; j++)
+			if (objs[j])
+				kmem_cache_free(cachep, objs[j]);
+		cond_resched();
+	}
+	return ktime_get_ns() - t0;
+}
+
+/*
+ * Hold 'nobj' objects; the smallest distance between two of them is the
+ * object stride, and the slab memory growth / nobj, the actual per-object
+ * memory cost. @ptrs has room for 'nobj' pointers.
+ */
+static void measure_mem(struct kmem_cache *cachep, unsigned long *ptrs,
+			unsigned long *stride, unsigned long *per_obj)
+{
+	unsigned long before, after, d;
+	int i, n;
+
+	before = slab_bytes();
+	for (n = 0; n < nobj; n++) {
+		ptrs[n] = (unsigned long)kmem_cache_alloc(cachep, GFP_KERNEL);
+		if (!ptrs[n])
+			break;
+	}
+	after = slab_bytes();
+	*per_obj = (n && after > before) ? (after - before) / n : 0;
+
+	sort(ptrs, n, sizeof(ptrs[0]), cmp_ptr, NULL);
+	*stride = ULONG_MAX;
+	for (i = 1; i < n; i++) {
+		d = ptrs[i] - ptrs[i - 1];
+		if (d && d < *stride)
+			*stride = d;
+	}
+	if (*stride == ULONG_MAX)
+		*stride = 0;
+	for (i = 0; i < n; i++)
+		kmem_cache_free(cachep, (void *)ptrs[i]);
+}
+
+static int run_bench(void)
+{
+	struct kmem_cache *cachep;
+	unsigned long *ptrs, stride, per_obj;
+	slab_flags_t flags;
+	char name[64], fstr[64];
+	int combo, ctor, f, len;
+	u64 ns;
+
+	ptrs = kvmalloc_array(nobj, sizeof(*ptrs), GFP_KERNEL);
+	if (!ptrs)
+		return -ENOMEM;
+
+	pr_info("sizeof(struct myctx) = %zu; %d alloc/free pairs (%d at a time), %d objects held\n",
+		sizeof(struct myctx), iters, batch, nobj);
+	pr_info("%-40s %4s %8s %8s %10s %10s\n", "flags", "ctor", "ns/pair", "objsize",
+		"stride", "mem/obj");
+
+	for (ctor = 0; ctor <= 1; ctor++) {
+		for (combo = 0; combo < (1 << NR_FLAGS); combo++) {
+			flags = 0;
+			len = 0;
+			fstr[0] = '\0';
+			for (f = 0; f < NR_FLAGS; f++) {
+				if (!(combo & (1 << f)))
+					continue;
+				flags |= flagtbl[f].flag;
+				len += scnprintf(fstr + len, sizeof(fstr) - len, "%s%s",
+						 len ? "|" : "", flagtbl[f].name);
+			}
+			if (!len)
+				strscpy(fstr, "(none)", sizeof(fstr));
+
+			snprintf(name, sizeof(name), "%s-%d-%d", OURMODNAME, combo, ctor);
+#ifdef SLAB_NO_MERGE
+			/* else, a 'plain' cache could be merged with an existing one */
+			flags |= SLAB_NO_MERGE;
+#endif
+			cachep = kmem_cache_create(name, sizeof(struct myctx), sizeof(long),
+						   flags, ctor ? our_ctor : NULL);
+			if (!cachep) {
+				pr_warn("kmem_cache_create(%s) failed\n", name);
+				continue;
+			}
+
+			run_workload(cachep);	/* warm up */
+			ns = run_workload(cachep);
+			measure_mem(cachep, ptrs, &stride, &per_obj);
+
+			pr_info("%-40s %4d %8llu %8u %10lu %10lu\n", fstr, ctor,
+				div_u64(ns, iters), kmem_cache_size(cachep), stride, per_obj);
+			kmem_cache_destroy(cachep);
+		}
+	}
+	kvfree(ptrs);
+	return 0;
+}
+
+static int __init slab_flags_bench_init(void)
+{
+	if (iters <= 0 || batch < 1 || batch > MAX_BATCH || nobj < 2) {
+		pr_warn("invalid parameter(s): iters=%d, batch=%d (1-%d), nobj=%d (>= 2)\n",
+			iters, batch, MAX_BATCH, nobj);
+		return -EINVAL;
+	}
+	pr_info("inserted\n");
+	return run_bench();
+}
+
+static void __exit slab_flags_bench_exit(void)
+{
+	pr_info("removed\n");
+}
+
+module_init(slab_flags_bench_init);
+module_exit(slab_flags_bench_exit);
@@ -13,6 +13,19 @@
  * Brief Description:
  * A simple demo of using the vmalloc() and friends...
  *
+ * With bench=1, we also benchmark them (results in the kernel log):
+ *  a) alloc and free latency of kmalloc(), kvmalloc() and vmalloc(), for
+ *     sizes from 4 KB up to bench_max_kb KB;
+ *  b) the size at which kvmalloc() switches from kmalloc() to vmalloc() on
+ *     this kernel (it does so when kmalloc(), tried with __GFP_NORETRY, fails;
+ *     so, the answer also depends on how fragmented memory is right now);
+ *  c) the access cost - a sequential and a random (pointer chasing) walk over
+ *     a walk_mb MB buffer - of vmalloc() memory (mapped with 4K pages) vs
+ *     direct-mapped memory (which the kernel maps with large pages where it
+ *     can). To keep the comparison fair, both buffers are accessed via the
+ *     same code, as an array of (4 MB or max order) chunks; the difference
+ *     is mostly the TLB miss penalty.
+ *
  * For details, please refer the book, Ch 9.
  */
 #define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
@@ -24,16 +37,37 @@
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/version.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/log2.h>
+#include <linux/sizes.h>
+#include "../../klib_llkd.h"	/* LLKD_NR_ORDERS */
 
 MODULE_AUTHOR("Kaiwan N Billimoria");
 MODULE_DESCRIPTION("LKP book:ch9/vmalloc_demo/: simple vmalloc() and friends demo lkm");
 MODULE_LICENSE("Dual MIT/GPL");
-MODULE_VERSION("0.1");
+MODULE_VERSION("0.2");
 
 static int kvnum = 5 * 1024 * 1024;	// 5 MB
 module_param(kvnum, int, 0644);
 MODULE_PARM_DESC(kvnum, "number of bytes to allocate with the kvmalloc(); (defaults to 5 MB)");
 
+static bool bench;
+module_param(bench, bool, 0644);
+MODULE_PARM_DESC(bench, "also run the alloc latency / kvmalloc switch / access cost benchmark (default 0)");
+
+static int bench_max_kb = 4096;
+module_param(bench_max_kb, int, 0644);
+MODULE_PARM_DESC(bench_max_kb, "bench: the largest allocation size, in KB (defaults to 4096)");
+
+static int bench_iters = 100;
+module_param(bench_iters, int, 0644);
+MODULE_PARM_DESC(bench_iters, "bench: # of alloc/free pairs per API and size (defaults to 100)");
+
+static int walk_mb = 64;
+module_param(walk_mb, int, 0644);
+MODULE_PARM_DESC(walk_mb, "bench: size of the buffers walked, in MB (defaults to 64)");
+
 #define KVN_MIN_BYTES   16
 #define DISP_BYTES      16
 
@@ -144,8 +178,281 @@ static int vmalloc_try(void)
 	return -ENOMEM;
 }
 
+/*------------------------------ The benchmark -----------------------------*/
+#define BENCH_GFP	(GFP_KERNEL | __GFP_NOWARN)
+enum { API_KMALLOC, API_KVMALLOC, API_VMALLOC, NR_APIS };
+static const char * const api_name[NR_APIS] = { "kmalloc", "kvmalloc", "vmalloc" };
+
+static void *api_alloc(int api, size_t sz)
+{
+	switch (api) {
+	case API_KMALLOC:
+		return sz <= KMALLOC_MAX_SIZE ? kmalloc(sz, BENCH_GFP) : NULL;
+	case API_KVMALLOC:
+		return kvmalloc(sz, BENCH_GFP);
+	}
+	return vmalloc(sz);
+}
+
+static void api_free(int api, void *p)
+{
+	if (api == API_KMALLOC)
+		kfree(p);
+	else
+		kvfree(p);
+}
+
+/* a) alloc and free latency per API, across sizes */
+static void bench_latency(void)
+{
+	u64 t0, alloc_ns[NR_APIS], free_ns[NR_APIS];
+	int api, i, n[NR_APIS];
+	char cell[NR_APIS][24];
+	size_t sz;
+	void *p;
+
+	pr_info("alloc/free latency (avg ns over %d pairs); '-' : failed\n", bench_iters);
+	pr_info("%10s  %17s  %17s  %17s\n", "size (KB)", "kmalloc", "kvmalloc", "vmalloc");
+	for (sz = PAGE_SIZE; sz <= (size_t)bench_max_kb * 1024; sz <<= 1) {
+		for (api = 0; api < NR_APIS; api++) {
+			alloc_ns[api] = free_ns[api] = 0;
+			n[api] = 0;
+			for (i = 0; i < bench_iters; i++) {
+				t0 = ktime_get_ns();
+				p = api_alloc(api, sz);
+				if (!p)
+					break;
+				alloc_ns[api] += ktime_get_ns() - t0;
+				t0 = ktime_get_ns();
+				api_free(api, p);
+				free_ns[api] += ktime_get_ns() - t0;
+				n[api]++;
+			}
+			if (n[api])
+				snprintf(cell[api], sizeof(cell[api]), "%8llu/%-8llu",
+					 div_u64(alloc_ns[api], n[api]), div_u64(free_ns[api], n[api]));
+			else
+				strscpy(cell[api], "-", sizeof(cell[api]));
+			cond_resched();
+		}
+		pr_info("%10zu  %17s  %17s  %17s\n", sz >> 10, cell[0], cell[1], cell[2]);
+	}
+}
+
+/* Does kvmalloc(@sz) give us vmalloc memory? (-1 if it failed) */
+static int kvmalloc_is_vmalloc(size_t sz)
+{
+	void *p = kvmalloc(sz, BENCH_GFP);
+	int ret;
+
+	if (!p)
+		return -1;
+	ret = is_vmalloc_addr(p);
+	kvfree(p);
+	return ret;
+}
+
+/* b) the size at which kvmalloc() switches to vmalloc() */
+static void bench_kvmalloc_switch(void)
+{
+	size_t lo, hi = PAGE_SIZE, mid, limit = max_t(size_t, (size_t)bench_max_kb * 1024,
+						       2 * KMALLOC_MAX_SIZE);
+
+	/* double until it's vmalloc memory; then binary search, in pages */
+	while (hi <= limit && kvmalloc_is_vmalloc(hi) != 1)
+		hi <<= 1;
+	if (hi > limit) {
+		pr_info("kvmalloc(): no switch to vmalloc() seen up to %zu KB\n", limit >> 10);
+		return;
+	}
+	lo = hi >> 1;
+	while (hi - lo > PAGE_SIZE) {
+		mid = lo + ((hi - lo) / 2 & PAGE_MASK);
+		if (kvmalloc_is_vmalloc(mid) == 1)
+			hi = mid;
+		else
+			lo = mid;
+	}
+	pr_info("kvmalloc(): switches to vmalloc() above %zu KB (at %zu KB); KMALLOC_MAX_SIZE = %lu KB\n",
+		lo >> 10, hi >> 10, (unsigned long)KMALLOC_MAX_SIZE >> 10);
+}
+
+/* c) the access cost. A buffer is an array of equal-sized chunks */
+struct walkbuf {
+	void **chunk;
+	int nr_chunks, chunk_shift;
+	struct page **pages;	/* direct-mapped: the chunks' pages, NULL for vmalloc */
+	void *vbuf;
+};
+
+static inline u64 *wb_addr(const struct walkbuf *wb, size_t off)
+{
+	return (u64 *)(wb->chunk[off >> wb->chunk_shift] + (off & ((1UL << wb->chunk_shift) - 1)));
+}
+
+static void wb_free(struct walkbuf *wb)
+{
+	int i;
+
+	if (wb->pages) {
+		for (i = 0; i < wb->nr_chunks; i++)
+			if (wb->pages[i])
+				__free_pages(wb->pages[i], wb->chunk_shift - PAGE_SHIFT);
+		kvfree(wb->pages);
+	}
+	vfree(wb->vbuf);
+	kvfree(wb->chunk);
+}
+
+static int wb_alloc(struct walkbuf *wb, size_t size, int order, bool direct)
+{
+	int i;
+
+	memset(wb, 0, sizeof(*wb));
+	wb->chunk_shift = PAGE_SHIFT + order;
+	wb->nr_chunks = size >> wb->chunk_shift;
+	wb->chunk = kvcalloc(wb->nr_chunks, sizeof(void *), GFP_KERNEL);
+	if (!wb->chunk)
+		return -ENOMEM;
+	if (!direct) {
+		wb->vbuf = vmalloc(size);
+		if (!wb->vbuf)
+			goto err;
+		for (i = 0; i < wb->nr_chunks; i++)
+			wb->chunk[i] = wb->vbuf + ((size_t)i << wb->chunk_shift);
+		return 0;
+	}
+	wb->pages = kvcalloc(wb->nr_chunks, sizeof(struct page *), GFP_KERNEL);
+	if (!wb->pages)
+		goto err;
+	for (i = 0; i < wb->nr_chunks; i++) {
+		wb->pages[i] = alloc_pages(BENCH_GFP | __GFP_NORETRY, order);
+		if (!wb->pages[i])
+			goto err;
+		wb->chunk[i] = page_address(wb->pages[i]);
+	}
+	return 0;
+ err:
+	wb_free(wb);
+	return -ENOMEM;
+}
+
+/* Link all cache lines of @wb into one random cycle (Sattolo's algorithm) */
+static void wb_link_random(struct walkbuf *wb, u32 *perm, size_t nlines)
+{
+	u64 x = get_random_u32() | 1;
+	size_t i, j;
+	u32 tmp;
+
+	for (i = 0; i < nlines; i++)
+		perm[i] = i;
+	for (i = nlines - 1; i > 0; i--) {
+		x ^= x << 13;	/* xorshift64: cheap, and good enough here */
+		x ^= x >> 7;
+		x ^= x << 17;
+		j = x % i;
+		tmp = perm[i];
+		perm[i] = perm[j];
+		perm[j] = tmp;
+	}
+	for (i = 0; i < nlines; i++)
+		*wb_addr(wb, (size_t)perm[i] * L1_CACHE_BYTES) =
+			(u64)perm[(i + 1) % nlines] * L1_CACHE_BYTES;
+}
+
+/* Sequential walk: read one word per cache line; returns ns per line */
+static u64 wb_walk_seq(const struct walkbuf *wb, size_t nlines)
+{
+	u64 t0, sum = 0;
+	size_t i;
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < nlines; i++)
+		sum += READ_ONCE(*wb_addr(wb, i * L1_CACHE_BYTES));
+	t0 = ktime_get_ns() - t0;
+	pr_debug("seq sum %llu\n", sum);	/* keep the compiler from eliding the loop */
+	return div_u64(t0, nlines);
+}
+
+/* Random walk: chase the pointers through all lines; returns ns per access */
+static u64 wb_walk_random(const struct walkbuf *wb, size_t nlines)
+{
+	u64 t0, off = 0;
+	size_t i;
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < nlines; i++)
+		off = READ_ONCE(*wb_addr(wb, off));
+	t0 = ktime_get_ns() - t0;
+	pr_debug("chase end %llu\n", off);
+	return div_u64(t0, nlines);
+}
+
+static void bench_access(void)
+{
+	struct walkbuf wb[2];		/* [0] : direct-mapped, [1] : vmalloc */
+	size_t size = (size_t)walk_mb << 20, nlines = size / L1_CACHE_BYTES;
+	int order = min_t(int, LLKD_NR_ORDERS - 1, ilog2(SZ_4M) - PAGE_SHIFT), i;
+	u64 seq[2], rnd[2], ratio;
+	u32 *perm, rem;
+
+	if ((size >> (PAGE_SHIFT + order)) == 0 || nlines > U32_MAX) {
+		pr_warn("walk_mb (%d) must be >= %lu MB\n", walk_mb, (PAGE_SIZE << order) >> 20);
+		return;
+	}
+	size = round_down(size, PAGE_SIZE << order);
+	nlines = size / L1_CACHE_BYTES;
+
+	perm = vmalloc(array_size(nlines, sizeof(u32)));
+	if (!perm)
+		return;
+	for (i = 0; i < 2; i++) {
+		if (wb_alloc(&wb[i], size, order, i == 0) < 0) {
+			pr_warn("couldn't allocate the %s %zu MB buffer\n",
+				i == 0 ? "direct-mapped" : "vmalloc", size >> 20);
+			if (i)
+				wb_free(&wb[0]);
+			vfree(perm);
+			return;
+		}
+	}
+	for (i = 0; i < 2; i++) {
+		wb_link_random(&wb[i], perm, nlines);
+		wb_walk_seq(&wb[i], nlines);	/* warm up (and fault in) */
+		seq[i] = wb_walk_seq(&wb[i], nlines);
+		rnd[i] = wb_walk_random(&wb[i], nlines);
+		cond_resched();
+	}
+	pr_info("access cost over %zu MB (%zu lines of %d bytes; chunks of %lu KB):\n",
+		size >> 20, nlines, L1_CACHE_BYTES, (PAGE_SIZE << order) >> 10);
+	pr_info("%16s  %14s  %14s\n", "memory", "seq ns/line", "random ns/line");
+	pr_info("%16s  %14llu  %14llu\n", "direct-mapped", seq[0], rnd[0]);
+	pr_info("%16s  %14llu  %14llu\n", "vmalloc", seq[1], rnd[1]);
+	if (rnd[0]) {
+		ratio = div_u64_rem(div64_u64(rnd[1] * 100, rnd[0]), 100, &rem);
+		pr_info("vmalloc random access penalty: %llu.%02ux\n", ratio, rem);
+	}
+
+	wb_free(&wb[1]);
+	wb_free(&wb[0]);
+	vfree(perm);
+}
+
+static void vmalloc_bench(void)
+{
+	if (bench_max_kb < 4 || bench_iters < 1 || walk_mb < 1) {
+		pr_warn("invalid bench parameter(s)\n");
+		return;
+	}
+	bench_latency();
+	bench_kvmalloc_switch();
+	bench_access();
+}
+
 static int __init vmalloc_demo_init(void)
 {
+	int ret;
+
 	if (kvnum < KVN_MIN_BYTES) {
 		pr_info("kvnum must be >= %d bytes (curr it's %d bytes)\n", KVN_MIN_BYTES,
 			kvnum);
@@ -153,7 +460,10 @@ static int __init vmalloc_demo_init(void)
 	}
 	pr_info("inserted\n");
 
-	return vmalloc_try();
+	ret = vmalloc_try();
+	if (!ret && bench)
+		vmalloc_bench();
+	return ret;
 }
 
 static void __exit vmalloc_demo_exit(void)
@@ -16,6 +16,11 @@
  * For details, please refer the book.
  */
 #include "klib_llkd.h"
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/seq_file.h>
 
 /* llkd_minsysinfo:
  * Similar to our ch5/min_sysinfo code; it's just simpler (avoiding deps) to
@@ -143,6 +148,144 @@ void show_phy_pages(const void *kaddr, size_t len, bool contiguity_check)
 	}
 }
 
+/*
+ * Helpers for show_phy_pages_compact()
+ * kaddr_to_page - return the page structure backing the kernel virtual
+ * address @addr, for lowmem (direct-mapped), vmalloc and module addresses;
+ * NULL if it isn't mapped. Any other address (f.e. highmem kmap()-ed pages,
+ * the fixmap) can't be resolved here: *@resolvable is set to false and NULL
+ * returned. (We mustn't just try vmalloc_to_page() on it: on a
+ * CONFIG_DEBUG_VIRTUAL=y kernel that's a VIRTUAL_BUG_ON(), i.e., a BUG().)
+ */
+static struct page *kaddr_to_page(const void *addr, bool *resolvable)
+{
+	*resolvable = true;
+	if (is_vmalloc_addr(addr))
+		return vmalloc_to_page(addr);
+#ifdef MODULES_VADDR	/* else, modules live within the vmalloc region */
+	if ((unsigned long)addr >= MODULES_VADDR && (unsigned long)addr < MODULES_END)
+		return vmalloc_to_page(addr);
+#endif
+	if (virt_addr_valid(addr))
+		return virt_to_page(addr);
+	*resolvable = false;
+	return NULL;
+}
+
+struct phy_extent_out {
+	struct seq_file *seq;
+	char *buf;
+	size_t bufsz, off;
+};
+
+/* Emit one extent: to the seq_file, else the buffer, else the kernel log */
+static void emit_extent(struct phy_extent_out *out, const void *va, int npages,
+			unsigned long pfn, bool mapped)
+{
+#if(BITS_PER_LONG == 64)
+#define EXTENT_FMT	"0x%016lx-0x%016lx -> pfn 0x%lx-0x%lx (%d pages)\n"
+#define UNMAPPED_FMT	"0x%016lx-0x%016lx -> (not mapped) (%d pages)\n"
+#else
+#define EXTENT_FMT	"0x%08lx-0x%08lx -> pfn 0x%lx-0x%lx (%d pages)\n"
+#define UNMAPPED_FMT	"0x%08lx-0x%08lx -> (not mapped) (%d pages)\n"
+#endif
+	unsigned long start = (unsigned long)va, end = start + npages * PAGE_SIZE - 1;
+
+	/* Below we show the actual virt addr and not a hashed value, just as
+	 * show_phy_pages() does; don't do this in production
+	 */
+	if (out->seq) {
+		if (mapped)
+			seq_printf(out->seq, EXTENT_FMT, start, end, pfn, pfn + npages - 1, npages);
+		else
+			seq_printf(out->seq, UNMAPPED_FMT, start, end, npages);
+	} else if (out->buf) {
+		if (mapped)
+			out->off += scnprintf(out->buf + out->off, out->bufsz - out->off,
+					      EXTENT_FMT, start, end, pfn, pfn + npages - 1, npages);
+		else
+			out->off += scnprintf(out->buf + out->off, out->bufsz - out->off,
+					      UNMAPPED_FMT, start, end, npages);
+	} else {
+		if (mapped)
+			pr_info(EXTENT_FMT, start, end, pfn, pfn + npages - 1, npages);
+		else
+			pr_info(UNMAPPED_FMT, start, end, npages);
+	}
+}
+
+/*
+ * show_phy_pages_compact - a compact, low-overhead version of show_phy_pages().
+ * Instead of a line per page, physically contiguous runs of pages are
+ * coalesced into 'extents', shown as:
+ *    va-start - va-end -> pfn pfn-start - pfn-end (N pages)
+ * Thus a physically contiguous buffer of any size shows up as a single line.
+ *
+ * Unlike show_phy_pages(), it isn't restricted to 'lowmem' addresses: vmalloc
+ * (and module) addresses are resolved via vmalloc_to_page() and
+ * page_to_pfn() (see kaddr_to_page() above). Pages at addresses that can't
+ * be resolved (neither lowmem, vmalloc nor module space) are skipped.
+ *
+ * @kaddr: the starting kernel virtual address (rounded down to a page)
+ * @len: length of the memory piece (bytes)
+ * @seq: if non-NULL, the output's written into this seq_file ...
+ * @buf, @bufsz: ... else, if @buf is non-NULL, into this buffer (output
+ *        beyond @bufsz bytes is truncated; it's always NUL-terminated) ...
+ *        else, as a last resort, to the kernel log.
+ * Returns the # of extents found.
+ */
+int show_phy_pages_compact(const void *kaddr, size_t len, struct seq_file *seq,
+			   char *buf, size_t bufsz)
+{
+	struct phy_extent_out out = { .seq = seq, .buf = buf, .bufsz = bufsz };
+	const void *va = (const void *)((unsigned long)kaddr & PAGE_MASK);
+	const void *run_va = va;
+	unsigned long pfn, run_pfn = 0;
+	struct page *pg;
+	bool mapped, run_mapped = false, resolvable;
+	int loops, i, run_len = 0, nr_extents = 0;
+
+	loops = DIV_ROUND_UP(len + offset_in_page(kaddr), PAGE_SIZE);
+	if (buf && bufsz)
+		buf[0] = '\0';
+	if (!len || (buf && !bufsz))
+		return 0;
+
+	for (i = 0; i < loops; i++, va += PAGE_SIZE) {
+		pg = kaddr_to_page(va, &resolvable);
+		if (!resolvable) {	/* skip it, ending the current run */
+			if (run_len) {
+				emit_extent(&out, run_va, run_len, run_pfn, run_mapped);
+				nr_extents++;
+			}
+			run_len = 0;
+			continue;
+		}
+		mapped = !!pg;
+		pfn = mapped ? page_to_pfn(pg) : 0;
+
+		/* extend the current run? */
+		if (run_len && mapped == run_mapped &&
+		    (!mapped || pfn == run_pfn + run_len)) {
+			run_len++;
+			continue;
+		}
+		if (run_len) {
+			emit_extent(&out, run_va, run_len, run_pfn, run_mapped);
+			nr_extents++;
+		}
+		run_va = va;
+		run_pfn = pfn;
+		run_mapped = mapped;
+		run_len = 1;
+	}
+	if (run_len) {
+		emit_extent(&out, run_va, run_len, run_pfn, run_mapped);
+		nr_extents++;
+	}
+	return nr_extents;
+}
+
 /*
  * powerof - a simple 'library' function to calculate and return
  *  @base to-the-power-of @exponent
@@ -183,3 +326,227 @@ void show_sizeof(void)
 		sizeof(long), sizeof(long long), sizeof(void *),
 		sizeof(float), sizeof(double), sizeof(long double));
 }
+
+/*
+ * Buddy System Allocator (BSA) free-list snapshots and fragmentation indices.
+ *
+ * llkd_frag_snapshot() captures, for every populated zone on every online
+ * node, the count of free blocks at each order - the same data that
+ * /proc/buddyinfo shows. From such a snapshot we compute, per order, the
+ * same two indices the kernel shows in debugfs (extfrag/unusable_index and
+ * extfrag/extfrag_index):
+ *  - the 'unusable free space index': the fraction (in 1/1000ths) of free
+ *    memory that can't satisfy an allocation of that order as it's in
+ *    smaller blocks; 0 => all free memory is usable, 1000 => none is.
+ *  - the 'fragmentation index': meaningful only when an allocation of that
+ *    order would fail; towards 0 => failure due to lack of memory, towards
+ *    1000 => due to fragmentation. -1000 => the allocation would succeed.
+ * Take a snapshot before and after a workload and call
+ * llkd_frag_show_delta() to see how it affected fragmentation, or have it
+ * done periodically via llkd_frag_timer_start().
+ */
+
+/*
+ * llkd_frag_snapshot - snapshot the per-zone, per-order free block counts.
+ * @snap: the snapshot structure to fill in (it's large-ish, ~4 KB; best to
+ *        allocate it dynamically)
+ * Returns the # of zones captured, or -ENOSPC if there were more than
+ * LLKD_FRAG_MAXZONES populated zones (the first LLKD_FRAG_MAXZONES are kept).
+ */
+int llkd_frag_snapshot(struct llkd_frag_snap *snap)
+{
+	struct llkd_zone_frag *zf;
+	struct zone *zone;
+	unsigned long flags;
+	int nid, z, order;
+
+	memset(snap, 0, sizeof(*snap));
+	snap->ts = ktime_get();
+	for_each_online_node(nid) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		for (z = 0; z < MAX_NR_ZONES; z++) {
+			zone = &pgdat->node_zones[z];
+			if (!populated_zone(zone))
+				continue;
+			if (snap->nr_zones == LLKD_FRAG_MAXZONES)
+				return -ENOSPC;
+			zf = &snap->zone[snap->nr_zones++];
+			zf->nid = nid;
+			zf->name = zone->name;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+			zf->managed = zone_managed_pages(zone);
+#else
+			zf->managed = zone->managed_pages;
+#endif
+			/* just as /proc/buddyinfo does, read the counts under the zone lock */
+			spin_lock_irqsave(&zone->lock, flags);
+			for (order = 0; order < LLKD_NR_ORDERS; order++)
+				zf->nr_free[order] = zone->free_area[order].nr_free;
+			spin_unlock_irqrestore(&zone->lock, flags);
+		}
+	}
+	return snap->nr_zones;
+}
+
+/* Sum up what's free in (and what's suitable for) an allocation of @order */
+static void frag_info(const struct llkd_zone_frag *zf, unsigned int order,
+		      u64 *free_pages, u64 *blocks_total, u64 *blocks_suitable)
+{
+	unsigned int o;
+
+	*free_pages = *blocks_total = *blocks_suitable = 0;
+	for (o = 0; o < LLKD_NR_ORDERS; o++) {
+		*blocks_total += zf->nr_free[o];
+		*free_pages += (u64)zf->nr_free[o] << o;
+		if (o >= order)
+			*blocks_suitable += (u64)zf->nr_free[o] << (o - order);
+	}
+}
+
+/*
+ * llkd_frag_unusable_index - the unusable free space index (0..1000) of
+ * zone @zf for an allocation of @order.
+ */
+int llkd_frag_unusable_index(const struct llkd_zone_frag *zf, unsigned int order)
+{
+	u64 free_pages, blocks_total, blocks_suitable;
+
+	frag_info(zf, order, &free_pages, &blocks_total, &blocks_suitable);
+	if (!free_pages)
+		return 1000;
+	return div64_u64((free_pages - (blocks_suitable << order)) * 1000ULL, free_pages);
+}
+
+/*
+ * llkd_frag_extfrag_index - the (external) fragmentation index (0..1000) of
+ * zone @zf for an allocation of @order; -1000 if it would succeed.
+ */
+int llkd_frag_extfrag_index(const struct llkd_zone_frag *zf, unsigned int order)
+{
+	u64 free_pages, blocks_total, blocks_suitable;
+
+	frag_info(zf, order, &free_pages, &blocks_total, &blocks_suitable);
+	if (!blocks_total)
+		return 0;
+	if (blocks_suitable)
+		return -1000;
+	return 1000 - (int)div64_u64(1000 + div64_u64(free_pages * 1000ULL, 1UL << order),
+				     blocks_total);
+}
+
+#define FRAG_LINELEN   (16 + LLKD_NR_ORDERS * 8)
+
+/*
+ * llkd_frag_show - display the snapshot @snap: per zone, the free blocks per
+ * order (as /proc/buddyinfo does) along with both indices per order.
+ */
+void llkd_frag_show(const struct llkd_frag_snap *snap)
+{
+	const struct llkd_zone_frag *zf;
+	char buf[3][FRAG_LINELEN];
+	int z, o, n[3];
+
+	pr_info("%s(): BSA snapshot @ %lld ms; per order 0..%d:\n",
+		__func__, ktime_to_ms(snap->ts), LLKD_NR_ORDERS - 1);
+	for (z = 0; z < snap->nr_zones; z++) {
+		zf = &snap->zone[z];
+		n[0] = snprintf(buf[0], FRAG_LINELEN, " free blocks :");
+		n[1] = snprintf(buf[1], FRAG_LINELEN, " unusable idx:");
+		n[2] = snprintf(buf[2], FRAG_LINELEN, " extfrag idx :");
+		for (o = 0; o < LLKD_NR_ORDERS; o++) {
+			n[0] += scnprintf(buf[0] + n[0], FRAG_LINELEN - n[0], " %7lu",
+					  zf->nr_free[o]);
+			n[1] += scnprintf(buf[1] + n[1], FRAG_LINELEN - n[1], " %7d",
+					  llkd_frag_unusable_index(zf, o));
+			n[2] += scnprintf(buf[2] + n[2], FRAG_LINELEN - n[2], " %7d",
+					  llkd_frag_extfrag_index(zf, o));
+		}
+		pr_info("Node %d, zone %8s (managed pages %lu):\n%s\n%s\n%s\n",
+			zf->nid, zf->name, zf->managed, buf[0], buf[1], buf[2]);
+	}
+}
+
+/*
+ * llkd_frag_show_delta - display what changed between the snapshots @before
+ * and @after: per zone, the change in free blocks and in the unusable free
+ * space index, per order.
+ */
+void llkd_frag_show_delta(const struct llkd_frag_snap *before,
+			  const struct llkd_frag_snap *after)
+{
+	const struct llkd_zone_frag *zb, *za;
+	char buf[2][FRAG_LINELEN];
+	int z, o, n[2];
+
+	pr_info("%s(): BSA changes over %lld ms; per order 0..%d:\n", __func__,
+		ktime_to_ms(ktime_sub(after->ts, before->ts)), LLKD_NR_ORDERS - 1);
+	for (z = 0; z < min(before->nr_zones, after->nr_zones); z++) {
+		zb = &before->zone[z];
+		za = &after->zone[z];
+		if (zb->nid != za->nid || zb->name != za->name)
+			continue;	/* a node went on/offline in between; skip it */
+		n[0] = snprintf(buf[0], FRAG_LINELEN, " free blocks :");
+		n[1] = snprintf(buf[1], FRAG_LINELEN, " unusable idx:");
+		for (o = 0; o < LLKD_NR_ORDERS; o++) {
+			n[0] += scnprintf(buf[0] + n[0], FRAG_LINELEN - n[0], " %+7ld",
+					  (long)(za->nr_free[o] - zb->nr_free[o]));
+			n[1] += scnprintf(buf[1] + n[1], FRAG_LINELEN - n[1], " %+7d",
+					  llkd_frag_unusable_index(za, o) -
+					  llkd_frag_unusable_index(zb, o));
+		}
+		pr_info("Node %d, zone %8s:\n%s\n%s\n", za->nid, za->name, buf[0], buf[1]);
+	}
+}
+
+/* Periodic snapshots: each period, we show the delta from the previous one */
+static struct llkd_frag_snap *frag_prev, *frag_cur;
+static struct delayed_work frag_dwork;
+static unsigned int frag_period_ms;
+
+static void frag_work(struct work_struct *work)
+{
+	struct llkd_frag_snap *tmp;
+
+	llkd_frag_snapshot(frag_cur);
+	llkd_frag_show_delta(frag_prev, frag_cur);
+	tmp = frag_prev;
+	frag_prev = frag_cur;
+	frag_cur = tmp;
+	schedule_delayed_work(&frag_dwork, msecs_to_jiffies(frag_period_ms));
+}
+
+/*
+ * llkd_frag_timer_start - every @period_ms milliseconds, snapshot the BSA
+ * free lists and display the delta from the previous snapshot.
+ * Must be called from process context; call llkd_frag_timer_stop() to stop.
+ */
+int llkd_frag_timer_start(unsigned int period_ms)
+{
+	if (frag_prev || !period_ms)
+		return -EINVAL;
+	frag_prev = kzalloc(sizeof(*frag_prev), GFP_KERNEL);
+	frag_cur = kzalloc(sizeof(*frag_cur), GFP_KERNEL);
+	if (!frag_prev || !frag_cur) {
+		kfree(frag_prev);
+		kfree(frag_cur);
+		frag_prev = frag_cur = NULL;
+		return -ENOMEM;
+	}
+	frag_period_ms = period_ms;
+	llkd_frag_snapshot(frag_prev);
+	llkd_frag_show(frag_prev);
+	INIT_DELAYED_WORK(&frag_dwork, frag_work);
+	schedule_delayed_work(&frag_dwork, msecs_to_jiffies(frag_period_ms));
+	return 0;
+}
+
+void llkd_frag_timer_stop(void)
+{
+	if (!frag_prev)
+		return;
+	cancel_delayed_work_sync(&frag_dwork);
+	kfree(frag_prev);
+	kfree(frag_cur);
+	frag_prev = frag_cur = NULL;
+}
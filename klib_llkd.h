@@ -22,10 +22,52 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <asm/io.h>		/* virt_to_phys(), phys_to_virt(), ... */
+#include <linux/mmzone.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
 
 void llkd_minsysinfo(void);
 u64 powerof(int base, int exponent);
 void show_phy_pages(const void *kaddr, size_t len, bool contiguity_check);
+struct seq_file;
+int show_phy_pages_compact(const void *kaddr, size_t len, struct seq_file *seq,
+			   char *buf, size_t bufsz);
 void show_sizeof(void);
 
+/*--- Buddy allocator free-list snapshots and fragmentation indices ---*/
+/* The # of page allocator orders; the meaning of MAX_ORDER changed in 6.4
+ * (it became inclusive) and it was renamed to MAX_PAGE_ORDER in 6.8
+ */
+#if defined(NR_PAGE_ORDERS)
+#define LLKD_NR_ORDERS   NR_PAGE_ORDERS
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+#define LLKD_NR_ORDERS   (MAX_ORDER + 1)
+#else
+#define LLKD_NR_ORDERS   MAX_ORDER
+#endif
+
+#define LLKD_FRAG_MAXZONES   32
+
+struct llkd_zone_frag {
+	int nid;
+	const char *name;		/* the zone name: DMA, DMA32, Normal, ... */
+	unsigned long managed;		/* # of pages managed by the BSA */
+	unsigned long nr_free[LLKD_NR_ORDERS];	/* free blocks per order */
+};
+
+struct llkd_frag_snap {
+	ktime_t ts;
+	int nr_zones;
+	struct llkd_zone_frag zone[LLKD_FRAG_MAXZONES];
+};
+
+int llkd_frag_snapshot(struct llkd_frag_snap *snap);
+int llkd_frag_unusable_index(const struct llkd_zone_frag *zf, unsigned int order);
+int llkd_frag_extfrag_index(const struct llkd_zone_frag *zf, unsigned int order);
+void llkd_frag_show(const struct llkd_frag_snap *snap);
+void llkd_frag_show_delta(const struct llkd_frag_snap *before,
+			  const struct llkd_frag_snap *after);
+int llkd_frag_timer_start(unsigned int period_ms);
+void llkd_frag_timer_stop(void);
+
 #endif
@@ -0,0 +1,767 @@
+/*
+ * solutions_to_assgn/ch9/slab_sizeclass/slab_sizeclass.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 9 : Kernel Memory Allocation for Module Authors Part 2
+ ****************************************************************
+ * Brief Description:
+ * Taking our slab_custom_mult assignment solution further: instead of 100
+ * custom caches of (i+1)*xfactor bytes that are used just once, we build a
+ * working *size-classed allocator* out of a set of custom slab caches:
+ *
+ *  void *sc_alloc(size_t size, gfp_t gfp);
+ *  void sc_free(void *ptr, size_t size);	// a 'sized' free
+ *
+ * The size classes are chosen either
+ *  - geometrically: from min_size up to max_size, each class growth_pct %
+ *    larger than the previous one (rounded up to 8 bytes), or
+ *  - from a histogram of your allocation sizes (the 'hist' parameter, or a
+ *    trace loaded at runtime, see below): given at most nclasses classes, we
+ *    pick the class sizes that minimize the total waste for that histogram
+ *    (a simple dynamic programming solution; it's optimal).
+ * Requests are routed to the tightest class in O(1) via a lookup table
+ * indexed by (size / 8); those beyond the largest class fall back to
+ * kmalloc(). Per class, we track the occupancy (live objects and bytes) and
+ * the waste (the class size minus the bytes requested).
+ *
+ * The debugfs interface (under /sys/kernel/debug/slab_sizeclass/):
+ *  trace   : (write) an allocation-size trace; each line is either
+ *            'size [count]', or an ftrace kmem:kmalloc event line (we use
+ *            it's bytes_req= field); each open+write replaces the trace
+ *  classes : (read) the size classes and their stats
+ *            (write) 'geo'   : rebuild the classes geometrically
+ *                    'trace' : rebuild the classes from the trace's histogram
+ *            (the class parameters are fixed at load time)
+ *  bench   : (write) replay the trace against our allocator and kmalloc(),
+ *            keeping up to 'window' objects live (FIFO); (read) the results
+ *
+ * For details, please refer the book, Ch 9.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
+
+#define OURMODNAME   "slab_sizeclass"
+#define OURCACHENAME "sizeclass"
+
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_DESCRIPTION("LKP book:solutions_to_assgn/ch9/slab_sizeclass: a size-classed allocator");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+#define SC_ALIGN	8
+#define MAX_CLASSES	64
+#define MAX_SIZE_LIMIT	(16 * 1024)	/* keeps the histogram DP fast */
+
+/*
+ * The class parameters are validated once, at init, and used unlocked all
+ * over (the bucket count, the DP's array bounds), so they're read-only.
+ */
+
+static int nclasses = 16;
+module_param(nclasses, int, 0444);
+MODULE_PARM_DESC(nclasses, "histogram classes: max # of size classes, 1-64 [def=16]");
+
+static int min_size = 16;
+module_param(min_size, int, 0444);
+MODULE_PARM_DESC(min_size, "geometric classes: the smallest class size [def=16]");
+
+static int max_size = 8192;
+module_param(max_size, int, 0444);
+MODULE_PARM_DESC(max_size, "the largest class size; larger requests go to kmalloc() [def=8192, max 16384]");
+
+static int growth_pct = 25;
+module_param(growth_pct, int, 0444);
+MODULE_PARM_DESC(growth_pct, "geometric classes: growth from one class to the next, in % [def=25]");
+
+static char *hist;
+module_param(hist, charp, 0444);
+MODULE_PARM_DESC(hist, "build the classes from this histogram: \"size:count,size:count,...\"");
+
+static int window = 64;
+module_param(window, int, 0644);
+MODULE_PARM_DESC(window, "bench: max # of live objects while replaying the trace [def=64]");
+
+static int trace_max = 1024 * 1024;
+module_param(trace_max, int, 0444);
+MODULE_PARM_DESC(trace_max, "max # of allocations held in the trace [def=1M]");
+
+struct sc_class {
+	unsigned int size;
+	struct kmem_cache *cachep;
+	atomic_long_t allocs, live, live_req;	/* live_req: bytes requested by the live objects */
+	atomic64_t waste;			/* cumulative bytes wasted */
+};
+
+static struct sc_class classes[MAX_CLASSES];
+static int nr_classes;
+static u8 *lut;			/* (size + 7) / 8 -> class index */
+static unsigned int lut_max;	/* the largest class size */
+static atomic_long_t nr_fallback;
+
+static DEFINE_MUTEX(sc_mtx);	/* serializes class (re)builds, trace updates and bench runs */
+static u32 *trace;
+static int trace_len;
+static int trace_rejected;	/* lines too long, or sizes beyond KMALLOC_MAX_SIZE */
+static char *bench_results;
+static struct dentry *gparent;
+
+/*------------------------------ The allocator -----------------------------*/
+static inline struct sc_class *sc_lookup(size_t size)
+{
+	if (!size || size > lut_max)
+		return NULL;
+	return &classes[lut[(size + SC_ALIGN - 1) / SC_ALIGN]];
+}
+
+static void *sc_alloc(size_t size, gfp_t gfp)
+{
+	struct sc_class *c = sc_lookup(size);
+	void *p;
+
+	if (!c) {
+		atomic_long_inc(&nr_fallback);
+		return kmalloc(size, gfp);
+	}
+	p = kmem_cache_alloc(c->cachep, gfp);
+	if (likely(p)) {
+		atomic_long_inc(&c->allocs);
+		atomic_long_inc(&c->live);
+		atomic_long_add(size, &c->live_req);
+		atomic64_add(c->size - size, &c->waste);
+	}
+	return p;
+}
+
+/* @size must be the size passed to sc_alloc() */
+static void sc_free(void *ptr, size_t size)
+{
+	struct sc_class *c = sc_lookup(size);
+
+	if (!ptr)
+		return;
+	if (!c) {
+		kfree(ptr);
+		return;
+	}
+	kmem_cache_free(c->cachep, ptr);
+	atomic_long_dec(&c->live);
+	atomic_long_sub(size, &c->live_req);
+}
+
+/*------------------------- Building the size classes ----------------------*/
+static void destroy_classes(void)
+{
+	int i;
+
+	for (i = 0; i < nr_classes; i++)
+		kmem_cache_destroy(classes[i].cachep);
+	memset(classes, 0, sizeof(classes));
+	nr_classes = 0;
+	kfree(lut);
+	lut = NULL;
+	lut_max = 0;
+}
+
+/* (Re)create the caches for the (ascending, SC_ALIGN-ed) class @sizes; needs sc_mtx */
+static int install_classes(const unsigned int *sizes, int n)
+{
+	char nm[32];
+	unsigned int s;
+	int i, c;
+
+	for (i = 0; i < nr_classes; i++)
+		if (atomic_long_read(&classes[i].live)) {
+			pr_warn("class %u has live objects; can't rebuild now\n", classes[i].size);
+			return -EBUSY;
+		}
+	destroy_classes();
+
+	lut = kzalloc(sizes[n - 1] / SC_ALIGN + 1, GFP_KERNEL);
+	if (!lut)
+		return -ENOMEM;
+	for (i = 0; i < n; i++) {
+		snprintf(nm, sizeof(nm), "%s-%u", OURCACHENAME, sizes[i]);
+		classes[i].size = sizes[i];
+		classes[i].cachep = kmem_cache_create(nm, sizes[i], SC_ALIGN, 0, NULL);
+		if (!classes[i].cachep) {
+			pr_warn("kmem_cache_create(%s) failed\n", nm);
+			nr_classes = i;
+			destroy_classes();
+			return -ENOMEM;
+		}
+		nr_classes++;
+	}
+	/* the O(1) lookup table: each (size / 8) slot -> the tightest class */
+	for (s = 0, c = 0; s <= sizes[n - 1] / SC_ALIGN; s++) {
+		while (sizes[c] < s * SC_ALIGN)
+			c++;
+		lut[s] = c;
+	}
+	lut_max = sizes[n - 1];
+	return 0;
+}
+
+static int build_geometric(void)
+{
+	unsigned int sizes[MAX_CLASSES], s = ALIGN(min_size, SC_ALIGN);
+	int n = 0;
+
+	while (n < MAX_CLASSES - 1 && s < max_size) {
+		sizes[n++] = s;
+		s = ALIGN(max_t(unsigned int, s + 1, s * (100 + growth_pct) / 100), SC_ALIGN);
+	}
+	sizes[n++] = ALIGN(max_size, SC_ALIGN);
+	return install_classes(sizes, n);
+}
+
+/*
+ * build_from_hist()
+ * Given the histogram (@sz[], @cnt[]: @m distinct, ascending, SC_ALIGN-ed
+ * sizes), pick at most 'nclasses' class sizes minimizing the total waste.
+ * A class covering sizes i..j (1-based) is of size sz[j] and wastes
+ *   cost(i,j) = sz[j] * (C[j] - C[i-1]) - (W[j] - W[i-1])
+ * with C[] and W[] the prefix sums of the counts and of count*size. Then,
+ *   dp[k][j] = min over i of  dp[k-1][i-1] + cost(i,j)
+ * is the least waste covering sizes 1..j with k classes.
+ */
+static int build_from_hist(const unsigned int *sz, const u64 *cnt, int m)
+{
+	unsigned int sizes[MAX_CLASSES];
+	u64 *C, *W, *dp, v;
+	u16 *from;
+	int k, K = min(nclasses, m), i, j, ret = -ENOMEM;
+
+#define DP(k, j)	dp[(k) * (m + 1) + (j)]
+#define FROM(k, j)	from[(k) * (m + 1) + (j)]
+#define COST(i, j)	((u64)sz[(j) - 1] * (C[j] - C[(i) - 1]) - (W[j] - W[(i) - 1]))
+	C = kvcalloc(m + 1, sizeof(u64), GFP_KERNEL);
+	W = kvcalloc(m + 1, sizeof(u64), GFP_KERNEL);
+	dp = kvmalloc_array((K + 1) * (m + 1), sizeof(u64), GFP_KERNEL);
+	from = kvmalloc_array((K + 1) * (m + 1), sizeof(u16), GFP_KERNEL);
+	if (!C || !W || !dp || !from)
+		goto out;
+
+	for (j = 1; j <= m; j++) {
+		C[j] = C[j - 1] + cnt[j - 1];
+		W[j] = W[j - 1] + cnt[j - 1] * sz[j - 1];
+	}
+	for (j = 0; j <= m; j++)
+		DP(0, j) = j ? U64_MAX : 0;
+	for (k = 1; k <= K; k++) {
+		DP(k, 0) = 0;
+		for (j = 1; j <= m; j++) {
+			DP(k, j) = U64_MAX;
+			for (i = k; i <= j; i++) {
+				if (DP(k - 1, i - 1) == U64_MAX)
+					continue;
+				v = DP(k - 1, i - 1) + COST(i, j);
+				if (v < DP(k, j)) {
+					DP(k, j) = v;
+					FROM(k, j) = i;
+				}
+			}
+		}
+		cond_resched();
+	}
+	pr_info("histogram: %d distinct sizes, %llu allocations; best %d classes waste %llu bytes\n",
+		m, C[m], K, DP(K, m));
+
+	/* backtrack: class k covers sizes FROM(k, j)..j */
+	for (k = K, j = m; k >= 1; k--) {
+		sizes[k - 1] = sz[j - 1];
+		j = FROM(k, j) - 1;
+	}
+	ret = install_classes(sizes, K);
+ out:
+	kvfree(from);
+	kvfree(dp);
+	kvfree(W);
+	kvfree(C);
+	return ret;
+#undef COST
+#undef FROM
+#undef DP
+}
+
+/*
+ * Build the classes from a histogram of 8-byte buckets: @buckets[b] is the
+ * # of requests of (b * 8 - 7) to (b * 8) bytes, for b in 1..@nb-1.
+ */
+static int build_from_buckets(const u64 *buckets, int nb)
+{
+	unsigned int *sz;
+	u64 *cnt;
+	int b, m = 0, ret = -ENOMEM;
+
+	sz = kvmalloc_array(nb, sizeof(*sz), GFP_KERNEL);
+	cnt = kvmalloc_array(nb, sizeof(*cnt), GFP_KERNEL);
+	if (!sz || !cnt)
+		goto out;
+	for (b = 1; b < nb; b++) {
+		if (!buckets[b])
+			continue;
+		sz[m] = b * SC_ALIGN;
+		cnt[m++] = buckets[b];
+	}
+	ret = m ? build_from_hist(sz, cnt, m) : -ENODATA;
+ out:
+	kvfree(cnt);
+	kvfree(sz);
+	return ret;
+}
+
+static int nr_buckets(void)
+{
+	return ALIGN(max_size, SC_ALIGN) / SC_ALIGN + 1;
+}
+
+/* The 'hist' module parameter: "size:count,size:count,..." */
+static int build_from_hist_param(void)
+{
+	char *buf, *s, *tok;
+	unsigned int size, count;
+	u64 *buckets;
+	int ret = -ENOMEM;
+
+	buckets = kvcalloc(nr_buckets(), sizeof(u64), GFP_KERNEL);
+	buf = kstrdup(hist, GFP_KERNEL);
+	if (!buckets || !buf)
+		goto out;
+	s = buf;
+	while ((tok = strsep(&s, ",")) != NULL) {
+		if (!*tok)
+			continue;
+		if (sscanf(tok, "%u:%u", &size, &count) != 2 || !size) {
+			pr_warn("bad histogram entry \"%s\"\n", tok);
+			ret = -EINVAL;
+			goto out;
+		}
+		if (size <= max_size)
+			buckets[DIV_ROUND_UP(size, SC_ALIGN)] += count;
+	}
+	ret = build_from_buckets(buckets, nr_buckets());
+ out:
+	kfree(buf);
+	kvfree(buckets);
+	return ret;
+}
+
+static int build_from_trace(void)
+{
+	u64 *buckets;
+	int i, ret;
+
+	if (!trace_len)
+		return -ENODATA;
+	buckets = kvcalloc(nr_buckets(), sizeof(u64), GFP_KERNEL);
+	if (!buckets)
+		return -ENOMEM;
+	for (i = 0; i < trace_len; i++)
+		if (trace[i] <= max_size)
+			buckets[DIV_ROUND_UP(trace[i], SC_ALIGN)]++;
+	ret = build_from_buckets(buckets, nr_buckets());
+	kvfree(buckets);
+	return ret;
+}
+
+/*------------------------------- The trace --------------------------------*/
+/*
+ * Parse one trace line: 'size [count]' or an ftrace kmalloc event line.
+ * For the latter, we match the event name field (f.e. "...: kmalloc: call_site=")
+ * as the call site symbol itself may well contain "kmalloc" (kmalloc_reserve
+ * and the like, in a kmem_cache_alloc event).
+ */
+static void trace_add_line(char *line)
+{
+	unsigned int size = 0, count = 1;
+	char *p = strstr(line, "bytes_req=");
+
+	if (p) {
+		if ((!strstr(line, ": kmalloc:") && !strstr(line, ": kmalloc_node:")) ||
+		    sscanf(p + 10, "%u", &size) != 1)
+			return;
+	} else {
+		line = skip_spaces(line);
+		if (!*line || *line == '#' || sscanf(line, "%u %u", &size, &count) < 1)
+			return;
+	}
+	if (size > KMALLOC_MAX_SIZE) {	/* we'd only trip the page allocator's WARN */
+		trace_rejected++;
+		return;
+	}
+	while (size && count-- && trace_len < trace_max)
+		trace[trace_len++] = size;
+}
+
+/*
+ * A partial line, carried over to the next write; room enough for a full
+ * ftrace kmalloc line. A line that's longer still is rejected (skipped up to
+ * it's newline and counted), not truncated.
+ */
+static char carry[512];
+static bool carry_skip;		/* skipping the rest of an overlong line */
+
+static ssize_t trace_write(struct file *filp, const char __user *ubuf,
+			   size_t count, loff_t *off)
+{
+	char *kbuf, *s, *line;
+	size_t clen;
+
+	mutex_lock(&sc_mtx);
+	if (*off == 0) {	/* a new trace */
+		trace_len = 0;
+		trace_rejected = 0;
+		carry[0] = '\0';
+		carry_skip = false;
+	}
+	clen = strlen(carry);
+	kbuf = kvmalloc(clen + count + 1, GFP_KERNEL);
+	if (!kbuf) {
+		mutex_unlock(&sc_mtx);
+		return -ENOMEM;
+	}
+	memcpy(kbuf, carry, clen);
+	if (copy_from_user(kbuf + clen, ubuf, count)) {
+		kvfree(kbuf);
+		mutex_unlock(&sc_mtx);
+		return -EFAULT;
+	}
+	kbuf[clen + count] = '\0';
+	carry[0] = '\0';
+
+	s = kbuf;
+	while ((line = strsep(&s, "\n")) != NULL) {
+		if (!s) {	/* the last, possibly partial, line */
+			if (carry_skip)
+				break;
+			if (strscpy(carry, line, sizeof(carry)) < 0) {
+				carry[0] = '\0';
+				carry_skip = true;
+				trace_rejected++;
+			}
+			break;
+		}
+		if (carry_skip) {	/* the tail of an overlong line */
+			carry_skip = false;
+			continue;
+		}
+		trace_add_line(line);
+	}
+	kvfree(kbuf);
+	*off += count;
+	mutex_unlock(&sc_mtx);
+	return count;
+}
+
+/* On close, the last line (if it had no newline) is complete */
+static int trace_release(struct inode *inode, struct file *filp)
+{
+	mutex_lock(&sc_mtx);
+	if (carry[0])
+		trace_add_line(carry);
+	carry[0] = '\0';
+	carry_skip = false;
+	pr_info("trace: %d allocations (%d lines rejected)\n", trace_len, trace_rejected);
+	mutex_unlock(&sc_mtx);
+	return 0;
+}
+
+/*------------------------------- The bench --------------------------------*/
+/*
+ * Replay the trace, keeping up to @win objects live (FIFO); @sc selects our
+ * allocator or kmalloc(). Returns the ns taken.
+ */
+static u64 replay(bool sc, void **ring, u32 *ringsz, int win)
+{
+	u64 t0 = ktime_get_ns(), ns;
+	int i, slot;
+
+	memset(ring, 0, win * sizeof(void *));
+	for (i = 0; i < trace_len; i++) {
+		slot = i % win;
+		if (ring[slot]) {
+			if (sc)
+				sc_free(ring[slot], ringsz[slot]);
+			else
+				kfree(ring[slot]);
+		}
+		ringsz[slot] = trace[i];
+		ring[slot] = sc ? sc_alloc(trace[i], GFP_KERNEL) : kmalloc(trace[i], GFP_KERNEL);
+		if (!(i & 1023))
+			cond_resched();
+	}
+	ns = ktime_get_ns() - t0;
+
+	for (slot = 0; slot < win; slot++) {
+		if (!ring[slot])
+			continue;
+		if (sc)
+			sc_free(ring[slot], ringsz[slot]);
+		else
+			kfree(ring[slot]);
+	}
+	return ns;
+}
+
+/* Our waste over the whole trace (kmalloc fallbacks counted via ksize()) */
+static u64 sizeclass_waste(void)
+{
+	struct sc_class *c;
+	u64 waste = 0;
+	void *p;
+	int i;
+
+	for (i = 0; i < trace_len; i++) {
+		c = sc_lookup(trace[i]);
+		if (c) {
+			waste += c->size - trace[i];
+		} else {
+			p = kmalloc(trace[i], GFP_KERNEL);
+			if (p) {
+				waste += ksize(p) - trace[i];
+				kfree(p);
+			}
+		}
+	}
+	return waste;
+}
+
+/* kmalloc's waste over the whole trace: ksize() of a throwaway allocation per size */
+static u64 kmalloc_waste(void)
+{
+	u64 waste = 0;
+	size_t last = 0, lastk = 0;
+	void *p;
+	int i;
+
+	for (i = 0; i < trace_len; i++) {
+		if (trace[i] != last) {
+			p = kmalloc(trace[i], GFP_KERNEL);
+			if (!p)
+				continue;
+			lastk = ksize(p);
+			kfree(p);
+			last = trace[i];
+		}
+		waste += lastk - trace[i];
+	}
+	return waste;
+}
+
+static int run_bench(void)
+{
+	u64 ns_sc, ns_km, w_sc, w_km, req = 0;
+	void **ring;
+	u32 *ringsz;
+	int i, win = window;
+
+	if (!trace_len)
+		return -ENODATA;
+	if (win < 1)
+		return -EINVAL;
+	ring = kvcalloc(win, sizeof(void *), GFP_KERNEL);
+	ringsz = kvcalloc(win, sizeof(u32), GFP_KERNEL);
+	if (!ring || !ringsz) {
+		kvfree(ringsz);
+		kvfree(ring);
+		return -ENOMEM;
+	}
+	for (i = 0; i < trace_len; i++)
+		req += trace[i];
+
+	replay(true, ring, ringsz, win);	/* warm up */
+	ns_sc = replay(true, ring, ringsz, win);
+	ns_km = replay(false, ring, ringsz, win);
+	w_sc = sizeclass_waste();
+	w_km = kmalloc_waste();
+
+	snprintf(bench_results, PAGE_SIZE,
+		 "trace: %d allocations, %llu bytes requested; window %d; %d size classes\n"
+		 "%-16s %12s %16s %8s\n"
+		 "%-16s %12llu %16llu %7llu%%\n"
+		 "%-16s %12llu %16llu %7llu%%\n",
+		 trace_len, req, win, nr_classes,
+		 "allocator", "ns/alloc", "bytes wasted", "waste",
+		 "sizeclass", div_u64(ns_sc, trace_len), w_sc,
+		 div64_u64(w_sc * 100, req + w_sc),
+		 "kmalloc", div_u64(ns_km, trace_len), w_km,
+		 div64_u64(w_km * 100, req + w_km));
+	pr_info("\n%s", bench_results);
+	kvfree(ringsz);
+	kvfree(ring);
+	return 0;
+}
+
+/*------------------------------ debugfs -----------------------------------*/
+static int classes_show(struct seq_file *seq, void *v)
+{
+	long live, live_req, allocs;
+	int i;
+
+	mutex_lock(&sc_mtx);
+	seq_printf(seq, "%d classes; O(1) lookup table of %u entries; %ld kmalloc fallbacks\n",
+		   nr_classes, lut_max / SC_ALIGN + 1, atomic_long_read(&nr_fallback));
+	seq_printf(seq, "%8s %12s %10s %12s %12s %14s\n", "class", "allocs", "live",
+		   "live bytes", "live waste", "total waste");
+	for (i = 0; i < nr_classes; i++) {
+		struct sc_class *c = &classes[i];
+
+		allocs = atomic_long_read(&c->allocs);
+		live = atomic_long_read(&c->live);
+		live_req = atomic_long_read(&c->live_req);
+		seq_printf(seq, "%8u %12ld %10ld %12ld %12ld %14lld\n", c->size, allocs, live,
+			   live * c->size, live * c->size - live_req,
+			   (long long)atomic64_read(&c->waste));
+	}
+	mutex_unlock(&sc_mtx);
+	return 0;
+}
+
+static int classes_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, classes_show, NULL);
+}
+
+static ssize_t classes_write(struct file *filp, const char __user *ubuf,
+			     size_t count, loff_t *off)
+{
+	char kbuf[16];
+	int ret;
+
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, ubuf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+	strim(kbuf);
+
+	mutex_lock(&sc_mtx);
+	if (!strcmp(kbuf, "geo"))
+		ret = build_geometric();
+	else if (!strcmp(kbuf, "trace"))
+		ret = build_from_trace();
+	else
+		ret = -EINVAL;
+	mutex_unlock(&sc_mtx);
+	return ret < 0 ? ret : count;
+}
+
+static int bench_show(struct seq_file *seq, void *v)
+{
+	mutex_lock(&sc_mtx);
+	seq_puts(seq, bench_results[0] ? bench_results : "no results yet; write to this file\n");
+	mutex_unlock(&sc_mtx);
+	return 0;
+}
+
+static int bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, bench_show, NULL);
+}
+
+static ssize_t bench_write(struct file *filp, const char __user *ubuf,
+			   size_t count, loff_t *off)
+{
+	int ret;
+
+	mutex_lock(&sc_mtx);
+	ret = run_bench();
+	mutex_unlock(&sc_mtx);
+	return ret < 0 ? ret : count;
+}
+
+static const struct file_operations classes_fops = {
+	.owner = THIS_MODULE,
+	.open = classes_open,
+	.read = seq_read,
+	.write = classes_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct file_operations trace_fops = {
+	.owner = THIS_MODULE,
+	.write = trace_write,
+	.release = trace_release,
+};
+
+static const struct file_operations bench_fops = {
+	.owner = THIS_MODULE,
+	.open = bench_open,
+	.read = seq_read,
+	.write = bench_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init slab_sizeclass_init(void)
+{
+	int ret = -ENOMEM;
+
+	if (nclasses < 1 || nclasses > MAX_CLASSES || min_size < 1 || max_size < min_size ||
+	    max_size > MAX_SIZE_LIMIT || growth_pct < 1 || trace_max < 1) {
+		pr_warn("invalid parameter(s)\n");
+		return -EINVAL;
+	}
+	trace = vmalloc(array_size(trace_max, sizeof(u32)));
+	bench_results = kzalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!trace || !bench_results)
+		goto out_free;
+
+	mutex_lock(&sc_mtx);
+	ret = hist ? build_from_hist_param() : build_geometric();
+	mutex_unlock(&sc_mtx);
+	if (ret < 0)
+		goto out_free;
+
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent)) {
+		pr_warn("debugfs_create_dir failed (is debugfs enabled/mounted?)\n");
+		ret = -ENODEV;
+		goto out_classes;
+	}
+	debugfs_create_file("classes", 0644, gparent, NULL, &classes_fops);
+	debugfs_create_file("trace", 0200, gparent, NULL, &trace_fops);
+	debugfs_create_file("bench", 0644, gparent, NULL, &bench_fops);
+
+	pr_info("%d size classes (%s), %u to %u bytes\n", nr_classes,
+		hist ? "from the histogram" : "geometric", classes[0].size, lut_max);
+	return 0;
+
+ out_classes:
+	destroy_classes();
+ out_free:
+	kfree(bench_results);
+	vfree(trace);
+	return ret;
+}
+
+static void __exit slab_sizeclass_exit(void)
+{
+	debugfs_remove_recursive(gparent);
+	destroy_classes();
+	kfree(bench_results);
+	vfree(trace);
+	pr_info("removed\n");
+}
+
+module_init(slab_sizeclass_init);
+module_exit(slab_sizeclass_exit);